@@ -0,0 +1,150 @@
+/**************************************************************************************
+* Jack Umina
+* Created Nov, 2019
+* Generates a synthetic corpus to benchmark indexing and querying at scale.
+* Usage: ./gen_corpus <dir> [num_docs] [doc_length] [vocab_size] [seed]
+* Writes <dir>/D0.txt .. D<num_docs - 1>.txt. Words are drawn from a vocabulary of
+* vocab_size words with Zipf (s = 1) frequencies, so word i + 1 is about 1 / (i + 1)
+* as frequent as the most common one. Document lengths are uniform between half and
+* one and a half times doc_length words. The same arguments give the same corpus.
+***************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#define DEFAULT_DOCS 20000
+#define DEFAULT_LENGTH 200
+#define DEFAULT_VOCAB 50000
+
+// Longest generated word, well under the tokenizer's limits
+#define MAX_WORD 16
+
+/**
+ * Builds the word of a vocabulary rank. A fixed-width base 26 prefix keeps every
+ * word distinct and a few more letters vary the lengths.
+ * @param word    buffer of at least MAX_WORD + 1 chars
+ * @param rank    rank of the word in the vocabulary
+ * @param digits  width of the prefix, enough for every rank
+ */
+static void make_word (char* word, uint32_t rank, int digits) {
+    int len = 0;
+    uint32_t r = rank;
+    for (int i = 0; i < digits; i++) {
+        word[len++] = 'a' + r % 26;
+        r /= 26;
+    }
+
+    // Common words come out short, like in real text
+    uint32_t h = rank * 2654435761u;
+    int extra = (rank < 100 ? 0 : 1) + h % (MAX_WORD - digits - 1);
+    for (int i = 0; i < extra; i++) {
+        h = h * 1103515245u + 12345;
+        word[len++] = 'a' + (h >> 16) % 26;
+    }
+    word[len] = '\0';
+}
+
+/**
+ * Draws a vocabulary rank from the Zipf distribution.
+ * @param  cdf         cumulative probabilities of the ranks
+ * @param  vocab_size  number of ranks
+ * @param  seed        state of rand_r()
+ * @return the rank
+ */
+static uint32_t draw (const double* cdf, uint32_t vocab_size, unsigned int* seed) {
+    double u = (double) rand_r (seed) / ((double) RAND_MAX + 1);
+    uint32_t lo = 0;
+    uint32_t hi = vocab_size - 1;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (cdf[mid] < u) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+int main (int argc, char** argv) {
+    if (argc < 2) {
+        printf ("Usage: ./gen_corpus <dir> [num_docs] [doc_length] [vocab_size] [seed]\n");
+        return 0;
+    }
+    const char* dir = argv[1];
+    int num_docs = argc > 2 ? atoi (argv[2]) : DEFAULT_DOCS;
+    int doc_length = argc > 3 ? atoi (argv[3]) : DEFAULT_LENGTH;
+    uint32_t vocab_size = argc > 4 ? (uint32_t) atoi (argv[4]) : DEFAULT_VOCAB;
+    unsigned int seed = argc > 5 ? (unsigned int) atoi (argv[5]) : 2019;
+
+    if (num_docs <= 0 || doc_length <= 0 || vocab_size == 0) {
+        printf ("Error: num_docs, doc_length and vocab_size must be positive numbers\n");
+        exit (0);
+    }
+
+    if (mkdir (dir, 0755) != 0 && errno != EEXIST) {
+        printf ("Error in creating %s: %s\n", dir, strerror (errno));
+        exit (0);
+    }
+
+    // Words and the cumulative Zipf distribution over them
+    int digits = 1;
+    for (uint64_t n = 26; n < vocab_size; n *= 26) {
+        digits++;
+    }
+    char* words = (char*) malloc ((size_t) vocab_size * (MAX_WORD + 1));
+    double* cdf = (double*) malloc (vocab_size * sizeof (double));
+    if (words == NULL || cdf == NULL) {
+        printf ("Error: unable to allocate memory for vocabulary\n");
+        exit (0);
+    }
+
+    double sum = 0;
+    for (uint32_t i = 0; i < vocab_size; i++) {
+        make_word (words + (size_t) i * (MAX_WORD + 1), i, digits);
+        sum += 1.0 / (i + 1);
+        cdf[i] = sum;
+    }
+    for (uint32_t i = 0; i < vocab_size; i++) {
+        cdf[i] /= sum;
+    }
+
+    size_t path_size = strlen (dir) + 32;
+    char path[path_size];
+    unsigned long long total_bytes = 0;
+    unsigned long long total_words = 0;
+
+    for (int d = 0; d < num_docs; d++) {
+        snprintf (path, path_size, "%s/D%d.txt", dir, d);
+        FILE* f = fopen (path, "w");
+        if (f == NULL) {
+            printf ("Error in opening %s: %s\n", path, strerror (errno));
+            exit (0);
+        }
+
+        int length = doc_length / 2 + rand_r (&seed) % (doc_length + 1);
+        for (int w = 0; w < length; w++) {
+            const char* word = words + (size_t) draw (cdf, vocab_size, &seed) * (MAX_WORD + 1);
+            fputs (word, f);
+            fputc (w % 12 == 11 ? '\n' : ' ', f);
+            total_bytes += strlen (word) + 1;
+        }
+        total_words += length;
+
+        if (fclose (f) != 0) {
+            printf ("Error in writing %s: %s\n", path, strerror (errno));
+            exit (0);
+        }
+    }
+
+    printf ("gen_corpus: %d documents, %llu words, %.1f MB, %u word vocabulary in %s\n",
+            num_docs, total_words, total_bytes / 1e6, vocab_size, dir);
+
+    free (cdf);
+    free (words);
+    return 0;
+}
@@ -0,0 +1,120 @@
+/**************************************************************************************
+* Jack Umina
+* Created Nov, 2019
+* Measures the size and decode speed of compressed postings lists.
+* Usage: ./postings_bench
+* Builds lists for terms with Zipf-distributed document frequencies over a generated
+* collection, then reports bytes per posting and how fast cursors walk them, both
+* from the in-memory chunks and from the contiguous encoding the index file uses.
+***************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "arena.h"
+#include "postings.h"
+
+#define BENCH_DOCS 100000
+#define BENCH_TERMS 20000
+
+/**
+ * Current time of the monotonic clock.
+ * @return seconds
+ */
+static double now (void) {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main (void) {
+    unsigned int seed = 12345;
+    struct arena a;
+    arena_init (&a, ARENA_CHUNK_SIZE);
+
+    struct postings_list* lists = (struct postings_list*) malloc (BENCH_TERMS * sizeof (struct postings_list));
+    if (lists == NULL) {
+        printf ("Error: unable to allocate memory for lists\n");
+        exit (0);
+    }
+
+    // Term i appears in about BENCH_DOCS / (i + 1) documents, with small tfs
+    uint64_t num_postings = 0;
+    for (int i = 0; i < BENCH_TERMS; i++) {
+        postings_init (&lists[i]);
+        uint32_t df = BENCH_DOCS / (i + 1);
+        uint32_t gap = 2 * (BENCH_DOCS / df) - 1;
+        uint32_t doc = 0;
+        for (uint32_t j = 0; j < df; j++) {
+            doc += 1 + rand_r (&seed) % gap;
+            uint32_t tf = 1 + (rand_r (&seed) % 8 == 0 ? rand_r (&seed) % 20 : 0);
+            postings_append (&a, &lists[i], doc, tf);
+            num_postings++;
+        }
+    }
+
+    // Lay the lists out contiguously like index_write() does
+    uint64_t size = 0;
+    for (int i = 0; i < BENCH_TERMS; i++) {
+        size += postings_size (&lists[i]);
+    }
+    uint8_t* bytes = (uint8_t*) malloc (size);
+    uint64_t* offsets = (uint64_t*) malloc (BENCH_TERMS * sizeof (uint64_t));
+    uint32_t* counts = (uint32_t*) malloc (BENCH_TERMS * sizeof (uint32_t));
+    if (bytes == NULL || offsets == NULL || counts == NULL) {
+        printf ("Error: unable to allocate memory for encoding\n");
+        exit (0);
+    }
+    uint64_t pos = 0;
+    for (int i = 0; i < BENCH_TERMS; i++) {
+        offsets[i] = pos;
+        counts[i] = lists[i].num_encoded + (lists[i].open_tf != 0);
+        pos += postings_write (&lists[i], bytes + pos);
+    }
+
+    // Walk every list, best of 5, summing doc + tf so the loop is not optimized away
+    double best_chunks = 1e9;
+    double best_bytes = 1e9;
+    uint64_t check = 0;
+    for (int run = 0; run < 5; run++) {
+        struct postings_cursor cur;
+
+        double start = now ();
+        for (int i = 0; i < BENCH_TERMS; i++) {
+            postings_open (&cur, &lists[i]);
+            while (postings_next (&cur)) {
+                check += cur.doc + cur.tf;
+            }
+        }
+        double t = now () - start;
+        if (t < best_chunks) {
+            best_chunks = t;
+        }
+
+        start = now ();
+        for (int i = 0; i < BENCH_TERMS; i++) {
+            postings_open_bytes (&cur, bytes + offsets[i], counts[i]);
+            while (postings_next (&cur)) {
+                check += cur.doc + cur.tf;
+            }
+        }
+        t = now () - start;
+        if (t < best_bytes) {
+            best_bytes = t;
+        }
+    }
+
+    printf ("postings: %lu postings in %lu bytes, %.2f bytes/posting (uncompressed doc+tf: 8)\n",
+            (unsigned long) num_postings, (unsigned long) size, (double) size / num_postings);
+    printf ("postings: decode %.0f M postings/s from chunks, %.0f M postings/s from index bytes (best of 5, check %lu)\n",
+            num_postings / best_chunks / 1e6, num_postings / best_bytes / 1e6, (unsigned long) (check & 0xffff));
+
+    free (counts);
+    free (offsets);
+    free (bytes);
+    free (lists);
+    arena_destroy (&a);
+    return 0;
+}
@@ -0,0 +1,165 @@
+/**************************************************************************************
+* Jack Umina
+* Created Nov, 2019
+* Compares exhaustive scoring with MaxScore top-k scoring on an existing index.
+* Usage: ./query_bench [k] [num_queries] [model]
+* Run it where ./search index has built search.idx. Queries of 2-5 terms are drawn
+* from the terms in at least 0.1% of the documents. Every answer is checked to be
+* identical between the two methods. model is tfidf (default), bm25 or bm25:<k1>,<b>.
+* When the index was built with -i, summing its impacts is timed too, and its top k
+* compared with the exact top k of the model the impacts were computed with.
+***************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hashtable.h"
+#include "infoRetrieval.h"
+#include "scoring.h"
+#include "indexfile.h"
+#include "segments.h"
+#include "maxscore.h"
+
+/**
+ * Current time of the monotonic clock.
+ * @return seconds
+ */
+static double now (void) {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main (int argc, char** argv) {
+    int k = argc > 1 ? atoi (argv[1]) : 10;
+    int num_queries = argc > 2 ? atoi (argv[2]) : 1000;
+
+    struct scoring sc;
+    scoring_init (&sc);
+    if (argc > 3 && !scoring_parse (&sc, argv[3])) {
+        printf ("query_bench: model must be tfidf, bm25 or bm25:<k1>,<b>\n");
+        return 0;
+    }
+
+    struct segment_set* set = segments_open (INDEX_FILE, 0);
+    if (set == NULL || set->num_segments == 0) {
+        printf ("query_bench: no %s here, run ./search index first\n", INDEX_FILE);
+        return 0;
+    }
+
+    // Candidate query terms from the first segment
+    const struct index_file* idx = set->segs[0].idx;
+    const char** words = (const char**) malloc ((idx->header->num_slots + 1) * sizeof (char*));
+    if (words == NULL) {
+        printf ("Error: unable to allocate memory for words\n");
+        exit (0);
+    }
+    int num_words = 0;
+    for (uint32_t i = 0; i < idx->header->num_slots; i++) {
+        if (idx->slots[i].df > 0 && idx->slots[i].df * 1000ull >= set->num_live) {
+            words[num_words++] = idx->strings + idx->slots[i].word_offset;
+        }
+    }
+
+    // Build the queries up front
+    unsigned int seed = 4242;
+    char*** queries = (char***) malloc (num_queries * sizeof (char**));
+    int* lens = (int*) malloc (num_queries * sizeof (int));
+    if (queries == NULL || lens == NULL || num_words == 0) {
+        printf ("Error: unable to build queries\n");
+        exit (0);
+    }
+    for (int q = 0; q < num_queries; q++) {
+        lens[q] = 2 + rand_r (&seed) % 4;
+        queries[q] = (char**) malloc (lens[q] * sizeof (char*));
+        for (int j = 0; j < lens[q]; j++) {
+            queries[q][j] = (char*) words[rand_r (&seed) % num_words];
+        }
+    }
+
+    struct query_stats exhaustive_stats;
+    struct query_stats maxscore_stats;
+    memset (&exhaustive_stats, 0, sizeof (exhaustive_stats));
+    memset (&maxscore_stats, 0, sizeof (maxscore_stats));
+    double exhaustive_time = 0;
+    double maxscore_time = 0;
+    int mismatches = 0;
+
+    struct scoring impacts;
+    scoring_init (&impacts);
+    int has_impacts = segments_impacts (set, &impacts);
+    struct scoring exact = impacts;
+    exact.impacts = 0;
+    struct query_stats impact_stats;
+    memset (&impact_stats, 0, sizeof (impact_stats));
+    double impact_time = 0;
+    long impact_hits = 0;
+    long impact_wanted = 0;
+
+    for (int q = 0; q < num_queries; q++) {
+        int n1, n2;
+
+        double start = now ();
+        struct relevancy_score* a = segments_score_exhaustive (set, &sc, queries[q], lens[q], k, &n1, &exhaustive_stats);
+        exhaustive_time += now () - start;
+
+        start = now ();
+        struct relevancy_score* b = maxscore_top_k (set, &sc, queries[q], lens[q], k, &n2, &maxscore_stats);
+        maxscore_time += now () - start;
+
+        // Field by field, the padding in relevancy_score is never written
+        int same = (n1 == n2);
+        for (int i = 0; same && i < n1; i++) {
+            same = (a[i].doc == b[i].doc && a[i].score == b[i].score);
+        }
+        mismatches += !same;
+        free (a);
+        free (b);
+
+        if (has_impacts) {
+            start = now ();
+            struct relevancy_score* c = segments_score_impacts (set, &impacts, queries[q], lens[q], k, &n1, &impact_stats);
+            impact_time += now () - start;
+
+            // How much of the exact top k the quantized scores find
+            struct relevancy_score* d = maxscore_top_k (set, &exact, queries[q], lens[q], k, &n2, NULL);
+            for (int i = 0; i < n2; i++) {
+                for (int j = 0; j < n1; j++) {
+                    if (c[j].doc == d[i].doc) {
+                        impact_hits++;
+                        break;
+                    }
+                }
+            }
+            impact_wanted += n2;
+            free (c);
+            free (d);
+        }
+    }
+
+    printf ("query_bench: %d queries, k = %d, %s, %u documents, %d mismatches\n",
+            num_queries, k, sc.model == SCORE_BM25 ? "bm25" : "tfidf", set->num_live, mismatches);
+    printf ("  exhaustive: %8.1f us/query, %lu postings decoded\n",
+            exhaustive_time / num_queries * 1e6, (unsigned long) exhaustive_stats.postings_decoded);
+    printf ("  maxscore:   %8.1f us/query, %lu of %lu postings decoded, %lu documents scored, %lu skipped\n",
+            maxscore_time / num_queries * 1e6, (unsigned long) maxscore_stats.postings_decoded,
+            (unsigned long) maxscore_stats.postings_total, (unsigned long) maxscore_stats.docs_scored,
+            (unsigned long) maxscore_stats.docs_pruned);
+    if (has_impacts) {
+        printf ("  impacts:    %8.1f us/query, %lu postings decoded, %.1f%% of the exact %s top k found\n",
+                impact_time / num_queries * 1e6, (unsigned long) impact_stats.postings_decoded,
+                impact_wanted > 0 ? 100.0 * impact_hits / impact_wanted : 100.0,
+                impacts.model == SCORE_BM25 ? "bm25" : "tfidf");
+    }
+
+    for (int q = 0; q < num_queries; q++) {
+        free (queries[q]);
+    }
+    free (queries);
+    free (lens);
+    free (words);
+    segments_close (set);
+    return 0;
+}
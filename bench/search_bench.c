@@ -0,0 +1,275 @@
+/**************************************************************************************
+* Jack Umina
+* Created Nov, 2019
+* End to end benchmark: indexes a directory of text files and times queries on it.
+* Usage: ./search_bench [-j workers] [-m model] [-q num_queries] [-k results] [-o json] <dir>
+* Trains on the .txt files in <dir>, writes the index to <dir>/search.idx, then answers
+* num_queries queries (default 2000) of 1, 3 and 10 terms each from the index. Query
+* terms are drawn from the words in at least 0.1% of the documents. Reports indexing
+* throughput, peak RSS and per-query latency percentiles, and writes them as JSON to
+* the -o file (default bench_results.json) so runs can be compared across versions.
+***************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <glob.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#include "hashtable.h"
+#include "infoRetrieval.h"
+#include "indexfile.h"
+#include "parallelTrain.h"
+#include "segments.h"
+#include "sort.h"
+
+#define NUM_MIXES 3
+
+// Number of terms in the queries of each mix
+static const int mix_terms[NUM_MIXES] = {1, 3, 10};
+
+/**
+ * Current time of the monotonic clock.
+ * @return seconds
+ */
+static double now (void) {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Largest resident set size of the process so far.
+ * @return kilobytes
+ */
+static long peak_rss_kb (void) {
+    struct rusage usage;
+    getrusage (RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+/**
+ * Compares two latencies, for qsort().
+ * @param  a pointer to the first double
+ * @param  b pointer to the second double
+ * @return negative, zero or positive as a is less than, equal to or greater than b
+ */
+static int double_comparator (const void* a, const void* b) {
+    double x = *(const double*) a;
+    double y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Latency at a percentile of a sorted array.
+ * @param  sorted  latencies in increasing order
+ * @param  n       number of latencies
+ * @param  p       percentile, 0 to 100
+ * @return the latency
+ */
+static double percentile (const double* sorted, int n, double p) {
+    int i = (int) (p / 100 * n);
+    return sorted[i < n ? i : n - 1];
+}
+
+struct mix_result {
+    int terms;
+    int num_queries;
+    double mean_us;
+    double p50_us;
+    double p99_us;
+    double p999_us;
+    double max_us;
+    struct query_stats stats;
+};
+
+int main (int argc, char** argv) {
+    int num_workers = 1;
+    int num_queries = 2000;
+    int k = RANK_DEFAULT_K;
+    const char* json_path = "bench_results.json";
+    struct scoring sc;
+    int opt;
+
+    scoring_init (&sc);
+
+    while ((opt = getopt (argc, argv, "j:m:q:k:o:")) != -1) {
+        switch (opt) {
+            case 'j':
+                num_workers = atoi (optarg);
+                break;
+            case 'm':
+                if (!scoring_parse (&sc, optarg)) {
+                    printf ("Error: scoring model must be tfidf, bm25 or bm25:<k1>,<b>\n");
+                    exit (0);
+                }
+                break;
+            case 'q':
+                num_queries = atoi (optarg);
+                break;
+            case 'k':
+                k = atoi (optarg);
+                break;
+            case 'o':
+                json_path = optarg;
+                break;
+            default:
+                printf ("Error: Incorrect format of arguments\n");
+                exit (0);
+        }
+    }
+    if (optind != argc - 1 || num_workers <= 0 || num_queries <= 0 || k < 0) {
+        printf ("Usage: ./search_bench [-j workers] [-m model] [-q num_queries] [-k results] [-o json] <dir>\n");
+        return 0;
+    }
+    const char* dir = argv[optind];
+
+    // Find the corpus
+    double start = now ();
+    size_t dir_len = strlen (dir);
+    char pattern[dir_len + 8];
+    sprintf (pattern, "%s/*.txt", dir);
+    glob_t result;
+    if (glob (pattern, 0, 0, &result) != 0 || result.gl_pathc < 2) {
+        printf ("Error: %s needs at least 2 text files, generate some with ./gen_corpus\n", dir);
+        exit (0);
+    }
+    double glob_s = now () - start;
+
+    unsigned long long corpus_bytes = 0;
+    for (size_t i = 0; i < result.gl_pathc; i++) {
+        struct stat st;
+        if (stat (result.gl_pathv[i], &st) == 0) {
+            corpus_bytes += st.st_size;
+        }
+    }
+
+    // Index it
+    start = now ();
+    struct hashtable* ht = train_files (result.gl_pathv, result.gl_pathc, HT_DEFAULT_BUCKETS, num_workers, 0);
+    double train_s = now () - start;
+    int num_terms = ht->num_elements;
+    long train_rss_kb = peak_rss_kb ();
+
+    unsigned long long num_tokens = 0;
+    for (int i = 0; i < ht->num_docs; i++) {
+        num_tokens += ht->docs[i].length;
+    }
+
+    char index_path[dir_len + 16];
+    sprintf (index_path, "%s/%s", dir, INDEX_FILE);
+    start = now ();
+    segments_rebuild (index_path, ht, NULL);
+    double write_s = now () - start;
+    ht_destroy (ht);
+    globfree (&result);
+
+    start = now ();
+    struct segment_set* set = segments_open (index_path, 0);
+    double open_s = now () - start;
+
+    unsigned long long index_bytes = 0;
+    for (int s = 0; s < set->num_segments; s++) {
+        index_bytes += set->segs[s].idx->size;
+    }
+
+    // Candidate query terms
+    const struct index_file* idx = set->segs[0].idx;
+    const char** words = (const char**) malloc ((idx->header->num_slots + 1) * sizeof (char*));
+    double* latencies = (double*) malloc (num_queries * sizeof (double));
+    char** query = (char**) malloc (mix_terms[NUM_MIXES - 1] * sizeof (char*));
+    if (words == NULL || latencies == NULL || query == NULL) {
+        printf ("Error: unable to allocate memory for queries\n");
+        exit (0);
+    }
+    int num_words = 0;
+    for (uint32_t i = 0; i < idx->header->num_slots; i++) {
+        if (idx->slots[i].df > 0 && idx->slots[i].df * 1000ull >= set->num_live) {
+            words[num_words++] = idx->strings + idx->slots[i].word_offset;
+        }
+    }
+    if (num_words == 0) {
+        printf ("Error: no words common enough to query\n");
+        exit (0);
+    }
+
+    // Time each mix of queries
+    struct mix_result mixes[NUM_MIXES];
+    unsigned int seed = 4242;
+    for (int m = 0; m < NUM_MIXES; m++) {
+        struct mix_result* mix = &mixes[m];
+        memset (mix, 0, sizeof (*mix));
+        mix->terms = mix_terms[m];
+        mix->num_queries = num_queries;
+
+        double total = 0;
+        for (int q = 0; q < num_queries; q++) {
+            for (int j = 0; j < mix->terms; j++) {
+                query[j] = (char*) words[rand_r (&seed) % num_words];
+            }
+
+            int n;
+            start = now ();
+            struct relevancy_score* scores = segments_score (set, &sc, query, mix->terms, k, &n, &mix->stats);
+            latencies[q] = (now () - start) * 1e6;
+            free (scores);
+            total += latencies[q];
+        }
+
+        qsort (latencies, num_queries, sizeof (double), double_comparator);
+        mix->mean_us = total / num_queries;
+        mix->p50_us = percentile (latencies, num_queries, 50);
+        mix->p99_us = percentile (latencies, num_queries, 99);
+        mix->p999_us = percentile (latencies, num_queries, 99.9);
+        mix->max_us = latencies[num_queries - 1];
+    }
+    long rss_kb = peak_rss_kb ();
+
+    printf ("search_bench: %u documents, %.1f MB, %llu tokens, %d terms\n",
+            set->num_live, corpus_bytes / 1e6, num_tokens, num_terms);
+    printf ("  indexing: train %.2f s (%.1f MB/s, %d workers), write %.2f s, open %.4f s, index %.1f MB\n",
+            train_s, corpus_bytes / 1e6 / train_s, num_workers, write_s, open_s, index_bytes / 1e6);
+    printf ("  peak rss: %ld KB after training, %ld KB after queries\n", train_rss_kb, rss_kb);
+    for (int m = 0; m < NUM_MIXES; m++) {
+        printf ("  %2d terms: p50 %7.1f us, p99 %7.1f us, p999 %7.1f us, mean %7.1f us (%d queries, k = %d)\n",
+                mixes[m].terms, mixes[m].p50_us, mixes[m].p99_us, mixes[m].p999_us, mixes[m].mean_us,
+                mixes[m].num_queries, k);
+    }
+
+    FILE* f = fopen (json_path, "w");
+    if (f == NULL) {
+        printf ("Error in opening %s\n", json_path);
+        exit (0);
+    }
+    fprintf (f, "{\n");
+    fprintf (f, "  \"index_version\": %d,\n", INDEX_VERSION);
+    fprintf (f, "  \"model\": \"%s\",\n", sc.model == SCORE_BM25 ? "bm25" : "tfidf");
+    fprintf (f, "  \"corpus\": {\"documents\": %u, \"bytes\": %llu, \"tokens\": %llu, \"terms\": %d},\n",
+            set->num_live, corpus_bytes, num_tokens, num_terms);
+    fprintf (f, "  \"indexing\": {\"workers\": %d, \"glob_s\": %.6f, \"train_s\": %.6f, \"train_mb_per_s\": %.3f, "
+            "\"write_s\": %.6f, \"open_s\": %.6f, \"index_bytes\": %llu},\n",
+            num_workers, glob_s, train_s, corpus_bytes / 1e6 / train_s, write_s, open_s, index_bytes);
+    fprintf (f, "  \"peak_rss_kb\": {\"after_training\": %ld, \"after_queries\": %ld},\n", train_rss_kb, rss_kb);
+    fprintf (f, "  \"queries\": [\n");
+    for (int m = 0; m < NUM_MIXES; m++) {
+        const struct mix_result* mix = &mixes[m];
+        fprintf (f, "    {\"terms\": %d, \"queries\": %d, \"k\": %d, \"mean_us\": %.2f, \"p50_us\": %.2f, "
+                "\"p99_us\": %.2f, \"p999_us\": %.2f, \"max_us\": %.2f, \"docs_scored\": %lu, "
+                "\"postings_decoded\": %lu}%s\n",
+                mix->terms, mix->num_queries, k, mix->mean_us, mix->p50_us, mix->p99_us, mix->p999_us,
+                mix->max_us, (unsigned long) mix->stats.docs_scored, (unsigned long) mix->stats.postings_decoded,
+                m < NUM_MIXES - 1 ? "," : "");
+    }
+    fprintf (f, "  ]\n}\n");
+    fclose (f);
+    printf ("  results written to %s\n", json_path);
+
+    free (query);
+    free (latencies);
+    free (words);
+    segments_close (set);
+    return 0;
+}
@@ -0,0 +1,122 @@
+/**************************************************************************************
+* Jack Umina
+* Created Nov, 2019
+* Measures tokenizer throughput on its own, without any hashtable inserts.
+* Usage: ./tokenizer_bench [file]
+* Without a file, tokenizes 64 MB of generated lowercase and capitalized words.
+***************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tokenizer.h"
+
+/**
+ * Current time of the monotonic clock.
+ * @return seconds
+ */
+static double now (void) {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Fills buf with space and newline separated words of 1-12 letters.
+ * @param buf  buffer to fill
+ * @param len  number of bytes
+ */
+static void generate (char* buf, size_t len) {
+    unsigned int seed = 12345;
+    size_t i = 0;
+
+    while (i < len) {
+        int word_len = 1 + rand_r (&seed) % 12;
+        for (int j = 0; j < word_len && i < len; j++) {
+            char c = 'a' + rand_r (&seed) % 26;
+            buf[i++] = (j == 0 && rand_r (&seed) % 8 == 0) ? c - ('a' - 'A') : c;
+        }
+        if (i < len) {
+            buf[i++] = (rand_r (&seed) % 10 == 0) ? '\n' : ' ';
+        }
+    }
+}
+
+int main (int argc, char** argv) {
+    size_t len = 64 << 20;
+    char* text;
+
+    if (argc > 1) {
+        FILE* f = fopen (argv[1], "rb");
+        if (f == NULL) {
+            printf ("Error in opening %s\n", argv[1]);
+            exit (0);
+        }
+        fseek (f, 0, SEEK_END);
+        len = ftell (f);
+        rewind (f);
+        text = (char*) malloc (len);
+        if (text == NULL || fread (text, 1, len, f) != len) {
+            printf ("Error in reading %s\n", argv[1]);
+            exit (0);
+        }
+        fclose (f);
+    } else {
+        text = (char*) malloc (len);
+        if (text == NULL) {
+            printf ("Error: unable to allocate memory for text\n");
+            exit (0);
+        }
+        generate (text, len);
+    }
+
+    char* buf = (char*) malloc (TOKENIZER_BLOCK);
+    if (buf == NULL) {
+        printf ("Error: unable to allocate memory for buffer\n");
+        exit (0);
+    }
+
+    struct token_list list;
+    token_list_init (&list);
+
+    // Feed the text through block by block like train_document() does,
+    // copying each block so the in-place lowercasing never sees its own output
+    double best = 0;
+    long tokens = 0;
+    for (int run = 0; run < 5; run++) {
+        double start = now ();
+        size_t pos = 0;
+        size_t filled = 0;
+        tokens = 0;
+        while (1) {
+            size_t n = len - pos < TOKENIZER_BLOCK - filled ? len - pos : TOKENIZER_BLOCK - filled;
+            memcpy (buf + filled, text + pos, n);
+            pos += n;
+            filled += n;
+
+            int at_eof = (pos == len);
+            list.num_tokens = 0;
+            size_t consumed = tokenize (buf, filled, at_eof, &list);
+            tokens += list.num_tokens;
+            if (at_eof) {
+                break;
+            }
+            memmove (buf, buf + consumed, filled - consumed);
+            filled -= consumed;
+        }
+        double mbps = len / (now () - start) / 1e6;
+        if (mbps > best) {
+            best = mbps;
+        }
+    }
+
+    printf ("tokenizer: %zu bytes, %ld tokens, %.1f MB/s (best of 5, includes block copy)\n",
+            len, tokens, best);
+
+    token_list_destroy (&list);
+    free (buf);
+    free (text);
+    return 0;
+}
@@ -0,0 +1,67 @@
+/**************************************************************************************
+* Jack Umina
+* Created Nov, 2019
+* Bump-pointer arenas. Everything allocated from one is released together, so
+* tearing down an index takes a handful of frees.
+***************************************************************************************/
+
+#ifndef arena_H
+#define arena_H
+
+#include <stddef.h>
+
+// Default number of bytes requested from malloc at a time
+#define ARENA_CHUNK_SIZE (1 << 20)
+
+struct arena_chunk {
+    struct arena_chunk* next;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
+struct arena {
+    struct arena_chunk* head;
+    size_t chunk_size;
+};
+
+/**
+ * Initialize an empty arena.
+ * @param a           pointer to the arena
+ * @param chunk_size  number of bytes to request from malloc at a time
+ */
+void arena_init (struct arena* a, size_t chunk_size);
+
+/**
+ * Allocates size bytes aligned to align, which must be a power of 2.
+ * @param  a      pointer to the arena
+ * @param  size   number of bytes
+ * @param  align  required alignment
+ * @return pointer to the bytes, valid until arena_destroy()
+ */
+void* arena_alloc (struct arena* a, size_t size, size_t align);
+
+/**
+ * Copies len bytes into the arena followed by a NUL terminator.
+ * @param  a     pointer to the arena
+ * @param  str   bytes to copy, need not be NUL terminated
+ * @param  len   number of bytes
+ * @return pointer to the copy
+ */
+char* arena_strndup (struct arena* a, const char* str, size_t len);
+
+/**
+ * Moves every chunk of src into dst, leaving src empty. Used when objects
+ * allocated in src are handed over to another owner.
+ * @param dst  arena that takes the chunks
+ * @param src  arena to empty
+ */
+void arena_adopt (struct arena* dst, struct arena* src);
+
+/**
+ * Frees every chunk of this arena.
+ * @param a pointer to the arena
+ */
+void arena_destroy (struct arena* a);
+
+#endif
@@ -0,0 +1,33 @@
+/**************************************************************************************
+* Jack Umina
+* Created Nov, 2019
+* Maps dense document numbers to the path and metadata of each indexed document.
+***************************************************************************************/
+
+#ifndef doctable_H
+#define doctable_H
+
+#include <stdint.h>
+
+struct document {
+    char* path;
+    int64_t mtime;
+    uint32_t length;
+};
+
+/**
+ * Creates a document table for the given files. Document i is paths[i].
+ * @param  paths     array of file paths, copied into the table
+ * @param  num_docs  number of paths
+ * @return array of num_docs documents with their modification times filled in
+ */
+struct document* doc_table_create (char** paths, int num_docs);
+
+/**
+ * Deallocate this document table.
+ * @param docs      array of documents
+ * @param num_docs  number of documents
+ */
+void doc_table_destroy (struct document* docs, int num_docs);
+
+#endif
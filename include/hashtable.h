@@ -7,98 +7,202 @@
 #ifndef hashtable_H
 #define hashtable_H
 
-struct docNode {
-    char* doc_id;
-    int tf;
-    struct docNode* next;
-};
+#include <stdint.h>
+#include <stddef.h>
+
+#include "arena.h"
+#include "doctable.h"
+#include "postings.h"
+#include "query.h"
+
+// Capacity used when no bucket hint is given on the command line
+#define HT_DEFAULT_BUCKETS 1024
+
+// The table doubles once num_elements / num_buckets would exceed this ratio
+#define HT_MAX_LOAD 0.7
 
+/**
+ * A slot in the open-addressing table. A slot is empty when word == NULL.
+ * word is the hashtable's own NUL terminated copy of the word, of any length. Its
+ * length and full 64-bit hash are kept with it, so probes compare those before
+ * any bytes and resizes never rehash. positions is only allocated when the
+ * hashtable records positions. term is the word's number in the frozen terms,
+ * only valid while the hashtable is frozen.
+ */
 struct wordNode {
         char* word;
+        uint64_t hash;
         int df;
-        struct docNode* docHead;
-        struct wordNode* next;
+        uint32_t len;
+        uint32_t term;
+        struct postings_list postings;
+        struct positions_list* positions;
+};
+
+/**
+ * The words of a trained hashtable in sorted order, laid out in parallel arrays by
+ * ht_freeze() so the dictionary is walked and scored over contiguous memory.
+ * Term i is strings + word_offset[i], NUL terminated, in df[i] documents, and
+ * idf[i] is its idf once finalize_stats() has cached it, 0 for stop words.
+ * After ht_freeze_postings(), its postings are docs[postings_offset[i]] up to
+ * docs[postings_offset[i + 1]], in increasing order, with their tfs at the same
+ * places in tfs, and lengths[d] is the length of document d. word_offset is NULL
+ * while the hashtable is not frozen, and docs while its postings are not.
+ */
+struct frozen_terms {
+        uint32_t num_terms;
+        char* strings;
+        uint32_t* word_offset;
+        int* df;
+        double* idf;
+        uint64_t* postings_offset;
+        uint32_t* docs;
+        uint32_t* tfs;
+        uint32_t* lengths;
 };
 
+/**
+ * Set positions before inserting any word to also record where each word occurs,
+ * for phrase queries. Once trained, ht_freeze() copies every word in sorted order
+ * into terms, for wildcard and fuzzy queries and for serving, until any word or
+ * posting is added. The terms' cached idfs, and stats_avg_length, the average
+ * document length, are for stats_docs documents under stats_model, and
+ * stats_docs is -1 once they are dropped.
+ */
 struct hashtable {
-        struct wordNode** map;
+        struct wordNode* map;
         int num_buckets;
         int num_elements;
-        char** docIDs;
+        struct document* docs;
         int num_docs;
+        int positions;
+        struct arena words;
+        struct arena postings;
+        struct frozen_terms terms;
+        int stats_docs;
+        enum score_model stats_model;
+        double stats_avg_length;
 };
 
 /**
  * Creates a new hashtable.
- * @param  num_buckets Number of buckets this hashtable should have
+ * @param  num_buckets Hint for the initial number of buckets, rounded up to a power of 2.
+ *                     The table grows on its own, so any positive value is valid.
  * @return pointer to this hashtable
  */
 struct hashtable* ht_create (int num_buckets);
 
 /**
- * Initialize a new docNode with the given parameters.
- * @param docPtr  pointer to the docNode to edit
- * @param doc_id  char* to doc_id word belongs to
- */
-void init_docNode (struct docNode* docPtr, char* doc_id);
-
-/**
- * Initialize a new wordNode with empty fields
+ * Initialize a wordNode slot with empty fields
  * @param wordPtr  pointer to the wordNode to initialize
  */
-void init_empty_wordNode (struct wordNode** wordPtr);
+void init_empty_wordNode (struct wordNode* wordPtr);
 
 /**
  * Initialize a new word node with the given parameters.
+ * @param ht      pointer to the hashtable, its postings arena holds the word's postings
  * @param wordPtr pointer to the wordNode to edit
  * @param word    char* to word we need to add
- * @param doc_id  char* to doc_id word belongs to
+ * @param len     length of word
+ * @param hash    hash_code() of word
+ * @param doc     number of the document word belongs to
  */
-void init_wordNode (struct wordNode* wordPtr, char* word, char* doc_id);
+void init_wordNode (struct hashtable* ht, struct wordNode* wordPtr, char* word, size_t len, uint64_t hash,
+        uint32_t doc);
 
 /**
- * (1) Inserts this word and doc_id pair into hashtable along with the
- *     corresponding docNode for which this word occurs in.
- * (2) If the word and doc_id pair already exists, update its tf.
+ * (1) Inserts this word and doc pair into hashtable along with the
+ *     corresponding posting for which this word occurs in.
+ * (2) If the word and doc pair already exists, update its tf.
  * (3) If the word exists but in a different document,
- *     add new doc_id and update its df.
+ *     add new doc and update its df.
+ * Documents must be inserted in increasing order of doc, so only the last posting
+ * of a word ever needs to be checked. The word is copied the first time it is seen.
  * @param ht      pointer to the hashtable
- * @param word    char* to word we need to add
- * @param doc_id  char* to doc_id word belongs to
+ * @param word    first byte of the word, need not be NUL terminated
+ * @param len     length of the word
+ * @param doc     number of the document word belongs to, its index in ht->docs
+ * @param pos     number of the token within the document, kept if ht->positions
  */
-void ht_insert (struct hashtable* ht, char* word, char* doc_id);
+void ht_insert (struct hashtable* ht, const char* word, size_t len, uint32_t doc, uint32_t pos);
 
 /**
- * Deallocate the given list of docNodes.
- * @param docPtr pointer to head of the list
+ * Finds the entry for this word, adding it with df = 0 and no postings if it is
+ * missing. The word is copied into ht->words when it is added, with an empty
+ * positions list if ht->positions. The caller changes the entry's df and
+ * postings, so the hashtable is no longer frozen.
+ * @param ht      pointer to the hashtable
+ * @param word    first byte of the word, need not be NUL terminated
+ * @param len     length of the word
+ * @param hash    hash_code() of word
+ * @return pointer to the word's entry, valid until the next insert
+ */
+struct wordNode* ht_add_word (struct hashtable* ht, const char* word, size_t len, uint64_t hash);
+
+/**
+ * Doubles the number of buckets and re-inserts every word using its stored hash.
+ * @param ht pointer to the hashtable
+ */
+void ht_grow (struct hashtable* ht);
+
+/**
+ * Copies the words of a trained hashtable into ht->terms in sorted order, the
+ * frozen dictionary that ht_expand() searches, with their dfs. Adding a word or a
+ * posting drops it again.
+ * @param ht pointer to the hashtable
+ */
+void ht_freeze (struct hashtable* ht);
+
+/**
+ * Decodes the postings of a frozen hashtable into ht->terms, one slice of doc
+ * numbers and tfs per term, and copies the document lengths next to them, for
+ * scoring many queries. The postings lists are kept for phrase queries.
+ * @param ht pointer to the hashtable, frozen with ht_freeze()
  */
-void destroy_docList (struct docNode* docPtr);
+void ht_freeze_postings (struct hashtable* ht);
 
 /**
- * Deallocate the given list of wordNodes.
- * @param wordPtr pointer to head of the list
+ * Finds the words a wildcard or fuzzy word matches in the frozen dictionary, see
+ * query_dict_expand().
+ * @param  ht         pointer to the hashtable, frozen with ht_freeze()
+ * @param  w          pointer to the wildcard
+ * @param  words      array of at least max_words words to fill in, in sorted order
+ * @param  max_words  most words to find
+ * @return number of words found
  */
-void destroy_wordList (struct wordNode* wordPtr);
+int ht_expand (const struct hashtable* ht, const struct query_wildcard* w, char** words, int max_words);
 
 /**
- * Deallocate this hashtable.
+ * Deallocate this hashtable, including its document table. Words and postings
+ * are released a whole arena chunk at a time.
  * @param ht pointer to hashtable
  */
 void ht_destroy (struct hashtable* ht);
 
 /**
- * Hashing function to determine which bucket this word belongs in.
- * @param ht      pointer to the hashtable
- * @param word    char* to word we need to add
- * @return the hash code of this word and doc_id pair
+ * 64-bit hash of the first len bytes of word.
+ * @param word    bytes to hash
+ * @param len     number of bytes
+ * @return the hash code of this word
+ */
+uint64_t hash_code (const char* word, size_t len);
+
+/**
+ * Searches the given hashtable for a word whose length and hash are already known,
+ * such as a word from another hashtable.
+ * @param  ht      pointer to the hashtable to search in
+ * @param  word    first byte of the word, need not be NUL terminated
+ * @param  len     length of the word
+ * @param  hash    hash_code() of word
+ * @return pointer to the wordNode this word belongs, or NULL if it is not present
  */
-int hash_code (struct hashtable* ht, char* word);
+struct wordNode* ht_find (struct hashtable* ht, const char* word, size_t len, uint64_t hash);
 
 /**
  * Searches the given hashtable for this word..
  * @param  ht      pointer to the hashtable to search in
  * @param  word    char* to the word to search for
- * @return pointer to the wordNode this word belongs
+ * @return pointer to the wordNode this word belongs, or NULL if it is not present
  */
 struct wordNode* get_word (struct hashtable* ht, char* word);
 
@@ -0,0 +1,254 @@
+/**************************************************************************************
+* Jack Umina
+* Created Nov, 2019
+* Reads and writes a trained hashtable as a single binary index file that queries
+* can mmap instead of re-training on every run.
+*
+* File layout (native byte order):
+*   index_header
+*   index_doc     docs[num_docs]           document table, path offsets into strings
+*   index_term    slots[num_slots]         open-addressing term directory
+*   index_block   blocks[num_blocks]       each term's postings split into INDEX_BLOCK_SIZE blocks
+*   uint8_t       postings[postings_size]  each term's postings as varints, see postings.h
+*   uint8_t       impacts[]                optional, each posting's score quantized to a byte
+*   uint32_t      block_positions[num_blocks]
+*                                          optional, where each block's positions start
+*                                          within its term's positions
+*   uint32_t      sorted[num_terms]        slot of each term, in sorted order of the words
+*   uint8_t       positions[positions_size]
+*                                          optional, each term's token positions, see postings.h
+*   char          strings[]                NUL terminated words and document paths
+***************************************************************************************/
+
+#ifndef indexfile_H
+#define indexfile_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "postings.h"
+#include "query.h"
+#include "scoring.h"
+
+#define INDEX_FILE "search.idx"
+#define INDEX_MAGIC "IRINDEX"
+#define INDEX_VERSION 7
+
+// Postings per block. Each block records its last doc and max tf, so cursors can
+// skip whole blocks and the scorer can bound what a block may contribute.
+#define INDEX_BLOCK_SIZE 64
+
+// Doc of a cursor that has run past the end of its postings
+#define INDEX_END UINT32_MAX
+
+struct index_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_docs;
+    uint32_t num_terms;
+    uint32_t num_slots;
+    uint32_t impacts;
+    uint32_t impact_model;
+    uint32_t positions;
+    uint32_t unused;
+    double impact_k1;
+    double impact_b;
+    double impact_scale;
+    uint64_t num_postings;
+    uint64_t postings_size;
+    uint64_t num_blocks;
+    uint64_t docs_offset;
+    uint64_t slots_offset;
+    uint64_t blocks_offset;
+    uint64_t postings_offset;
+    uint64_t impacts_offset;
+    uint64_t positions_size;
+    uint64_t block_positions_offset;
+    uint64_t sorted_offset;
+    uint64_t positions_offset;
+    uint64_t strings_offset;
+    uint64_t file_size;
+    uint64_t body_checksum;
+    uint64_t header_checksum;
+};
+
+/**
+ * A term directory slot, probed exactly like the hashtable. Empty when df == 0.
+ * When the index has impacts, the term's df impacts start at impacts_offset, and
+ * when it has positions, the term's positions start at positions_offset.
+ */
+struct index_term {
+    uint64_t hash;
+    uint64_t word_offset;
+    uint64_t postings_offset;
+    uint64_t blocks_offset;
+    uint64_t impacts_offset;
+    uint64_t positions_offset;
+    uint32_t df;
+    uint32_t word_len;
+    uint32_t max_tf;
+    uint32_t unused;
+};
+
+/**
+ * A run of INDEX_BLOCK_SIZE postings of a term, the last block may be shorter.
+ * The block's first doc gap is relative to the previous block's last_doc.
+ */
+struct index_block {
+    uint32_t last_doc;
+    uint32_t offset;
+    uint32_t max_tf;
+};
+
+struct index_doc {
+    uint64_t path_offset;
+    int64_t mtime;
+    uint32_t length;
+    uint32_t unused;
+};
+
+/**
+ * A read-only view of an index file mapped into memory.
+ */
+struct index_file {
+    void* base;
+    size_t size;
+    const struct index_header* header;
+    struct document* docs;
+    const struct index_term* slots;
+    const struct index_block* blocks;
+    const uint8_t* postings;
+    const uint8_t* impacts;
+    const uint32_t* block_positions;
+    const uint32_t* sorted;
+    const uint8_t* positions;
+    const char* strings;
+};
+
+/**
+ * Serializes a trained hashtable into an index file. The file is written to a
+ * temporary name and renamed into place so readers never see a partial index.
+ * Positions are stored when the hashtable recorded them.
+ * @param ht       pointer to the trained hashtable
+ * @param path     name of the file to create
+ * @param impacts  model to precompute impacts with, from this file's own statistics,
+ *                 or NULL to store none
+ */
+void index_write (struct hashtable* ht, const char* path, const struct scoring* impacts);
+
+/**
+ * Maps an index file into memory and validates its header and the offsets in its
+ * layout. The document table is the only part copied out of the mapping, its paths
+ * still point into it.
+ * @param  path    name of the index file
+ * @param  verify  when non-zero, also checksum the whole body (reads every page)
+ * @return pointer to the mapped index, or NULL if the file does not exist
+ */
+struct index_file* index_open (const char* path, int verify);
+
+/**
+ * Reads back the model an index file's impacts were computed with.
+ * @param  idx  pointer to the mapped index
+ * @param  sc   pointer to the scoring settings to fill in
+ * @return 1 if the index has impacts, 0 if it has none and sc is untouched
+ */
+int index_impacts (const struct index_file* idx, struct scoring* sc);
+
+/**
+ * Unmaps the index file and frees the view.
+ * @param idx pointer to the mapped index
+ */
+void index_close (struct index_file* idx);
+
+/**
+ * Searches the term directory for this word.
+ * @param  idx   pointer to the mapped index
+ * @param  word  char* to the word to search for
+ * @return pointer to the term's slot, or NULL if the word is not indexed
+ */
+const struct index_term* index_lookup (const struct index_file* idx, const char* word);
+
+/**
+ * Finds the words a wildcard or fuzzy word matches among the sorted terms, see
+ * query_dict_expand().
+ * @param  idx        pointer to the mapped index
+ * @param  w          pointer to the wildcard
+ * @param  words      array of at least max_words words to fill in, in sorted order,
+ *                    pointing into the mapping
+ * @param  max_words  most words to find
+ * @return number of words found
+ */
+int index_expand (const struct index_file* idx, const struct query_wildcard* w, char** words, int max_words);
+
+/**
+ * Walks one term's postings in an index file, able to skip whole blocks.
+ */
+struct index_cursor {
+    struct postings_cursor postings;
+    const uint8_t* bytes;
+    const struct index_block* blocks;
+    uint32_t num_blocks;
+    uint32_t df;
+    uint32_t next;
+    uint32_t block;
+    uint32_t shallow;
+    uint32_t doc;
+    uint32_t tf;
+    uint64_t decoded;
+};
+
+/**
+ * Positions a cursor on the first posting of a term.
+ * @param cur   pointer to the cursor
+ * @param idx   pointer to the mapped index
+ * @param term  pointer to the term's slot
+ */
+void index_cursor_open (struct index_cursor* cur, const struct index_file* idx, const struct index_term* term);
+
+/**
+ * Moves the cursor to the next posting.
+ * @param  cur pointer to the cursor
+ * @return 1 if there was another posting, 0 at the end (cur->doc is then INDEX_END)
+ */
+static inline int index_cursor_next (struct index_cursor* cur) {
+    if (cur->next == cur->df) {
+        cur->doc = INDEX_END;
+        return 0;
+    }
+    postings_next (&cur->postings);
+    cur->block = cur->next / INDEX_BLOCK_SIZE;
+    cur->next++;
+    cur->decoded++;
+    cur->doc = cur->postings.doc;
+    cur->tf = cur->postings.tf;
+    return 1;
+}
+
+/**
+ * Moves the cursor to the first posting with a doc of at least target, skipping
+ * blocks that end before it without decoding them. The block is found by galloping,
+ * so a seek far ahead costs the log of the blocks skipped.
+ * @param  cur     pointer to the cursor
+ * @param  target  doc to move to
+ * @return 1 if such a posting exists, 0 at the end (cur->doc is then INDEX_END)
+ */
+int index_cursor_seek (struct index_cursor* cur, uint32_t target);
+
+/**
+ * Largest tf the cursor's term can have in target, from the block that would hold
+ * it. Never decodes postings, and target must not decrease between calls.
+ * @param  cur     pointer to the cursor
+ * @param  target  doc to bound
+ * @return max tf of the block covering target, 0 if target is past the last posting
+ */
+static inline uint32_t index_cursor_block_max (struct index_cursor* cur, uint32_t target) {
+    if (cur->shallow < cur->block) {
+        cur->shallow = cur->block;
+    }
+    while (cur->shallow < cur->num_blocks && cur->blocks[cur->shallow].last_doc < target) {
+        cur->shallow++;
+    }
+    return cur->shallow < cur->num_blocks ? cur->blocks[cur->shallow].max_tf : 0;
+}
+
+#endif
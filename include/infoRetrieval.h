@@ -1,44 +1,57 @@
 /**************************************************************************************
 * Jack Umina
 * Created Nov, 2019
-* Handles processes of populating the hashtable, removing stop words, reading the
-* search-query, and ranking the documents by relevancy.
+* Handles processes of populating the hashtable, scoring the documents against a
+* query while skipping stop words, and ranking them by relevancy.
 ***************************************************************************************/
 
 #ifndef infoRetrieval_H
 #define infoRetrieval_H
 
+#include <stdint.h>
+
+#include "query.h"
+#include "scoring.h"
+
+// What output_results() writes, see output_select()
+#define OUTPUT_DOCUMENT 1
+#define OUTPUT_SCORES 2
+#define OUTPUT_ALL (OUTPUT_DOCUMENT | OUTPUT_SCORES)
+
+// Bytes copied at a time when a document cannot be sent with sendfile()
+#define OUTPUT_BLOCK_SIZE (64 << 10)
+
+// Bytes of search_scores.txt formatted before each write
+#define OUTPUT_SCORES_BUFFER (1 << 20)
+
+// Longest score as printf ("%f") writes it, the largest double has 309 digits
+#define OUTPUT_SCORE_MAX 320
+
 struct relevancy_score {
-    char* doc_id;
+    uint32_t doc;
     double score;
 };
 
 /**
- * Computes the idf of the given word.
- * idf = log (N / df) ,
- * where N = number of documents in hashtable, and df = document frequency
- * @param  wn pointer to a wordNode
- * @return the computed idf
+ * Checks whether a word is a stop word, one that appears in every document and so
+ * has an idf of 0. Decided from the current statistics rather than at training time.
+ * @param  df        number of documents containing the word
+ * @param  num_docs  number of documents searched
+ * @return 1 if the word should be ignored, 0 otherwise
  */
-double get_idf (struct hashtable* ht, struct wordNode* wordPtr);
+int is_stop_word (uint64_t df, uint64_t num_docs);
 
 /**
- * Searches the given hashtable for this word and doc_id pair.
- * @param  ht      pointer to the hashtable to search in
- * @param  word    char* to the word to search for
- * @param  doc_id  char* to the document this word belongs in
- * @return the tf of this word in this doc_id
- */
-int get_tf (struct wordNode* wordPtr, char* doc_id);
-
-/**
- * Removes all words in hash table whose idf = 0.
- * @param ht pointer to the hashtable
+ * Reads one document and adds each of its words to the hashtable.
+ * @param  ht    pointer to the hashtable
+ * @param  doc   pointer to the document's entry in the document table, its length is filled in
+ * @param  i     number of the document
  */
-void stop_words (struct hashtable* ht);
+void train_document (struct hashtable* ht, struct document* doc, uint32_t i);
 
 /**
- * Takes a set of documents and populates the hashtable.
+ * Takes a set of documents and populates the hashtable. Stop words are kept, they
+ * are skipped at query time instead so the index stays valid as documents change.
  * @param  ht    pointer to the hashtable
  */
 void train (struct hashtable* ht);
@@ -50,37 +63,79 @@ void train (struct hashtable* ht);
 void str_tolower (char* str);
 
 /**
- * Reads in search query from user at console.
- * @param str        the string that needs to be split into separate words
- * @paran query_len  parameter will hold the length of the search_query
- * @return array of strings where each string is each search term
+ * Caches the idf of every frozen term under the scoring model, 0 for stop words,
+ * and the average document length, so queries read them instead of taking a
+ * logarithm for each term and summing every document's length. Call it once
+ * training is done. It only recomputes them when the number of documents or the
+ * model changed since the last call, and the hashtable must not be scored from
+ * other threads meanwhile.
+ * @param ht  pointer to the trained hashtable, frozen with ht_freeze()
+ * @param sc  pointer to the scoring settings
  */
-char** read_query (char* str, int* query_len);
+void finalize_stats (struct hashtable* ht, const struct scoring* sc);
 
 /**
- * Computes the tf-idf score for this document and givens set of search terms
+ * Computes the score of every document for the given set of search terms.
+ * Each search term is looked up once and its idf computed once, or read from the
+ * cache finalize_stats() keeps, then its postings are walked once, adding each
+ * posting's score into a dense array indexed by document number, so documents
+ * that contain none of the search terms are never visited. Postings frozen with
+ * ht_freeze_postings() are read straight from their arrays.
  * @param  ht           pointer to the hashtable we are working with
+ * @param  sc           pointer to the scoring settings
  * @param  search_query string array of search terms
  * @param  query_len    length of the search query
- * @param  doc_id       char* to the doc_id we are computing tf-idf for
- * @return              the relevancy score of this doc_id against the given search_query
+ * @return              array of ht->num_docs relevancy scores indexed by document number
  */
-double compute_tf_idf (struct hashtable* ht, char** search_query, int query_len, char* doc_id);
+double* accumulate_scores (struct hashtable* ht, const struct scoring* sc, char** search_query, int query_len);
 
 /**
- * Print the contents of the most relvant document to console and list all files and
- * their scores in order in search_scores.txt
- * @param  ht           pointer to the hashtable we are working with
- * @param scores array of relevancy_scores
+ * Chooses what output_results() writes, so benchmarks can skip printing.
+ * @param which  OUTPUT_DOCUMENT and OUTPUT_SCORES or'd together, 0 for nothing
+ */
+void output_select (int which);
+
+/**
+ * Print the contents of the most relvant document to console and list the ranked
+ * files and their scores in order in search_scores.txt, leaving out whatever
+ * output_select() turned off. The document is copied to stdout by the kernel
+ * where it can be.
+ * @param docs      document table the scores refer to
+ * @param scores    array of relevancy_scores, ranked
+ * @param num_docs  number of entries in scores to write
+ */
+void output_results (const struct document* docs, struct relevancy_score* scores, int num_docs);
+
+/**
+ * Expands every wildcard and fuzzy word of a query with the words of the
+ * hashtable, see query_select_words() and query_expand().
+ * @param ht  pointer to the hashtable, frozen with ht_freeze()
+ * @param sc  pointer to the scoring settings, which choose how fuzzy words are scored
+ * @param q   pointer to the parsed query
  */
-void output_results (struct hashtable* ht, struct relevancy_score* scores);
+void expand_query (struct hashtable* ht, const struct scoring* sc, struct query* q);
 
 /**
- * Ranks the documents in order of their tf-idf scores and outputs results.
+ * Scores the documents against the search query and ranks the best k. Only reads
+ * the hashtable, so several threads may score queries at once. When the query has
+ * a filter, only the documents it matches are ranked.
  * @param  ht            pointer to the hashtable
- * @param  search_query  string array of search terms
- * @param  query_len     length of the search query
+ * @param  sc            pointer to the scoring settings
+ * @param  q             pointer to the parsed query
+ * @param  k             number of top results wanted, 0 ranks every document
+ * @param  num_results   set to the number of ranked entries at the front of the array
+ * @return array of relevancy scores, free it when done
+ */
+struct relevancy_score* score_query (struct hashtable* ht, const struct scoring* sc, const struct query* q,
+        int k, int* num_results);
+
+/**
+ * Ranks the documents in order of their scores and outputs results.
+ * @param  ht  pointer to the hashtable
+ * @param  sc  pointer to the scoring settings
+ * @param  q   pointer to the parsed query
+ * @param  k   number of top results to write, 0 writes every document
  */
-void rank (struct hashtable* ht, char** search_query, int query_len);
+void rank (struct hashtable* ht, const struct scoring* sc, const struct query* q, int k);
 
 #endif
@@ -0,0 +1,41 @@
+/**************************************************************************************
+* Jack Umina
+* Created Nov, 2019
+* Finds the documents a query's filter matches: its Boolean operators, phrases and
+* NEAR/k constraints (see query.h). Every node of the filter moves forward through
+* the documents it matches, seeking to a target instead of visiting each one. An
+* AND leapfrogs its operands to the largest document either is on, and seeking an
+* index file's postings gallops over whole blocks, so an AND of a rare and a common
+* word costs about the length of the rare one. Positions are only decoded for the
+* documents that contain every word of a phrase.
+***************************************************************************************/
+
+#ifndef match_H
+#define match_H
+
+#include <stdint.h>
+
+#include "query.h"
+
+/**
+ * Finds the live documents of a set that match the query's filter. Without
+ * positions in every segment, phrases and NEAR/k constraints match nothing, see
+ * segments_positions().
+ * @param  set          pointer to the set
+ * @param  q            pointer to the parsed query, with a filter
+ * @param  num_matches  set to the number of matching documents
+ * @return sorted array of document numbers across the set, free it when done
+ */
+uint32_t* query_match (const struct segment_set* set, const struct query* q, uint32_t* num_matches);
+
+/**
+ * Finds the documents of a trained hashtable that match the query's filter.
+ * Without positions, phrases and NEAR/k constraints match nothing.
+ * @param  ht           pointer to the hashtable
+ * @param  q            pointer to the parsed query, with a filter
+ * @param  num_matches  set to the number of matching documents
+ * @return sorted array of document numbers, free it when done
+ */
+uint32_t* query_match_ht (struct hashtable* ht, const struct query* q, uint32_t* num_matches);
+
+#endif
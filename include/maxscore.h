@@ -0,0 +1,37 @@
+/**************************************************************************************
+* Jack Umina
+* Created Nov, 2019
+* Document-at-a-time top-k scoring with MaxScore pruning. Each term's largest
+* possible contribution, from its max tf (see scorer_bound()), splits the terms into essential ones, which
+* any document entering the top k must contain, and the rest. Candidates only come
+* from the essential terms, and the block maxima of the other terms bound a
+* candidate's score before their postings are decoded.
+***************************************************************************************/
+
+#ifndef maxscore_H
+#define maxscore_H
+
+// Bounds are inflated by this fraction before comparing them with the top k, so
+// rounding in the sums never prunes a document that belongs there
+#define MAXSCORE_SLACK 1e-9
+
+// Every candidate costs a look at each term, so queries with more terms than this,
+// such as wide wildcards, are cheaper to score exhaustively
+#define MAXSCORE_MAX_TERMS 32
+
+/**
+ * Ranks the best k live documents for the search query without scoring every
+ * document. Gives exactly the same results as segments_score_exhaustive().
+ * @param  set           pointer to the set
+ * @param  sc            pointer to the scoring settings
+ * @param  search_query  string array of search terms
+ * @param  query_len     length of the search query
+ * @param  k             number of top results wanted, must be positive
+ * @param  num_results   set to the number of ranked entries in the array
+ * @param  stats         counters to add this query's work to, may be NULL
+ * @return array of relevancy scores numbered across the set, free it when done
+ */
+struct relevancy_score* maxscore_top_k (const struct segment_set* set, const struct scoring* sc,
+        char** search_query, int query_len, int k, int* num_results, struct query_stats* stats);
+
+#endif
@@ -0,0 +1,30 @@
+/**************************************************************************************
+* Jack Umina
+* Created Nov, 2019
+* Trains the hashtable with several worker threads. Each worker indexes whole
+* documents into its own private shard, then the shards are merged in parallel.
+***************************************************************************************/
+
+#ifndef parallelTrain_H
+#define parallelTrain_H
+
+/**
+ * Takes a set of documents and populates the hashtable using num_workers threads.
+ * Produces the same words, dfs and postings as train().
+ * @param  ht           pointer to the hashtable, must be empty
+ * @param  num_workers  number of threads to index and merge with
+ */
+void train_parallel (struct hashtable* ht, int num_workers);
+
+/**
+ * Creates a hashtable for the given files and trains it.
+ * @param  paths        array of file paths, copied into the document table
+ * @param  num_docs     number of paths
+ * @param  num_buckets  initial bucket hint
+ * @param  num_workers  number of training threads, 1 trains on the calling thread
+ * @param  positions    non-zero to also record token positions, for phrase queries
+ * @return pointer to the trained hashtable
+ */
+struct hashtable* train_files (char** paths, int num_docs, int num_buckets, int num_workers, int positions);
+
+#endif
@@ -0,0 +1,277 @@
+/**************************************************************************************
+* Jack Umina
+* Created Nov, 2019
+* Compressed postings lists. Each posting is stored as two varints, the gap from the
+* previous posting's doc and the tf, so a typical posting takes 2-3 bytes.
+* While training, a list is a chain of arena chunks that double in size, and the
+* newest posting is kept unencoded so its tf can still grow. In the index file a
+* list is the same varints laid out contiguously.
+*
+* A positional index also keeps a positions list next to each postings list: for
+* each posting, its tf token positions as varints, the first one as it is and the
+* rest as gaps from the one before. The positions of a posting are only found by
+* skipping those of the postings before it, see positions_skip().
+***************************************************************************************/
+
+#ifndef postings_H
+#define postings_H
+
+#include <stdint.h>
+
+#include "arena.h"
+
+// Smallest and largest number of encoded bytes in one chunk
+#define POSTINGS_MIN_CHUNK 16
+#define POSTINGS_MAX_CHUNK 4096
+
+// A posting never takes more than two 5-byte varints
+#define POSTINGS_MAX_ENCODED 10
+
+struct postings_chunk {
+    struct postings_chunk* next;
+    uint32_t len;
+    uint32_t cap;
+    uint8_t bytes[];
+};
+
+struct postings_list {
+    struct postings_chunk* head;
+    struct postings_chunk* tail;
+    uint32_t num_encoded;
+    uint32_t last_encoded_doc;
+    uint32_t open_doc;
+    uint32_t open_tf;
+    uint32_t max_tf;
+};
+
+/**
+ * Token positions of every posting of a word, in the same kind of chunks.
+ */
+struct positions_list {
+    struct postings_chunk* head;
+    struct postings_chunk* tail;
+    uint32_t last_doc;
+    uint32_t last_pos;
+};
+
+/**
+ * Streams the postings of one list in increasing doc order.
+ */
+struct postings_cursor {
+    const struct postings_chunk* chunk;
+    const uint8_t* pos;
+    const uint8_t* end;
+    uint32_t num_encoded;
+    uint32_t open_doc;
+    uint32_t open_tf;
+    uint32_t doc;
+    uint32_t tf;
+};
+
+/**
+ * Initialize an empty postings list.
+ * @param list pointer to the list
+ */
+void postings_init (struct postings_list* list);
+
+/**
+ * Records one occurrence of a word in doc. Docs must arrive in increasing order.
+ * @param  a     arena new chunks are allocated from
+ * @param  list  pointer to the list
+ * @param  doc   number of the document
+ * @return 1 if doc is new to this list (the df grew), 0 if only its tf grew
+ */
+int postings_add (struct arena* a, struct postings_list* list, uint32_t doc);
+
+/**
+ * Appends a whole posting with a known tf. doc must be above every doc in the list.
+ * @param a     arena new chunks are allocated from
+ * @param list  pointer to the list
+ * @param doc   number of the document
+ * @param tf    term frequency in doc
+ */
+void postings_append (struct arena* a, struct postings_list* list, uint32_t doc, uint32_t tf);
+
+/**
+ * Largest tf of any posting in the list, kept up to date as postings are added.
+ * @param  list pointer to the list
+ * @return the largest tf, 0 for an empty list
+ */
+uint32_t postings_max_tf (const struct postings_list* list);
+
+/**
+ * Number of bytes postings_write() needs for this list.
+ * @param  list pointer to the list
+ * @return size of the contiguous encoding
+ */
+uint64_t postings_size (const struct postings_list* list);
+
+/**
+ * Writes the list as contiguous varints, including its open posting.
+ * @param  list  pointer to the list
+ * @param  out   buffer of at least postings_size() bytes
+ * @return number of bytes written
+ */
+uint64_t postings_write (const struct postings_list* list, uint8_t* out);
+
+/**
+ * Positions a cursor before the first posting of an in-memory list.
+ * @param cur   pointer to the cursor
+ * @param list  pointer to the list, must not change while the cursor is used
+ */
+void postings_open (struct postings_cursor* cur, const struct postings_list* list);
+
+/**
+ * Positions a cursor before the first posting of a contiguous encoding.
+ * @param cur    pointer to the cursor
+ * @param bytes  first byte of the encoding
+ * @param count  number of postings encoded
+ */
+void postings_open_bytes (struct postings_cursor* cur, const uint8_t* bytes, uint32_t count);
+
+/**
+ * Reads the token positions of postings, in step with a postings cursor.
+ */
+struct positions_cursor {
+    const struct postings_chunk* chunk;
+    const uint8_t* pos;
+    const uint8_t* end;
+};
+
+/**
+ * Initialize an empty positions list.
+ * @param list pointer to the list
+ */
+void positions_init (struct positions_list* list);
+
+/**
+ * Records the position of one occurrence of a word, right after the matching
+ * postings_add(). Positions must arrive in increasing order within a doc.
+ * @param a     arena new chunks are allocated from
+ * @param list  pointer to the list
+ * @param doc   number of the document
+ * @param pos   number of the token within the document
+ */
+void positions_add (struct arena* a, struct positions_list* list, uint32_t doc, uint32_t pos);
+
+/**
+ * Number of bytes positions_write() needs for this list.
+ * @param  list pointer to the list
+ * @return size of the contiguous encoding
+ */
+uint64_t positions_size (const struct positions_list* list);
+
+/**
+ * Writes the list as contiguous varints.
+ * @param  list  pointer to the list
+ * @param  out   buffer of at least positions_size() bytes
+ * @return number of bytes written
+ */
+uint64_t positions_write (const struct positions_list* list, uint8_t* out);
+
+/**
+ * Positions a cursor before the positions of the first posting of an in-memory list.
+ * @param cur   pointer to the cursor
+ * @param list  pointer to the list, must not change while the cursor is used
+ */
+void positions_open (struct positions_cursor* cur, const struct positions_list* list);
+
+/**
+ * Positions a cursor on a contiguous encoding.
+ * @param cur    pointer to the cursor
+ * @param bytes  first byte of the positions to read
+ */
+void positions_open_bytes (struct positions_cursor* cur, const uint8_t* bytes);
+
+/**
+ * Appends the positions of one posting read from a cursor, for merging lists.
+ * @param a     arena new chunks are allocated from
+ * @param list  pointer to the list to append to
+ * @param doc   number of the document in list
+ * @param cur   cursor on the posting's positions, advanced past them
+ * @param tf    term frequency of the posting
+ */
+void positions_copy (struct arena* a, struct positions_list* list, uint32_t doc,
+        struct positions_cursor* cur, uint32_t tf);
+
+/**
+ * Decodes a varint.
+ * @param  pos pointer to the read position, advanced past the varint
+ * @return the decoded value
+ */
+static inline uint32_t postings_read_varint (const uint8_t** pos) {
+    const uint8_t* p = *pos;
+    uint32_t value = *p & 0x7f;
+    int shift = 7;
+
+    while (*p++ & 0x80) {
+        value |= (uint32_t) (*p & 0x7f) << shift;
+        shift += 7;
+    }
+    *pos = p;
+    return value;
+}
+
+/**
+ * Advances the cursor to the next posting, setting cur->doc and cur->tf.
+ * @param  cur pointer to the cursor
+ * @return 1 if there was another posting, 0 at the end of the list
+ */
+static inline int postings_next (struct postings_cursor* cur) {
+    if (cur->num_encoded > 0) {
+        // Move on to the next chunk once this one is used up
+        while (cur->pos == cur->end) {
+            cur->chunk = cur->chunk->next;
+            cur->pos = cur->chunk->bytes;
+            cur->end = cur->chunk->bytes + cur->chunk->len;
+        }
+        cur->doc += postings_read_varint (&cur->pos);
+        cur->tf = postings_read_varint (&cur->pos);
+        cur->num_encoded--;
+        return 1;
+    }
+
+    // The open posting, if there is one, comes last
+    if (cur->open_tf != 0) {
+        cur->doc = cur->open_doc;
+        cur->tf = cur->open_tf;
+        cur->open_tf = 0;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Reads the next position varint, a position or a gap.
+ * @param  cur pointer to the cursor
+ * @return the decoded value
+ */
+static inline uint32_t positions_next (struct positions_cursor* cur) {
+    // Varints never span chunks, so a chunk only ends between them
+    while (cur->pos == cur->end) {
+        cur->chunk = cur->chunk->next;
+        cur->pos = cur->chunk->bytes;
+        cur->end = cur->chunk->bytes + cur->chunk->len;
+    }
+    return postings_read_varint (&cur->pos);
+}
+
+/**
+ * Skips the positions of postings without decoding them.
+ * @param cur  pointer to the cursor
+ * @param n    number of varints to skip, the sum of the postings' tfs
+ */
+static inline void positions_skip (struct positions_cursor* cur, uint32_t n) {
+    while (n > 0) {
+        while (cur->pos == cur->end) {
+            cur->chunk = cur->chunk->next;
+            cur->pos = cur->chunk->bytes;
+            cur->end = cur->chunk->bytes + cur->chunk->len;
+        }
+
+        // Every varint ends in a byte with the high bit clear
+        n -= !(*cur->pos++ & 0x80);
+    }
+}
+
+#endif
@@ -0,0 +1,127 @@
+/**************************************************************************************
+* Jack Umina
+* Created Nov, 2019
+* Cache of ranked results in front of query scoring, for servers answering the same
+* queries again and again. Queries are keyed by their sorted terms and their filter,
+* so reordered queries share an entry. Entries are evicted least recently used
+* first once the cache holds more than its budget of bytes. Safe to use from
+* several threads.
+***************************************************************************************/
+
+#ifndef qcache_H
+#define qcache_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "infoRetrieval.h"
+
+// Bytes of results a server caches unless asked for another budget
+#define QCACHE_DEFAULT_BUDGET (64 << 20)
+
+/**
+ * One cached query and its ranked results.
+ */
+struct qcache_entry {
+    char* key;
+    uint64_t hash;
+    struct relevancy_score* results;
+    int num_results;
+    size_t bytes;
+    struct qcache_entry* chain;
+    struct qcache_entry* prev;
+    struct qcache_entry* next;
+};
+
+/**
+ * Chained hashtable of entries plus a list of them from most to least recently used.
+ */
+struct qcache {
+    struct qcache_entry** buckets;
+    uint32_t num_buckets;
+    uint32_t num_entries;
+    size_t budget;
+    size_t bytes;
+    struct qcache_entry* head;
+    struct qcache_entry* tail;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t invalidations;
+    pthread_mutex_t lock;
+};
+
+/**
+ * Snapshot of a cache's counters.
+ */
+struct qcache_stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t invalidations;
+    uint32_t num_entries;
+    size_t bytes;
+};
+
+/**
+ * Creates an empty cache.
+ * @param  budget  most bytes of keys, results and bookkeeping to keep
+ * @return pointer to the cache
+ */
+struct qcache* qcache_create (size_t budget);
+
+/**
+ * Frees a cache and every entry in it.
+ * @param cache pointer to the cache
+ */
+void qcache_destroy (struct qcache* cache);
+
+/**
+ * Sorts the terms of a query and joins them into its cache key. Repeated terms are
+ * kept, they count once for each time they appear when the query is scored.
+ * Scoring the sorted terms gives a reordered query the same results to the bit.
+ * The query's filter goes in front, written so that it ends unambiguously, then
+ * a ':' and the terms, then a ';' and the patterns of the scored wildcards, each
+ * with a ~ and the edits it allows.
+ * Wildcards are sorted too, so their words are added to the terms in the same
+ * order when the query is expanded.
+ * @param  q  pointer to the parsed query, not yet expanded, its terms and
+ *            wildcards are sorted in place
+ * @return the key, free it when done
+ */
+char* qcache_key (struct query* q);
+
+/**
+ * Looks a query up and copies out its results. Counts a hit or a miss.
+ * @param  cache        pointer to the cache
+ * @param  key          the query's qcache_key()
+ * @param  num_results  set to the number of results on a hit
+ * @return a copy of the results, free it when done, or NULL on a miss
+ */
+struct relevancy_score* qcache_get (struct qcache* cache, const char* key, int* num_results);
+
+/**
+ * Caches a copy of a query's results, evicting the least recently used entries until
+ * it fits. Results larger than the whole budget are not cached.
+ * @param cache        pointer to the cache
+ * @param key          the query's qcache_key()
+ * @param results      ranked results
+ * @param num_results  number of results
+ */
+void qcache_put (struct qcache* cache, const char* key, const struct relevancy_score* results, int num_results);
+
+/**
+ * Drops every entry, called whenever the index the results came from changes.
+ * @param cache pointer to the cache
+ */
+void qcache_invalidate (struct qcache* cache);
+
+/**
+ * Reads the cache's counters.
+ * @param cache  pointer to the cache
+ * @param stats  filled in with the counters
+ */
+void qcache_get_stats (struct qcache* cache, struct qcache_stats* stats);
+
+#endif
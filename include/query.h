@@ -0,0 +1,237 @@
+/**************************************************************************************
+* Jack Umina
+* Created Nov, 2019
+* Parsed search queries. Every word of a query is scored, and quoted phrases and
+* NEAR/k operators also restrict the results to documents where the words occur
+* close together:
+*   "new york" pizza     new and york next to each other, in that order
+*   apple NEAR/3 pie     apple and pie at most 3 words apart, in either order
+* NEAR/k joins the words on either side of it. A quote left open ends the phrase at
+* the end of the query.
+*
+* A query using AND, OR, NOT (in capitals) or parentheses is a Boolean filter
+* instead, and only the documents it matches are ranked:
+*   (apple OR pear) AND pie NOT crust
+* Words, phrases and NEAR/k pairs next to each other without an operator must all
+* match, AND binds tighter than OR, and words under NOT are not scored.
+*
+* A word with * (any characters) or ? (any one character) in it is a wildcard:
+*   comput* AND sci?nce
+* It stands for every indexed word it matches, at most QUERY_MAX_EXPANSIONS of
+* them, and is scored as their disjunction. A fuzzy word, ending in ~1 or ~2 (or
+* just ~, which is ~2), stands in the same way for the indexed words at most that
+* many insertions, deletions or substitutions away:
+*   recieve~1 AND pizza~
+* Either every such word is scored, weighted down by its distance, or only the
+* closest one, see enum fuzzy_mode in scoring.h. Inside phrases and NEAR/k both
+* are just words.
+***************************************************************************************/
+
+#ifndef query_H
+#define query_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "scoring.h"
+
+// Parentheses nested deeper than this are ignored
+#define QUERY_MAX_DEPTH 64
+
+// Queries with more nodes than this are refused, which bounds how deep matching
+// recurses
+#define QUERY_MAX_NODES 1024
+
+// Words a wildcard expands to at most, the first ones in sorted order
+#define QUERY_MAX_EXPANSIONS 1024
+
+// Most edits a fuzzy word allows, and the distance of a bare ~
+#define QUERY_MAX_DISTANCE 2
+
+// Longer fuzzy words are matched exactly, the search takes their length squared
+#define QUERY_MAX_FUZZY_LENGTH 64
+
+enum constraint_kind {
+    CONSTRAINT_PHRASE,
+    CONSTRAINT_NEAR
+};
+
+/**
+ * Words that must occur close together in a matching document. Its num_terms words
+ * start at first in the query's constraint_terms. A NEAR constraint has two words
+ * at most distance positions apart.
+ */
+struct query_constraint {
+    enum constraint_kind kind;
+    int first;
+    int num_terms;
+    uint32_t distance;
+};
+
+enum query_node_kind {
+    QUERY_WORD,
+    QUERY_CONSTRAINT,
+    QUERY_AND,
+    QUERY_OR,
+    QUERY_NOT,
+    QUERY_WILDCARD
+};
+
+/**
+ * A node of the filter a query's documents must match. A word node matches the
+ * documents containing word and a constraint node those where constraints[arg]
+ * holds. AND and OR combine nodes left and right, NOT complements node left.
+ * A wildcard node stands for wildcards[arg] and matches nothing until
+ * query_expand() turns it into an OR of the words it matches.
+ */
+struct query_node {
+    enum query_node_kind kind;
+    char* word;
+    int arg;
+    int left;
+    int right;
+};
+
+/**
+ * A word with wildcards in it, or a fuzzy word when distance is not 0, then
+ * pattern is the word without its ~. node is its node in the filter, or -1 when
+ * the query has no operators, and the words it expands to are scored unless it
+ * is under NOT.
+ */
+struct query_wildcard {
+    char* pattern;
+    int distance;
+    int node;
+    int scored;
+};
+
+/**
+ * A query split into words. terms holds every word to be scored, and
+ * constraint_terms the words of each constraint in query order. Both point into
+ * the string the query was parsed from, or into the index a wildcard was
+ * expanded from. weights[j] scales the score of terms[j], weights is NULL while
+ * every term counts once. nodes[root] is the filter, root is -1 when every
+ * document is ranked.
+ */
+struct query {
+    char** terms;
+    double* weights;
+    int num_terms;
+    char** constraint_terms;
+    struct query_constraint* constraints;
+    int num_constraints;
+    struct query_node* nodes;
+    int num_nodes;
+    int root;
+    struct query_wildcard* wildcards;
+    int num_wildcards;
+};
+
+/**
+ * Splits a query into lowercase words and picks out its phrases, NEAR/k operators
+ * and Boolean operators. Stray quotes, parentheses and operators are ignored.
+ * @param  str  the query, split and lowercased in place
+ * @param  q    pointer to the query to fill in, release with query_free()
+ * @return 0 on success, or -1 if the query needs more than QUERY_MAX_NODES nodes,
+ *         in which case q is already released
+ */
+int query_parse (char* str, struct query* q);
+
+/**
+ * A dictionary of words in sorted order, such as an index's or a hashtable's.
+ * word (dict, i) is word i.
+ */
+struct query_dict {
+    const void* dict;
+    uint32_t num_words;
+    char* (*word) (const void* dict, uint32_t i);
+};
+
+/**
+ * Checks whether a word matches a wildcard pattern, where * matches any characters
+ * and ? any one character.
+ * @param  pattern  the pattern
+ * @param  word     the word
+ * @return 1 if the whole word matches, 0 if not
+ */
+int query_wildcard_match (const char* pattern, const char* word);
+
+/**
+ * Counts the insertions, deletions and substitutions that turn one word into
+ * another.
+ * @param  a    the first word
+ * @param  b    the second word
+ * @param  max  largest distance of interest
+ * @return the distance, or max + 1 if it is larger than max
+ */
+int query_edit_distance (const char* a, const char* b, int max);
+
+/**
+ * Weight of a word a fuzzy word expands to, 1 / (1 + distance), so the word
+ * itself counts fully and each edit away counts less.
+ * @param  distance  edits between the two words
+ * @return the weight
+ */
+double query_fuzzy_weight (int distance);
+
+/**
+ * Finds the words of a sorted dictionary that a wildcard matches. A pattern's
+ * words all start with its part before the first * or ?, which is found by binary
+ * search, so this takes time logarithmic in the size of the dictionary plus the
+ * number of words with that prefix. A fuzzy word is matched by working out the
+ * edit distance a character at a time down the prefixes shared by neighbouring
+ * words, and skipping, with a galloping search, every word that starts with a
+ * prefix already too far from it, rather than comparing it with every word.
+ * @param  d          pointer to the dictionary
+ * @param  w          pointer to the wildcard
+ * @param  words      array of at least max_words words to fill in, in sorted order
+ * @param  max_words  most words to find
+ * @return number of words found
+ */
+int query_dict_expand (const struct query_dict* d, const struct query_wildcard* w, char** words, int max_words);
+
+/**
+ * Sorts words, drops repeats and keeps the first QUERY_MAX_EXPANSIONS, to combine
+ * the expansions of a pattern from several dictionaries.
+ * @param  words      array of words, sorted in place
+ * @param  num_words  number of words
+ * @return number of words kept at the front of the array
+ */
+int query_unique_words (char** words, int num_words);
+
+/**
+ * Decides what a wildcard is scored as from the words it matches. A fuzzy word
+ * in FUZZY_BEST mode keeps only its closest word, every other wildcard keeps all
+ * of them, weighted by distance if it is fuzzy.
+ * @param  w          pointer to the wildcard
+ * @param  mode       how fuzzy words are scored
+ * @param  words      the words it matches, in sorted order, the kept words are
+ *                    moved to the front
+ * @param  df         number of documents each word is in, only read for a fuzzy
+ *                    word in FUZZY_BEST mode, which skips words in none
+ * @param  num_words  number of words
+ * @param  weights    array of num_words weights to fill in for the kept words
+ * @return number of words kept
+ */
+int query_select_words (const struct query_wildcard* w, enum fuzzy_mode mode, char** words, const uint64_t* df,
+        int num_words, double* weights);
+
+/**
+ * Replaces a wildcard with the words it matches. The words are added to the
+ * scored terms unless the wildcard is under NOT, and its filter node becomes an
+ * OR of them. The words must outlive the query.
+ * @param q          pointer to the parsed query
+ * @param wildcard   index of the wildcard, expanded only once
+ * @param words      the words it matches, in sorted order
+ * @param weights    weight of each word when scored, or NULL if they count once
+ * @param num_words  number of words, a wildcard with none matches nothing
+ */
+void query_expand (struct query* q, int wildcard, char** words, const double* weights, int num_words);
+
+/**
+ * Frees the arrays of a parsed query, not the string it points into.
+ * @param q pointer to the query
+ */
+void query_free (struct query* q);
+
+#endif
@@ -0,0 +1,151 @@
+/**************************************************************************************
+* Jack Umina
+* Created Nov, 2019
+* Relevance models. A query's terms are weighted by idf, and each posting adds a
+* function of its tf and its document's length:
+*   tf-idf:  tf * idf                                        idf = log10 (N / df)
+*   BM25:    idf * tf * (k1 + 1) / (tf + k1 * (1 - b + b * length / avg_length))
+*                                                            idf = ln (1 + (N - df + 0.5) / (df + 0.5))
+* An index can also store each posting's BM25 or tf-idf score quantized to a byte,
+* an impact, so a query only adds small integers.
+***************************************************************************************/
+
+#ifndef scoring_H
+#define scoring_H
+
+#include <stdint.h>
+
+#define BM25_DEFAULT_K1 1.2
+#define BM25_DEFAULT_B 0.75
+
+// Largest quantized impact, an impact of 0 means the posting scores 0
+#define IMPACT_MAX 255
+
+enum score_model {
+    SCORE_TFIDF,
+    SCORE_BM25
+};
+
+/**
+ * How a fuzzy query word is scored: as every indexed word close enough, each
+ * weighted by query_fuzzy_weight() of its distance, or as the closest word alone,
+ * the one in the most documents among equally close words.
+ */
+enum fuzzy_mode {
+    FUZZY_EXPAND,
+    FUZZY_BEST
+};
+
+/**
+ * Statistics of a whole collection split across shards, so a shard scores its own
+ * documents exactly as an index over the whole collection would. df[j] is the
+ * number of live documents containing term j of the query being scored.
+ */
+struct collection_stats {
+    uint64_t num_docs;
+    uint64_t total_length;
+    const uint64_t* df;
+};
+
+/**
+ * How queries are scored, as chosen on the command line. collection is NULL
+ * unless a shard is scoring, then idf and the average length come from it
+ * instead of the index. weights is NULL unless the query being scored has
+ * weighted terms, then weights[j] multiplies the idf of term j. Impacts are
+ * stored unweighted and ignore it.
+ */
+struct scoring {
+    enum score_model model;
+    double k1;
+    double b;
+    int impacts;
+    enum fuzzy_mode fuzzy;
+    const struct collection_stats* collection;
+    const double* weights;
+};
+
+/**
+ * The scoring parameters for one query, with the collection's average document
+ * length folded in.
+ */
+struct scorer {
+    enum score_model model;
+    double k1_plus_1;
+    double norm;
+    double slope;
+};
+
+/**
+ * Sets up tf-idf scoring, the default.
+ * @param sc pointer to the scoring settings
+ */
+void scoring_init (struct scoring* sc);
+
+/**
+ * Parses a model name: tfidf, bm25, or bm25:<k1>,<b>.
+ * @param  sc    pointer to the scoring settings to fill in
+ * @param  spec  the model name
+ * @return 1 if it was understood, 0 otherwise
+ */
+int scoring_parse (struct scoring* sc, const char* spec);
+
+/**
+ * Computes the idf of a term under the model.
+ * @param  sc        pointer to the scoring settings
+ * @param  df        number of documents containing the term, at least 1
+ * @param  num_docs  number of documents searched
+ * @return the idf
+ */
+double scoring_idf (const struct scoring* sc, uint64_t df, uint64_t num_docs);
+
+/**
+ * Prepares the scoring of one query.
+ * @param scorer      pointer to the scorer to fill in
+ * @param sc          pointer to the scoring settings
+ * @param avg_length  average length in tokens of the documents searched
+ */
+void scorer_init (struct scorer* scorer, const struct scoring* sc, double avg_length);
+
+/**
+ * Checks whether scores depend on document length, so callers only read lengths
+ * when they have to.
+ * @param  scorer  pointer to the query's scorer
+ * @return 1 if scorer_term() uses its length, 0 if any length will do
+ */
+static inline int scorer_uses_length (const struct scorer* scorer) {
+    return scorer->model == SCORE_BM25 && scorer->slope != 0;
+}
+
+/**
+ * What one posting adds to its document's score.
+ * @param  scorer  pointer to the query's scorer
+ * @param  tf      term frequency of the posting
+ * @param  length  length of the posting's document
+ * @param  idf     idf of the term
+ * @return the posting's score
+ */
+static inline double scorer_term (const struct scorer* scorer, uint32_t tf, uint32_t length, double idf) {
+    if (scorer->model == SCORE_TFIDF) {
+        return (tf * idf);
+    }
+    return idf * (tf * scorer->k1_plus_1) / (tf + scorer->norm + scorer->slope * length);
+}
+
+/**
+ * Upper bound on what any posting of a term with at most max_tf can add. Never
+ * less than scorer_term() for such a posting, in any document.
+ * @param  scorer  pointer to the query's scorer
+ * @param  max_tf  largest term frequency of the postings
+ * @param  idf     idf of the term
+ * @return the bound
+ */
+static inline double scorer_bound (const struct scorer* scorer, uint32_t max_tf, double idf) {
+    if (scorer->model == SCORE_TFIDF) {
+        return max_tf * idf;
+    }
+
+    // BM25 grows with tf and shrinks with length, so take the shortest length, 0
+    return max_tf == 0 ? 0 : idf * (max_tf * scorer->k1_plus_1) / (max_tf + scorer->norm);
+}
+
+#endif
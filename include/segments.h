@@ -0,0 +1,357 @@
+/**************************************************************************************
+* Jack Umina
+* Created Nov, 2019
+* An index made of immutable segments. Each segment is an index file (see
+* indexfile.h) over some of the documents. A manifest lists the live segments and,
+* for each, a tombstone bitmap of its documents that were deleted or changed since.
+* Documents are numbered across segments in manifest order.
+*
+* Manifest layout (native byte order):
+*   manifest_header
+*   manifest_segment  segments[num_segments]
+*   uint64_t          deleted[]   each segment's tombstone bitmap, (num_docs + 63) / 64 words
+*
+* Segments are never modified. Changed files get a new segment and a tombstone in
+* the old one, and merging writes a new segment without the tombstoned documents.
+* A new manifest is written to a temporary name and renamed into place, so readers
+* always see a complete set of segments.
+***************************************************************************************/
+
+#ifndef segments_H
+#define segments_H
+
+#include <stdint.h>
+
+#define MANIFEST_MAGIC "IRSEGS"
+#define MANIFEST_VERSION 1
+
+// Once there are more segments than this, an update merges them all into one
+#define SEGMENTS_MAX 8
+
+struct manifest_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_segments;
+    uint32_t next_id;
+    uint32_t unused;
+    uint64_t checksum;
+};
+
+struct manifest_segment {
+    uint32_t id;
+    uint32_t num_docs;
+    uint32_t num_deleted;
+    uint32_t unused;
+};
+
+struct segment {
+    uint32_t id;
+    struct index_file* idx;
+    uint64_t* deleted;
+    uint32_t num_deleted;
+    uint32_t base;
+};
+
+/**
+ * The segments of an index. docs[base + i] is document i of a segment, deleted
+ * documents keep their entry but are never ranked. lengths[base + i] is its length,
+ * kept apart from docs so scoring reads a compact array.
+ */
+struct segment_set {
+    struct segment* segs;
+    int num_segments;
+    uint32_t next_id;
+    uint32_t num_docs;
+    uint32_t num_live;
+    uint64_t live_length;
+    struct document* docs;
+    uint32_t* lengths;
+};
+
+/**
+ * Work done answering queries, for comparing how queries are evaluated.
+ */
+struct query_stats {
+    uint64_t docs_scored;
+    uint64_t docs_pruned;
+    uint64_t postings_decoded;
+    uint64_t postings_total;
+};
+
+/**
+ * Checks a document's tombstone within its segment.
+ * @param  seg  pointer to the segment
+ * @param  doc  number of the document within the segment
+ * @return non-zero if the document is deleted
+ */
+static inline int segment_is_deleted (const struct segment* seg, uint32_t doc) {
+    return (seg->deleted[doc / 64] >> (doc % 64)) & 1;
+}
+
+/**
+ * Creates a set with no segments.
+ * @param  next_id  id for the first segment added, ids are never reused
+ * @return pointer to the set
+ */
+struct segment_set* segments_create (uint32_t next_id);
+
+/**
+ * Reads the manifest and maps every segment it lists.
+ * @param  path    name of the manifest, segment files are named <path>.<id>
+ * @param  verify  when non-zero, also checksum the body of every segment
+ * @return pointer to the set, or NULL if the manifest does not exist
+ */
+struct segment_set* segments_open (const char* path, int verify);
+
+/**
+ * Unmaps the segments and frees the set.
+ * @param set pointer to the set
+ */
+void segments_close (struct segment_set* set);
+
+/**
+ * Writes a trained hashtable as a new segment and appends it to the set.
+ * The manifest is not written until segments_commit().
+ * @param set      pointer to the set
+ * @param path     name of the manifest
+ * @param ht       pointer to the trained hashtable
+ * @param impacts  model to precompute the segment's impacts with, or NULL for none
+ */
+void segments_add (struct segment_set* set, const char* path, struct hashtable* ht,
+        const struct scoring* impacts);
+
+/**
+ * Marks a document deleted. Takes effect on disk at the next segments_commit().
+ * @param set  pointer to the set
+ * @param doc  number of the document across the set
+ */
+void segments_delete (struct segment_set* set, uint32_t doc);
+
+/**
+ * Checks whether a document has been deleted.
+ * @param  set  pointer to the set
+ * @param  doc  number of the document across the set
+ * @return 1 if it is deleted, 0 if it is live
+ */
+int segments_is_deleted (const struct segment_set* set, uint32_t doc);
+
+/**
+ * Atomically replaces the manifest with the current state of the set.
+ * @param set   pointer to the set
+ * @param path  name of the manifest
+ */
+void segments_commit (struct segment_set* set, const char* path);
+
+/**
+ * Deletes the segment files of a set, used once a new manifest no longer lists them.
+ * @param set   pointer to the set
+ * @param path  name of the manifest
+ */
+void segments_remove_files (const struct segment_set* set, const char* path);
+
+/**
+ * Finds the model the set's impacts were computed with. An index keeps the impact
+ * settings it was built with, new segments get the same ones.
+ * @param  set  pointer to the set
+ * @param  sc   pointer to the scoring settings to fill in
+ * @return 1 if every segment has impacts, 0 if any has none
+ */
+int segments_impacts (const struct segment_set* set, struct scoring* sc);
+
+/**
+ * Checks whether phrase queries can be answered from the set.
+ * @param  set  pointer to the set
+ * @return 1 if every segment has positions, 0 if any has none or there are none
+ */
+int segments_positions (const struct segment_set* set);
+
+/**
+ * Average length of the live documents, for BM25 length normalization. A shard
+ * uses the average over the whole collection instead.
+ * @param  set  pointer to the set
+ * @param  sc   pointer to the scoring settings
+ * @return average length in tokens, 0 when there are no live documents
+ */
+double segments_avg_length (const struct segment_set* set, const struct scoring* sc);
+
+/**
+ * Replaces the index with a single segment trained from a hashtable. Only the old
+ * manifest is read, not its segments, so an index written by an older version of
+ * the file format is replaced too. The old segment files are removed once the new
+ * manifest is in place.
+ * @param path     name of the manifest
+ * @param ht       pointer to the trained hashtable
+ * @param impacts  model to precompute the segment's impacts with, or NULL for none
+ */
+void segments_rebuild (const char* path, struct hashtable* ht, const struct scoring* impacts);
+
+/**
+ * Merges every segment into one new segment without the deleted documents,
+ * commits the manifest and removes the old segment files. The new segment keeps
+ * the impacts of the old ones.
+ * @param set   pointer to the set
+ * @param path  name of the manifest
+ */
+void segments_merge (struct segment_set* set, const char* path);
+
+/**
+ * Brings the set up to date with the given files: files that are new or whose
+ * modification time changed are trained into a new segment, and the old copies of
+ * changed or missing files are tombstoned. Commits the manifest, then merges if
+ * there are more than SEGMENTS_MAX segments.
+ * @param set          pointer to the set
+ * @param path         name of the manifest
+ * @param paths        sorted array of the file paths that should be indexed
+ * @param num_paths    number of paths
+ * @param num_buckets  initial bucket hint for training
+ * @param num_workers  number of training threads
+ * @param impacts      model to precompute impacts with when the set has no segments
+ *                     yet, or NULL for none. Otherwise the set's own settings are kept.
+ * @param positions    non-zero to store positions when the set has no segments yet,
+ *                     otherwise new segments store them if the set's segments do
+ */
+void segments_update (struct segment_set* set, const char* path, char** paths, int num_paths,
+        int num_buckets, int num_workers, const struct scoring* impacts, int positions);
+
+/**
+ * Counts the live documents of the set that contain a word.
+ * @param  set   pointer to the set
+ * @param  word  the word
+ * @return the word's df across the segments
+ */
+uint64_t segments_df (const struct segment_set* set, const char* word);
+
+/**
+ * Finds the words of any segment a wildcard or fuzzy word matches, see
+ * index_expand().
+ * @param  set    pointer to the set
+ * @param  w      pointer to the wildcard
+ * @param  words  array of at least QUERY_MAX_EXPANSIONS * num_segments words to
+ *                fill in, pointing into the segments
+ * @return number of distinct words at the front of words, in sorted order and at
+ *         most QUERY_MAX_EXPANSIONS
+ */
+int segments_expand (const struct segment_set* set, const struct query_wildcard* w, char** words);
+
+/**
+ * Expands every wildcard and fuzzy word of a query with the words of the set, see
+ * query_select_words() and query_expand().
+ * @param set  pointer to the set, open for as long as the query is used
+ * @param sc   pointer to the scoring settings, which choose how fuzzy words are scored
+ * @param q    pointer to the parsed query
+ */
+void segments_expand_query (const struct segment_set* set, const struct scoring* sc, struct query* q);
+
+/**
+ * Looks up every query term in every segment and computes its idf, times its
+ * weight in sc->weights if there are any. The df of each term and the number of
+ * documents are summed over the segments, not counting deleted documents, or
+ * taken from sc->collection when a shard is scoring.
+ * @param set           pointer to the set
+ * @param sc            pointer to the scoring settings
+ * @param search_query  string array of search terms
+ * @param query_len     length of the search query
+ * @param terms         array of query_len * num_segments slots, terms[j * num_segments + s]
+ *                      is set to term j's slot in segment s, or NULL if it is not there
+ * @param idf           array of query_len idfs, 0 for terms that add nothing to any score
+ */
+void segments_lookup (const struct segment_set* set, const struct scoring* sc, char** search_query,
+        int query_len, const struct index_term** terms, double* idf);
+
+/**
+ * Scores every live document against the search query, then ranks the best k.
+ * Each term's postings are walked once, adding their scores into a dense accumulator.
+ * @param  set           pointer to the set
+ * @param  sc            pointer to the scoring settings
+ * @param  search_query  string array of search terms
+ * @param  query_len     length of the search query
+ * @param  k             number of top results wanted, 0 ranks every live document
+ * @param  num_results   set to the number of ranked entries at the front of the array
+ * @param  stats         counters to add this query's work to, may be NULL
+ * @return array of relevancy scores numbered across the set, free it when done
+ */
+struct relevancy_score* segments_score_exhaustive (const struct segment_set* set, const struct scoring* sc,
+        char** search_query, int query_len, int k, int* num_results, struct query_stats* stats);
+
+/**
+ * Scores every live document against the search query from the impacts stored in
+ * the segments, then ranks the best k. Each posting only adds its impact to an
+ * integer accumulator, a document's score is its sum times its segment's scale.
+ * Every segment must have impacts.
+ * @param  set           pointer to the set
+ * @param  sc            pointer to the scoring settings
+ * @param  search_query  string array of search terms
+ * @param  query_len     length of the search query
+ * @param  k             number of top results wanted, 0 ranks every live document
+ * @param  num_results   set to the number of ranked entries at the front of the array
+ * @param  stats         counters to add this query's work to, may be NULL
+ * @return array of relevancy scores numbered across the set, free it when done
+ */
+struct relevancy_score* segments_score_impacts (const struct segment_set* set, const struct scoring* sc,
+        char** search_query, int query_len, int k, int* num_results, struct query_stats* stats);
+
+/**
+ * Scores only the given live documents against the search query, then ranks the
+ * best k. Each term's postings are sought to the documents in turn, skipping the
+ * blocks in between. Scores are the same as segments_score() gives them.
+ * @param  set           pointer to the set
+ * @param  sc            pointer to the scoring settings
+ * @param  search_query  string array of search terms
+ * @param  query_len     length of the search query
+ * @param  matches       sorted array of live document numbers across the set
+ * @param  num_matches   number of documents in matches
+ * @param  k             number of top results wanted, 0 ranks every match
+ * @param  num_results   set to the number of ranked entries at the front of the array
+ * @param  stats         counters to add this query's work to, may be NULL
+ * @return array of relevancy scores numbered across the set, free it when done
+ */
+struct relevancy_score* segments_score_matches (const struct segment_set* set, const struct scoring* sc,
+        char** search_query, int query_len, const uint32_t* matches, uint32_t num_matches, int k,
+        int* num_results, struct query_stats* stats);
+
+/**
+ * Scores the live documents against the search query and ranks the best k. Only
+ * reads the set, so several threads may score queries at once. A top-k query is
+ * answered with maxscore_top_k(), which skips documents that cannot make the top k,
+ * and a query for every document, or with more than MAXSCORE_MAX_TERMS terms, is
+ * scored exhaustively. Both rank the same.
+ * With sc->impacts the stored impacts are summed instead.
+ * @param  set           pointer to the set
+ * @param  sc            pointer to the scoring settings
+ * @param  search_query  string array of search terms
+ * @param  query_len     length of the search query
+ * @param  k             number of top results wanted, 0 ranks every live document
+ * @param  num_results   set to the number of ranked entries at the front of the array
+ * @param  stats         counters to add this query's work to, may be NULL
+ * @return array of relevancy scores numbered across the set, free it when done
+ */
+struct relevancy_score* segments_score (const struct segment_set* set, const struct scoring* sc,
+        char** search_query, int query_len, int k, int* num_results, struct query_stats* stats);
+
+/**
+ * Scores the live documents against a parsed query and ranks the best k. Without
+ * a filter this is segments_score(). Otherwise only the documents the filter
+ * matches are scored, see query_match().
+ * @param  set          pointer to the set
+ * @param  sc           pointer to the scoring settings
+ * @param  q            pointer to the parsed query
+ * @param  k            number of top results wanted, 0 ranks every match
+ * @param  num_results  set to the number of ranked entries at the front of the array
+ * @param  stats        counters to add this query's work to, may be NULL
+ * @return array of relevancy scores numbered across the set, free it when done
+ */
+struct relevancy_score* segments_score_query (const struct segment_set* set, const struct scoring* sc,
+        const struct query* q, int k, int* num_results, struct query_stats* stats);
+
+/**
+ * Ranks the live documents against a parsed query and outputs results.
+ * @param  set    pointer to the set
+ * @param  sc     pointer to the scoring settings
+ * @param  q      pointer to the parsed query
+ * @param  k      number of top results to write, 0 writes every match
+ * @param  stats  counters to add this query's work to, may be NULL
+ */
+void segments_rank (const struct segment_set* set, const struct scoring* sc, const struct query* q, int k,
+        struct query_stats* stats);
+
+#endif
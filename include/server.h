@@ -0,0 +1,108 @@
+/**************************************************************************************
+* Jack Umina
+* Created Nov, 2019
+* Long-running query server. The index is built or loaded once, and reopened when it
+* changes on disk, then queries are read one per line from stdin or from clients of a
+* Unix domain socket.
+*
+* Each query is answered with a single line:
+*   <num_results> <latency_us>[ <path>:<score>]...
+* where latency_us is the time spent parsing, scoring and formatting the query.
+* Answers are cached by query, see qcache.h, and the cache is emptied whenever the
+* index is reopened.
+***************************************************************************************/
+
+#ifndef server_H
+#define server_H
+
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "qcache.h"
+#include "scoring.h"
+
+// Number of threads serving socket clients unless asked for more
+#define SERVER_DEFAULT_THREADS 4
+
+// Accepted connections waiting for a free thread before accept() blocks
+#define SERVER_QUEUE_SIZE 64
+
+// Seconds between checks of whether the index on disk has changed
+#define SERVER_CHECK_INTERVAL 1
+
+/**
+ * What the server answers queries from. Exactly one of ht, segs and shards is set.
+ * A server answering from segs reopens the index whenever its manifest is replaced,
+ * holding lock for writing while it swaps segs, so queries hold it for reading.
+ */
+struct server {
+    struct hashtable* ht;
+    const struct segment_set* segs;
+    struct shard_pool* shards;
+    int num_results;
+    struct scoring scoring;
+    struct qcache* cache;
+    const char* index_path;
+    ino_t index_ino;
+    struct timespec index_mtime;
+    double next_check_us;
+    pthread_rwlock_t lock;
+    pthread_mutex_t check_lock;
+};
+
+/**
+ * Latency totals for the queries answered on one stream.
+ */
+struct server_stats {
+    long num_queries;
+    double total_us;
+    double max_us;
+};
+
+/**
+ * Sets up a server and opens the index, if there is one. Leaves ht for the caller to
+ * train and freeze, or shards to start, when segs comes back NULL.
+ * @param s             pointer to the server to fill in
+ * @param index_path    name of the index manifest, or NULL to leave the index to the caller
+ * @param num_results   number of results for each query, 0 ranks every document
+ * @param sc            pointer to the scoring settings
+ * @param cache_budget  bytes of results to cache, 0 turns the cache off
+ */
+void server_init (struct server* s, const char* index_path, int num_results, const struct scoring* sc,
+        size_t cache_budget);
+
+/**
+ * Closes the server's index or frees its hashtable, and frees its cache.
+ * @param s pointer to the server
+ */
+void server_destroy (struct server* s);
+
+/**
+ * Prints the latency totals of a stream and the cache's hit rate to stderr.
+ * @param s      pointer to the server
+ * @param label  what the totals are for
+ * @param stats  latency totals of the stream
+ */
+void server_print_stats (struct server* s, const char* label, const struct server_stats* stats);
+
+/**
+ * Answers every line of in on out, flushing after each answer, until in ends.
+ * @param s      pointer to the server
+ * @param in     stream of newline-delimited queries
+ * @param out    stream to write the answers to
+ * @param stats  latency totals to add this stream's queries to
+ */
+void serve_stream (struct server* s, FILE* in, FILE* out, struct server_stats* stats);
+
+/**
+ * Listens on a Unix domain socket and answers each client's queries on a pool of
+ * threads, one client per thread at a time. Never returns.
+ * @param s            pointer to the server
+ * @param path         file name of the socket, replaced if it already exists
+ * @param num_threads  number of threads serving clients
+ */
+void serve_socket (struct server* s, const char* path, int num_threads);
+
+#endif
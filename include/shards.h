@@ -0,0 +1,117 @@
+/**************************************************************************************
+* Jack Umina
+* Created Nov, 2019
+* An index split into shards, each its own segmented index (see segments.h) over a
+* contiguous range of the documents, and each answered by its own process. Shard i
+* of the index at <path> has the manifest <path>.shard<i>. Documents are numbered
+* across shards in shard order, the same numbers an unsharded index gives them.
+*
+* The coordinator talks to every shard over a Unix socket pair, one line per request:
+*   E <query>                                   -> for each wildcard <n>[ <word>[ <df>]]...
+*   S <words> <query>                           -> <num_live> <live_length>[ <df>]...
+*   Q <k> <num_docs> <total_length> <words> <num_terms>[ <df>]... <query>
+*                                               -> <n> <docs_scored> <docs_pruned>
+*                                                  <postings_decoded> <postings_total>
+*                                                  then n lines of <doc> <score>
+* where <words> is <num_wildcards>, then for each wildcard <n>[ <word> <weight>]...
+* and an E reply only has dfs for fuzzy words when the closest word is picked.
+* A query is scattered twice. The first round gathers each term's df and the
+* number and length of the live documents, summed into statistics of the whole
+* collection. The second sends those back, so every shard scores its documents
+* exactly as an unsharded index would, and the top k of each shard are merged.
+* Scores travel as hexadecimal floats, so they arrive to the bit. A query with
+* wildcards or fuzzy words is first sent to every shard to find the words they
+* match, and the words of all the shards are sent with both rounds, with the
+* weights the coordinator picked for them, so every shard expands the query to
+* the same terms.
+***************************************************************************************/
+
+#ifndef shards_H
+#define shards_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "scoring.h"
+
+/**
+ * One shard process and the coordinator's ends of its socket.
+ */
+struct shard {
+    pid_t pid;
+    FILE* to;
+    FILE* from;
+    uint32_t base;
+    uint32_t num_docs;
+};
+
+/**
+ * Running shards. docs[base + i] is document i of a shard, as in a segment_set.
+ * Only one query is scattered at a time, holding lock.
+ */
+struct shard_pool {
+    struct shard* shards;
+    int num_shards;
+    uint32_t num_docs;
+    struct document* docs;
+    int positions;
+    enum fuzzy_mode fuzzy;
+    pthread_mutex_t lock;
+};
+
+/**
+ * Splits the files into contiguous ranges, one per shard, and replaces each
+ * shard's index with one trained from its range.
+ * @param path         name of the unsharded index, shards are named <path>.shard<i>
+ * @param paths        sorted array of the file paths to index
+ * @param num_paths    number of paths, at least num_shards
+ * @param num_shards   number of shards
+ * @param num_buckets  initial bucket hint for training each shard
+ * @param num_workers  number of training threads
+ * @param positions    non-zero to also store where each word occurs
+ */
+void shards_build (const char* path, char** paths, int num_paths, int num_shards, int num_buckets,
+        int num_workers, int positions);
+
+/**
+ * Starts a process for each shard, which opens the shard's index and answers the
+ * coordinator until its socket is closed, and reads each shard's document table.
+ * @param  path        name of the unsharded index
+ * @param  num_shards  number of shards
+ * @param  sc          pointer to the scoring settings, without impacts
+ * @return pointer to the pool, stop it with shards_stop()
+ */
+struct shard_pool* shards_start (const char* path, int num_shards, const struct scoring* sc);
+
+/**
+ * Closes every shard's socket, waits for the processes to exit and frees the pool.
+ * @param pool pointer to the pool
+ */
+void shards_stop (struct shard_pool* pool);
+
+/**
+ * Scores a query on every shard with the statistics of the whole collection and
+ * merges their top k. Ranks and scores the same as the unsharded index would.
+ * Safe to call from several threads, queries are answered one at a time.
+ * @param  pool         pointer to the pool
+ * @param  query        the query as typed, not yet parsed
+ * @param  k            number of top results wanted, 0 ranks every match
+ * @param  num_results  set to the number of ranked entries at the front of the array
+ * @param  stats        counters to add every shard's work to, may be NULL
+ * @return array of relevancy scores numbered across the shards, free it when done
+ */
+struct relevancy_score* shards_score (struct shard_pool* pool, const char* query, int k, int* num_results,
+        struct query_stats* stats);
+
+/**
+ * Ranks a query across the shards and outputs results.
+ * @param pool   pointer to the pool
+ * @param query  the query as typed, not yet parsed
+ * @param k      number of top results to write, 0 writes every match
+ * @param stats  counters to add every shard's work to, may be NULL
+ */
+void shards_rank (struct shard_pool* pool, const char* query, int k, struct query_stats* stats);
+
+#endif
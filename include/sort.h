@@ -7,21 +7,46 @@
 #ifndef scores_H
 #define scores_H
 
+// Number of results written to search_scores.txt unless asked for more
+#define RANK_DEFAULT_K 10
+
 /**
  * Function to compare to relevancy_score structs according to their scores.
+ * Equal scores are ordered by doc so the ranking is the same on every run.
  * @param  a relevancy_score 1
  * @param  b relevancy_score 2
- * @return positive number if a->score > b->score
- *         negative number if a->score < b->score
- *         and 0 if a->score = b->score
+ * @return negative number if a ranks before b (higher score, or same score and lower doc)
+ *         positive number if a ranks after b
+ *         and 0 if a and b are the same document
  */
 int comparator (const void* a, const void* b);
 
 /**
  * Function to sort an array of relevancy_score structs.
- * @param ht      pointer to the hashtable
- * @param scores array to sort
+ * @param scores    array to sort
+ * @param num_docs  number of entries in scores
+ */
+void sort (struct relevancy_score* scores, int num_docs);
+
+/**
+ * Offers an entry to a bounded heap of the best k entries seen so far, as kept by
+ * top_k(). The root, heap[0], is the entry that ranks last.
+ * @param  heap   array of at least k entries holding the heap
+ * @param  size   number of entries in the heap, updated
+ * @param  k      largest size of the heap
+ * @param  entry  the entry to offer
+ * @return 1 if the entry was kept, 0 if it ranks after all k entries
+ */
+int top_k_push (struct relevancy_score* heap, int* size, int k, struct relevancy_score entry);
+
+/**
+ * Moves the k best entries to the front of scores in ranked order, keeping a
+ * bounded heap of the best k seen so far. The rest of the array is left unordered.
+ * @param  scores    array to select from
+ * @param  num_docs  number of entries in scores
+ * @param  k         number of entries wanted
+ * @return number of entries now ranked at the front, the smaller of k and num_docs
  */
-void sort (struct hashtable* ht, struct relevancy_score* scores);
+int top_k (struct relevancy_score* scores, int num_docs, int k);
 
 #endif
@@ -0,0 +1,109 @@
+/**************************************************************************************
+* Jack Umina
+* Created Nov, 2019
+* Optional instrumentation: time spent in each phase of a run and counts of the work
+* done on the hot paths, written as JSON. Phase timers only read the clock once
+* stats_enable() has been called. Counters are compiled in only when building with
+* make STATS=1 (-DSEARCH_STATS), otherwise STATS_COUNT() and STATS_PROBES() are empty.
+*
+* Each thread counts into its own stats_local and adds it to the process totals with
+* stats_flush(), so counting never takes a lock or shares a cache line.
+***************************************************************************************/
+
+#ifndef stats_H
+#define stats_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+enum stats_phase {
+    STATS_GLOB,
+    STATS_TRAIN,
+    STATS_INDEX_WRITE,
+    STATS_INDEX_OPEN,
+    STATS_PARSE,
+    STATS_SCORE,
+    STATS_SORT,
+    STATS_OUTPUT,
+    STATS_NUM_PHASES
+};
+
+enum stats_counter {
+    STATS_HASH_LOOKUPS,
+    STATS_HASH_PROBES,
+    STATS_STRCMP,
+    STATS_POSTINGS_SCANNED,
+    STATS_DOCS_SCORED,
+    STATS_BYTES_READ,
+    STATS_NUM_COUNTERS
+};
+
+// Probe lengths 1 .. STATS_PROBE_HIST - 1 get their own bucket, the last holds the rest
+#define STATS_PROBE_HIST 16
+
+struct stats {
+    double phase_us[STATS_NUM_PHASES];
+    uint64_t phase_calls[STATS_NUM_PHASES];
+    uint64_t counters[STATS_NUM_COUNTERS];
+    uint64_t probe_hist[STATS_PROBE_HIST];
+};
+
+extern int stats_enabled;
+extern __thread struct stats stats_local;
+
+#ifdef SEARCH_STATS
+#define STATS_COUNT(counter, n) (stats_local.counters[counter] += (n))
+#define STATS_PROBES(n) stats_probes (n)
+#else
+#define STATS_COUNT(counter, n) ((void) 0)
+#define STATS_PROBES(n) ((void) 0)
+#endif
+
+/**
+ * Counts one hashtable lookup and the slots it probed.
+ * @param probes number of slots looked at, at least 1
+ */
+static inline void stats_probes (uint64_t probes) {
+    stats_local.counters[STATS_HASH_LOOKUPS]++;
+    stats_local.counters[STATS_HASH_PROBES] += probes;
+    stats_local.probe_hist[probes < STATS_PROBE_HIST ? probes - 1 : STATS_PROBE_HIST - 1]++;
+}
+
+/**
+ * Current time of the monotonic clock.
+ * @return microseconds
+ */
+double stats_now_us (void);
+
+/**
+ * Starts timing phases. Until then stats_begin() and stats_end() do nothing.
+ */
+void stats_enable (void);
+
+/**
+ * Starts timing a phase.
+ * @return the start time to pass to stats_end()
+ */
+double stats_begin (void);
+
+/**
+ * Adds the time since start to a phase. Phases may nest, the time of an inner
+ * phase also counts towards the outer one.
+ * @param phase  the phase that ended
+ * @param start  what stats_begin() returned
+ */
+void stats_end (enum stats_phase phase, double start);
+
+/**
+ * Adds this thread's stats to the process totals and clears them. Worker threads
+ * call it before they exit.
+ */
+void stats_flush (void);
+
+/**
+ * Writes the process totals, after flushing the calling thread, as JSON.
+ * @param f stream to write to
+ */
+void stats_write (FILE* f);
+
+#endif
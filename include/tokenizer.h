@@ -0,0 +1,53 @@
+/**************************************************************************************
+* Jack Umina
+* Created Nov, 2019
+* Splits blocks of document text into lowercase words. Words are returned as
+* (pointer, length) slices into the block instead of separately allocated strings.
+***************************************************************************************/
+
+#ifndef tokenizer_H
+#define tokenizer_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Largest block train_document() reads from a file at once
+#define TOKENIZER_BLOCK (1 << 20)
+
+struct token {
+    const char* word;
+    uint32_t len;
+};
+
+struct token_list {
+    struct token* tokens;
+    int num_tokens;
+    int capacity;
+};
+
+/**
+ * Initialize an empty token_list.
+ * @param list pointer to the token_list
+ */
+void token_list_init (struct token_list* list);
+
+/**
+ * Deallocate the tokens of this token_list.
+ * @param list pointer to the token_list
+ */
+void token_list_destroy (struct token_list* list);
+
+/**
+ * Lowercases ASCII letters in buf in place and appends every word, delimited by
+ * ' ' or '\n', to list. Empty words between repeated delimiters are skipped.
+ * Uses AVX2 or SSE2 when the CPU has them and a scalar loop otherwise.
+ * @param  buf     block of text, modified in place
+ * @param  len     number of bytes in buf
+ * @param  at_eof  non-zero if nothing follows buf, so its last word is complete
+ * @param  list    token_list to append to, its slices point into buf
+ * @return number of bytes consumed; when !at_eof, buf[return..len) is an unfinished
+ *         word that must be carried over to the start of the next block
+ */
+size_t tokenize (char* buf, size_t len, int at_eof, struct token_list* list);
+
+#endif
@@ -0,0 +1,109 @@
+/**************************************************************************************
+* Jack Umina
+* Created Nov, 2019
+* Bump-pointer arenas. Everything allocated from one is released together, so
+* tearing down an index takes a handful of frees.
+***************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+/**
+ * Initialize an empty arena.
+ * @param a           pointer to the arena
+ * @param chunk_size  number of bytes to request from malloc at a time
+ */
+void arena_init (struct arena* a, size_t chunk_size) {
+    a->head = NULL;
+    a->chunk_size = chunk_size;
+}
+
+/**
+ * Allocates size bytes aligned to align, which must be a power of 2.
+ * @param  a      pointer to the arena
+ * @param  size   number of bytes
+ * @param  align  required alignment
+ * @return pointer to the bytes, valid until arena_destroy()
+ */
+void* arena_alloc (struct arena* a, size_t size, size_t align) {
+    struct arena_chunk* chunk = a->head;
+
+    if (chunk == NULL || size + align > chunk->size - chunk->used) {
+        // Start a new chunk, big enough for requests larger than the chunk size
+        size_t chunk_bytes = size + align > a->chunk_size ? size + align : a->chunk_size;
+        chunk = (struct arena_chunk*) malloc (sizeof (struct arena_chunk) + chunk_bytes);
+
+        // Check for allocation errors
+        if (chunk == NULL) {
+            printf("Error: unable to allocate memory for arena\n");
+            exit (0);
+        }
+
+        chunk->next = a->head;
+        chunk->size = chunk_bytes;
+        chunk->used = 0;
+        a->head = chunk;
+    }
+
+    // Bump the pointer, padding it up to the requested alignment
+    uintptr_t start = (uintptr_t) (chunk->data + chunk->used);
+    uintptr_t aligned = (start + align - 1) & ~(uintptr_t) (align - 1);
+    chunk->used += (aligned - start) + size;
+    return (void*) aligned;
+}
+
+/**
+ * Copies len bytes into the arena followed by a NUL terminator.
+ * @param  a     pointer to the arena
+ * @param  str   bytes to copy, need not be NUL terminated
+ * @param  len   number of bytes
+ * @return pointer to the copy
+ */
+char* arena_strndup (struct arena* a, const char* str, size_t len) {
+    char* copy = (char*) arena_alloc (a, len + 1, 1);
+    memcpy (copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+/**
+ * Moves every chunk of src into dst, leaving src empty. Used when objects
+ * allocated in src are handed over to another owner.
+ * @param dst  arena that takes the chunks
+ * @param src  arena to empty
+ */
+void arena_adopt (struct arena* dst, struct arena* src) {
+    if (src->head == NULL) {
+        return;
+    }
+
+    // Put src's chunks behind dst's current chunk so dst keeps bumping into it
+    struct arena_chunk* last = src->head;
+    while (last->next != NULL) {
+        last = last->next;
+    }
+
+    if (dst->head == NULL) {
+        dst->head = src->head;
+    } else {
+        last->next = dst->head->next;
+        dst->head->next = src->head;
+    }
+    src->head = NULL;
+}
+
+/**
+ * Frees every chunk of this arena.
+ * @param a pointer to the arena
+ */
+void arena_destroy (struct arena* a) {
+    while (a->head != NULL) {
+        struct arena_chunk* next = a->head->next;
+        free (a->head);
+        a->head = next;
+    }
+}
@@ -0,0 +1,64 @@
+/**************************************************************************************
+* Jack Umina
+* Created Nov, 2019
+* Maps dense document numbers to the path and metadata of each indexed document.
+***************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "doctable.h"
+
+/**
+ * Creates a document table for the given files. Document i is paths[i].
+ * @param  paths     array of file paths, copied into the table
+ * @param  num_docs  number of paths
+ * @return array of num_docs documents with their modification times filled in
+ */
+struct document* doc_table_create (char** paths, int num_docs) {
+    struct document* docs = (struct document*) malloc (num_docs * sizeof (struct document));
+
+    // Check for allocation errors
+    if (docs == NULL) {
+        printf("Error: unable to allocate memory for document table\n");
+        exit (0);
+    }
+
+    for (int i = 0; i < num_docs; i++) {
+        struct stat st;
+
+        if (stat (paths[i], &st) != 0) {
+            printf("Error in opening %s: ", paths[i]);
+            printf("%s\n", strerror(errno));
+            exit (0);
+        }
+
+        docs[i].path = strdup (paths[i]);
+
+        // Check for allocation errors
+        if (docs[i].path == NULL) {
+            printf("Error: unable to allocate memory for document path\n");
+            exit (0);
+        }
+
+        docs[i].mtime = st.st_mtime;
+        docs[i].length = 0;
+    }
+
+    return docs;
+}
+
+/**
+ * Deallocate this document table.
+ * @param docs      array of documents
+ * @param num_docs  number of documents
+ */
+void doc_table_destroy (struct document* docs, int num_docs) {
+    for (int i = 0; i < num_docs; i++) {
+        free (docs[i].path);
+    }
+    free (docs);
+}
@@ -2,21 +2,25 @@
 * Jack Umina
 * Created Nov, 2019
 * Represents a hashtable data structure.
+* Words live directly in an open-addressing array probed linearly from hash & mask.
 ***************************************************************************************/
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "hashtable.h"
+#include "query.h"
+#include "stats.h"
 
 /**
  * Creates a new hashtable.
- * @param  num_buckets Number of buckets this hashtable should have
+ * @param  num_buckets Hint for the initial number of buckets, rounded up to a power of 2.
+ *                     The table grows on its own, so any positive value is valid.
  * @return pointer to this hashtable
  */
 struct hashtable* ht_create (int num_buckets) {
     // Initialize space for ht
-	struct hashtable* ht = (struct hashtable*) malloc (sizeof (struct hashtable));
+    struct hashtable* ht = (struct hashtable*) malloc (sizeof (struct hashtable));
 
     // Check for allocation errors
     if (ht == NULL) {
@@ -24,276 +28,494 @@ struct hashtable* ht_create (int num_buckets) {
         exit (0);
     }
 
+    // Round the hint up to a power of 2 so a bucket is just hash & (num_buckets - 1)
+    int capacity = 16;
+    while (capacity < num_buckets && capacity < (1 << 30)) {
+        capacity <<= 1;
+    }
+
     // Initialize fields of hashtable
-    ht->map = (struct wordNode**) malloc (num_buckets * sizeof (struct wordNode*));
+    ht->map = (struct wordNode*) malloc (capacity * sizeof (struct wordNode));
 
-	// Check for allocation errors
+    // Check for allocation errors
     if (ht->map == NULL) {
         printf("Error: unable to allocate memory for ht->map\n");
         exit (0);
     }
 
-	ht->num_buckets = num_buckets;
-	ht->num_elements = 0;
-    ht->docIDs = NULL;
+    ht->num_buckets = capacity;
+    ht->num_elements = 0;
+    ht->docs = NULL;
     ht->num_docs = 0;
-
-    // Initialize space for a wordNode pointer in each bucket
-	for (int i = 0; i < num_buckets; i++) {
-		init_empty_wordNode (&ht->map[i]); 	
-	}
+    ht->positions = 0;
+    memset (&ht->terms, 0, sizeof (ht->terms));
+    ht->stats_docs = -1;
+    ht->stats_model = SCORE_TFIDF;
+    ht->stats_avg_length = 0;
+    arena_init (&ht->words, ARENA_CHUNK_SIZE);
+    arena_init (&ht->postings, ARENA_CHUNK_SIZE);
+
+    // Mark every bucket as empty
+    for (int i = 0; i < capacity; i++) {
+        init_empty_wordNode (&ht->map[i]);
+    }
 
     return ht;
 }
 
 /**
- * Initialize a new docNode with the given parameters.
- * @param docPtr  pointer to the docNode to edit
- * @param doc_id  char* to doc_id word belongs to
+ * Initialize a wordNode slot with empty fields
+ * @param wordPtr  pointer to the wordNode to initialize
  */
-void init_docNode (struct docNode* docPtr, char* doc_id) {
-    docPtr->doc_id = doc_id;
-    docPtr->tf = 1;
-    docPtr->next = NULL;
+void init_empty_wordNode (struct wordNode* wordPtr) {
+    // Initialize variables in wordNode to NULL/0
+    wordPtr->word = NULL;
+    wordPtr->hash = 0;
+    wordPtr->df = 0;
+    wordPtr->len = 0;
+    wordPtr->term = 0;
+    postings_init (&wordPtr->postings);
+    wordPtr->positions = NULL;
 }
 
 /**
- * Initialize a new wordNode with empty fields
- * @param wordPtr  pointer to the wordNode to initialize
+ * Allocates an empty positions list for a new word, if the hashtable keeps them.
+ * @param  ht  pointer to the hashtable
+ * @return pointer to the list, or NULL if ht->positions is not set
  */
-void init_empty_wordNode (struct wordNode** wordPtr) {
-	*wordPtr = (struct wordNode*) malloc (sizeof (struct wordNode));
-
-	// Check for allocation errors
-	if (wordPtr == NULL) {
-		printf("Error: unable to allocate memory for wordPtr\n");
-		exit (0);
-	}
-
-	// Initialize variables in wordNode to NULL/0
-	(*wordPtr)->word = NULL;
-	(*wordPtr)->df = 0;
-	(*wordPtr)->docHead = NULL;
-	(*wordPtr)->next = NULL;
+static struct positions_list* new_positions (struct hashtable* ht) {
+    if (!ht->positions) {
+        return NULL;
+    }
+    struct positions_list* list = (struct positions_list*) arena_alloc (&ht->postings,
+            sizeof (struct positions_list), sizeof (void*));
+    positions_init (list);
+    return list;
+}
+
+/**
+ * Drops the frozen terms and the cached term statistics, once a word or a
+ * posting changes.
+ * @param ht pointer to the hashtable
+ */
+static void thaw (struct hashtable* ht) {
+    if (ht->terms.word_offset == NULL) {
+        return;
+    }
+    free (ht->terms.strings);
+    free (ht->terms.word_offset);
+    free (ht->terms.df);
+    free (ht->terms.idf);
+    free (ht->terms.postings_offset);
+    free (ht->terms.docs);
+    free (ht->terms.tfs);
+    free (ht->terms.lengths);
+    memset (&ht->terms, 0, sizeof (ht->terms));
+    ht->stats_docs = -1;
 }
 
 /**
  * Initialize a new word node with the given parameters.
+ * @param ht      pointer to the hashtable, its postings arena holds the word's postings
  * @param wordPtr pointer to the wordNode to edit
  * @param word    char* to word we need to add
- * @param doc_id  char* to doc_id word belongs to
+ * @param len     length of word
+ * @param hash    hash_code() of word
+ * @param doc     number of the document word belongs to
  */
-void init_wordNode (struct wordNode* wordPtr, char* word, char* doc_id) {
+void init_wordNode (struct hashtable* ht, struct wordNode* wordPtr, char* word, size_t len, uint64_t hash,
+        uint32_t doc) {
     // Initialize fields of wordNode
     wordPtr->word = word;
+    wordPtr->hash = hash;
     wordPtr->df = 1;
-    wordPtr->docHead = (struct docNode*) malloc (sizeof (struct docNode));
+    wordPtr->len = (uint32_t) len;
+    wordPtr->term = 0;
+    postings_init (&wordPtr->postings);
+    postings_add (&ht->postings, &wordPtr->postings, doc);
+    wordPtr->positions = new_positions (ht);
+}
 
-	// Check for allocation errors
-    if (wordPtr->docHead == NULL) {
-        printf("Error: unable to allocate memory for wordPtr->docHead\n");
-        exit (0);
+/**
+ * (1) Inserts this word and doc pair into hashtable along with the
+ *     corresponding posting for which this word occurs in.
+ * (2) If the word and doc pair already exists, update its tf.
+ * (3) If the word exists but in a different document,
+ *     add new doc and update its df.
+ * Documents must be inserted in increasing order of doc, so only the last posting
+ * of a word ever needs to be checked. The word is copied the first time it is seen.
+ * @param ht      pointer to the hashtable
+ * @param word    first byte of the word, need not be NUL terminated
+ * @param len     length of the word
+ * @param doc     number of the document word belongs to, its index in ht->docs
+ * @param pos     number of the token within the document, kept if ht->positions
+ */
+void ht_insert (struct hashtable* ht, const char* word, size_t len, uint32_t doc, uint32_t pos) {
+    uint64_t hash = hash_code (word, len);
+
+    // Make room first so the slot found below stays valid
+    if (ht->num_elements + 1 > ht->num_buckets * HT_MAX_LOAD) {
+        ht_grow (ht);
+    }
+
+    uint64_t mask = (uint64_t) ht->num_buckets - 1;
+    uint64_t i = hash & mask;
+
+    // Probe until we find the word or an empty slot
+    while (ht->map[i].word != NULL) {
+        struct wordNode* wordPtr = &ht->map[i];
+
+        // Only compare bytes when the full hashes and the lengths match
+        if (wordPtr->hash == hash && wordPtr->len == len) {
+            STATS_COUNT (STATS_STRCMP, 1);
+            if (memcmp (wordPtr->word, word, len) == 0) {
+                STATS_PROBES (((i - hash) & mask) + 1);
+
+                // Increment the tf, and the df if the word is new to this doc
+                if (postings_add (&ht->postings, &wordPtr->postings, doc)) {
+                    wordPtr->df++;
+                }
+                thaw (ht);
+                if (wordPtr->positions != NULL) {
+                    positions_add (&ht->postings, wordPtr->positions, doc, pos);
+                }
+                return;
+            }
+        }
+        i = (i + 1) & mask;
     }
+    STATS_PROBES (((i - hash) & mask) + 1);
 
-    wordPtr->next = NULL;
+    // Reached an empty slot, word is not in hashtable so keep a copy of it
+    init_wordNode (ht, &ht->map[i], arena_strndup (&ht->words, word, len), len, hash, doc);
+    if (ht->map[i].positions != NULL) {
+        positions_add (&ht->postings, ht->map[i].positions, doc, pos);
+    }
 
-    // Initialize fields of docNode
-    init_docNode (wordPtr->docHead, doc_id);
+    // Increment num_elements
+    ht->num_elements++;
+    thaw (ht);
 }
 
 /**
- * (1) Inserts this word and doc_id pair into hashtable along with the
- *     corresponding docNode for which this word occurs in.
- * (2) If the word and doc_id pair already exists, update its tf.
- * (3) If the word exists but in a different document,
- *     add new doc_id and update its df.
+ * Finds the entry for this word, adding it with df = 0 and no postings if it is
+ * missing. The word is copied into ht->words when it is added, with an empty
+ * positions list if ht->positions. The caller changes the entry's df and
+ * postings, so the hashtable is no longer frozen.
  * @param ht      pointer to the hashtable
- * @param word    char* to word we need to add
- * @param doc_id  char* to doc_id word belongs to
+ * @param word    first byte of the word, need not be NUL terminated
+ * @param len     length of the word
+ * @param hash    hash_code() of word
+ * @return pointer to the word's entry, valid until the next insert
  */
-void ht_insert (struct hashtable* ht, char* word, char* doc_id) {
-    // Get this bucket this word belongs in
-	int hashCode = hash_code (ht, word);
-
-    // Set pointer to point to correct bucket
-	struct wordNode* wordPtr = ht->map[hashCode];
-
-    // If the first word in the bucket is NULL, then call init_wordNode() to fill it
-	if (wordPtr->word == NULL) {
-        init_wordNode (wordPtr, word, doc_id);
-        // Increment num_elements
-    	ht->num_elements++;
-        return;
-	}
-
-	// Temporary pointer to track node before the one we are looking at,
-	// this way we can set the wordPtr->next to the correct node
-	struct wordNode* lastPtr = NULL;
-
-    // While the word is not NULL continue on through list
-	while (wordPtr != NULL) {
-		// If we've found the word already in hashtable, we only need to update its fields
-		if (strcmp (wordPtr->word, word) == 0) {
-
-			// Since the word already exists, we can free the copy of it
-			free (word);
-
-            // Continue through docNodes until we find the right doc
-            struct docNode* docPtr = wordPtr->docHead;
-            struct docNode* lastDocPtr = NULL;
-            while (docPtr != NULL) {
-                // If the doc already exists, increment its tf
-                if (strcmp (docPtr->doc_id, doc_id) == 0) {
-                    docPtr->tf += 1;
-                    return;
-                }
-                lastDocPtr = docPtr;
-                docPtr = docPtr->next;
-            }
-            // Else, this word is in a new doc
-            docPtr = (struct docNode*) malloc (sizeof (struct docNode));
+struct wordNode* ht_add_word (struct hashtable* ht, const char* word, size_t len, uint64_t hash) {
+    // The caller adds postings to the entry, changing its df
+    thaw (ht);
 
-			// Check for allocation errors
-		    if (docPtr == NULL) {
-		        printf("Error: unable to allocate memory for docPtr\n");
-		        exit (0);
-		    }
+    // Make room first so the slot found below stays valid
+    if (ht->num_elements + 1 > ht->num_buckets * HT_MAX_LOAD) {
+        ht_grow (ht);
+    }
 
-            init_docNode (docPtr, doc_id);
+    uint64_t mask = (uint64_t) ht->num_buckets - 1;
+    uint64_t i = hash & mask;
 
-			// Increment the df
-			wordPtr->df++;
+    // Probe until we find the word or an empty slot
+    while (ht->map[i].word != NULL) {
+        if (ht->map[i].hash == hash && ht->map[i].len == len && memcmp (ht->map[i].word, word, len) == 0) {
+            return &ht->map[i];
+        }
+        i = (i + 1) & mask;
+    }
 
-            // Stitch the last docNode to this one
-            lastDocPtr->next = docPtr;
+    ht->map[i].word = arena_strndup (&ht->words, word, len);
+    ht->map[i].hash = hash;
+    ht->map[i].len = (uint32_t) len;
+    ht->map[i].positions = new_positions (ht);
+    ht->num_elements++;
+    thaw (ht);
+    return &ht->map[i];
+}
 
-            return;
-		}
-		// If this is not the word we are trying to insert, continue to next node
-		lastPtr = wordPtr;
-		wordPtr = wordPtr->next;
-	}
+/**
+ * Doubles the number of buckets and re-inserts every word using its stored hash.
+ * @param ht pointer to the hashtable
+ */
+void ht_grow (struct hashtable* ht) {
+    int old_buckets = ht->num_buckets;
+    struct wordNode* old_map = ht->map;
 
-    // If wordPtr==NULL, word is not in hashtable, call init_wordNode
-    wordPtr = (struct wordNode*) malloc (sizeof (struct wordNode));
+    int new_buckets = old_buckets * 2;
+    struct wordNode* new_map = (struct wordNode*) malloc (new_buckets * sizeof (struct wordNode));
 
-	// Check for allocation errors
-    if (wordPtr == NULL) {
-        printf("Error: unable to allocate memory for wordPtr\n");
+    // Check for allocation errors
+    if (new_map == NULL) {
+        printf("Error: unable to allocate memory for ht->map\n");
         exit (0);
     }
 
-    init_wordNode (wordPtr, word, doc_id);
+    for (int i = 0; i < new_buckets; i++) {
+        init_empty_wordNode (&new_map[i]);
+    }
+
+    // Words are already unique, so only an empty slot is needed for each one
+    uint64_t mask = (uint64_t) new_buckets - 1;
+    for (int i = 0; i < old_buckets; i++) {
+        if (old_map[i].word == NULL) {
+            continue;
+        }
+        uint64_t j = old_map[i].hash & mask;
+        while (new_map[j].word != NULL) {
+            j = (j + 1) & mask;
+        }
+        new_map[j] = old_map[i];
+    }
+
+    free (old_map);
+    ht->map = new_map;
+    ht->num_buckets = new_buckets;
+}
+
+/**
+ * Compares the words of two slots, for qsort().
+ * @param  a pointer to the first slot's wordNode pointer
+ * @param  b pointer to the second slot's wordNode pointer
+ * @return negative, zero or positive as a sorts before, with or after b
+ */
+static int word_comparator (const void* a, const void* b) {
+    return strcmp ((*(struct wordNode* const*) a)->word, (*(struct wordNode* const*) b)->word);
+}
 
-	// Set node before this one's next to this node
-	lastPtr->next = wordPtr;
+/**
+ * Allocates an array for the frozen terms, with room for one more element.
+ * @param  count  number of elements
+ * @param  size   size of one element
+ * @return pointer to the array
+ */
+static void* frozen_array (uint64_t count, size_t size) {
+    void* array = malloc ((count + 1) * size);
 
-	// Increment num_elements
-	ht->num_elements++;
+    // Check for allocation errors
+    if (array == NULL) {
+        printf("Error: unable to allocate memory for frozen terms\n");
+        exit (0);
+    }
+    return array;
 }
 
 /**
- * Deallocate the given list of docNodes.
- * @param docPtr pointer to head of the list
+ * Copies the words of a trained hashtable into ht->terms in sorted order, the
+ * frozen dictionary that ht_expand() searches, with their dfs. Adding a word or a
+ * posting drops it again.
+ * @param ht pointer to the hashtable
  */
-void destroy_docList (struct docNode* docPtr) {
-    // Temporary ptr
-    struct docNode* temp = NULL;
-
-    // Loop through the docNodes
-    while (docPtr != NULL) {
-        // Free current node while maintaining access to the rest of list
-        temp = docPtr;
-        docPtr = docPtr->next;
-        free (temp);
+void ht_freeze (struct hashtable* ht) {
+    thaw (ht);
+    struct wordNode** sorted = (struct wordNode**) frozen_array (ht->num_elements, sizeof (struct wordNode*));
+
+    uint32_t n = 0;
+    uint64_t string_bytes = 0;
+    for (int i = 0; i < ht->num_buckets; i++) {
+        if (ht->map[i].word != NULL) {
+            sorted[n++] = &ht->map[i];
+            string_bytes += ht->map[i].len + 1;
+        }
     }
+    qsort (sorted, n, sizeof (struct wordNode*), word_comparator);
+
+    if (string_bytes > UINT32_MAX) {
+        printf("Error: too many bytes of words to freeze\n");
+        exit (0);
+    }
+
+    // The words are copied back to back, so walking the dictionary in sorted
+    // order reads memory in order instead of jumping around the arena
+    struct frozen_terms* terms = &ht->terms;
+    terms->num_terms = n;
+    terms->strings = (char*) frozen_array (string_bytes, 1);
+    terms->word_offset = (uint32_t*) frozen_array (n, sizeof (uint32_t));
+    terms->df = (int*) frozen_array (n, sizeof (int));
+    terms->idf = (double*) frozen_array (n, sizeof (double));
+
+    uint32_t pos = 0;
+    for (uint32_t t = 0; t < n; t++) {
+        memcpy (terms->strings + pos, sorted[t]->word, sorted[t]->len + 1);
+        terms->word_offset[t] = pos;
+        terms->df[t] = sorted[t]->df;
+        terms->idf[t] = 0;
+        sorted[t]->term = t;
+        pos += sorted[t]->len + 1;
+    }
+    free (sorted);
 }
 
 /**
- * Deallocate the given list of wordNodes.
- * @param wordPtr pointer to head of the list
+ * Decodes the postings of a frozen hashtable into ht->terms, one slice of doc
+ * numbers and tfs per term, and copies the document lengths next to them, for
+ * scoring many queries. The postings lists are kept for phrase queries.
+ * @param ht pointer to the hashtable, frozen with ht_freeze()
  */
-void destroy_wordList (struct wordNode* wordPtr) {
-    // Temporary ptr
-    struct wordNode* temp = NULL;
-
-    // Loop through the wordNodes
-    while (wordPtr != NULL) {
-        // Free list of docs at each word
-        destroy_docList (wordPtr->docHead);
-
-		// Members of this wordNode
-		free (wordPtr->word);
-
-        // Free current node while maintaining access to the rest of list
-        temp = wordPtr;
-        wordPtr = wordPtr->next;
-        free (temp);
+void ht_freeze_postings (struct hashtable* ht) {
+    struct frozen_terms* terms = &ht->terms;
+    if (terms->docs != NULL) {
+        return;
     }
+
+    // Each term's slice starts where the one before it ends
+    terms->postings_offset = (uint64_t*) frozen_array (terms->num_terms, sizeof (uint64_t));
+    uint64_t num_postings = 0;
+    for (uint32_t t = 0; t < terms->num_terms; t++) {
+        terms->postings_offset[t] = num_postings;
+        num_postings += terms->df[t];
+    }
+    terms->postings_offset[terms->num_terms] = num_postings;
+
+    terms->docs = (uint32_t*) frozen_array (num_postings, sizeof (uint32_t));
+    terms->tfs = (uint32_t*) frozen_array (num_postings, sizeof (uint32_t));
+    for (int i = 0; i < ht->num_buckets; i++) {
+        const struct wordNode* wordPtr = &ht->map[i];
+        if (wordPtr->word == NULL) {
+            continue;
+        }
+
+        uint64_t p = terms->postings_offset[wordPtr->term];
+        struct postings_cursor cur;
+        postings_open (&cur, &wordPtr->postings);
+        while (postings_next (&cur)) {
+            terms->docs[p] = cur.doc;
+            terms->tfs[p] = cur.tf;
+            p++;
+        }
+    }
+
+    terms->lengths = (uint32_t*) frozen_array (ht->num_docs, sizeof (uint32_t));
+    for (int d = 0; d < ht->num_docs; d++) {
+        terms->lengths[d] = ht->docs[d].length;
+    }
+}
+
+/**
+ * Word i of a frozen hashtable's sorted dictionary.
+ * @param  dict  pointer to the hashtable
+ * @param  i     index of the word in sorted order
+ * @return the word
+ */
+static char* sorted_word (const void* dict, uint32_t i) {
+    const struct frozen_terms* terms = &((const struct hashtable*) dict)->terms;
+    return terms->strings + terms->word_offset[i];
+}
+
+/**
+ * Finds the words a wildcard or fuzzy word matches in the frozen dictionary, see
+ * query_dict_expand().
+ * @param  ht         pointer to the hashtable, frozen with ht_freeze()
+ * @param  w          pointer to the wildcard
+ * @param  words      array of at least max_words words to fill in, in sorted order
+ * @param  max_words  most words to find
+ * @return number of words found
+ */
+int ht_expand (const struct hashtable* ht, const struct query_wildcard* w, char** words, int max_words) {
+    struct query_dict d = {ht, ht->terms.num_terms, sorted_word};
+    return query_dict_expand (&d, w, words, max_words);
 }
 
 /**
- * Deallocate this hashtable.
+ * Deallocate this hashtable, including its document table. Words and postings
+ * are released a whole arena chunk at a time.
  * @param ht pointer to hashtable
  */
 void ht_destroy (struct hashtable* ht) {
-	// Loop through each bucket, destroying the list of words in each one
-	for (int i = 0; i < ht->num_buckets; i++) {
-        destroy_wordList (ht->map[i]);
-	}
-	free (ht->map);	
-	free (ht);
+    thaw (ht);
+    if (ht->docs != NULL) {
+        doc_table_destroy (ht->docs, ht->num_docs);
+    }
+    arena_destroy (&ht->words);
+    arena_destroy (&ht->postings);
+    free (ht->map);
+    free (ht);
 }
 
 /**
- * Hashing function to determine which bucket this word belongs in.
- * @param ht      pointer to the hashtable
- * @param word    char* to word we need to add
- * @return the hash code of this word and doc_id pair
+ * Finalizer from MurmurHash3, spreads every input bit over the whole word.
+ * @param  x value to mix
+ * @return mixed value
  */
-int hash_code (struct hashtable* ht, char* word) {
-	// Track sum of ASCII values of word
-	int sum = 0;
-	int i = 0;
-
-	// Loop through, adding ASCII values of each char to sum
-	while (*(word+i) != '\0') {
-		sum += (int) *(word+i);
-		i++;
-	}
-
-	// Return the sum % num_buckets to keep range consitent
-	return sum % ht->num_buckets;
+static inline uint64_t mix64 (uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
 }
 
 /**
- * Searches the given hashtable for this word..
- * @param  ht      pointer to the hashtable to search in
- * @param  word    char* to the word to search for
- * @return pointer to the wordNode this word belongs
+ * 64-bit hash of the first len bytes of word.
+ * Consumes 8 bytes per step with a multiply/rotate round and mixes the result.
+ * @param word    bytes to hash
+ * @param len     number of bytes
+ * @return the hash code of this word
  */
-struct wordNode* get_word (struct hashtable* ht, char* word) {
-    // Get the bucket this word would belong to
-    int hashCode = hash_code (ht, word);
+uint64_t hash_code (const char* word, size_t len) {
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ (len * 0xc2b2ae3d27d4eb4fULL);
+    uint64_t k;
+
+    // Whole 8 byte blocks
+    while (len >= 8) {
+        memcpy (&k, word, 8);
+        k *= 0x87c37b91114253d5ULL;
+        k = (k << 31) | (k >> 33);
+        h ^= k * 0x4cf5ad432745937fULL;
+        h = ((h << 27) | (h >> 37)) * 5 + 0x52dce729;
+        word += 8;
+        len -= 8;
+    }
 
-    // Set pointer to head of word list at this bucket
-    struct wordNode* wordPtr = ht->map[hashCode];
+    // Remaining 0-7 bytes
+    k = 0;
+    memcpy (&k, word, len);
+    h ^= k * 0x87c37b91114253d5ULL;
 
-    // If the word at this bucket is NULL, word does not exist in the list
-    if (wordPtr->word == NULL) {
-        return NULL;
-    }
+    return mix64 (h);
+}
 
-    // Loop through word list searching for word
-    while (wordPtr != NULL && strcmp (wordPtr->word, word) != 0) {
-        wordPtr = wordPtr->next;
+/**
+ * Searches the given hashtable for a word whose length and hash are already known,
+ * such as a word from another hashtable.
+ * @param  ht      pointer to the hashtable to search in
+ * @param  word    first byte of the word, need not be NUL terminated
+ * @param  len     length of the word
+ * @param  hash    hash_code() of word
+ * @return pointer to the wordNode this word belongs, or NULL if it is not present
+ */
+struct wordNode* ht_find (struct hashtable* ht, const char* word, size_t len, uint64_t hash) {
+    uint64_t mask = (uint64_t) ht->num_buckets - 1;
+    uint64_t i = hash & mask;
+
+    // Probe until we reach an empty slot
+    while (ht->map[i].word != NULL) {
+        if (ht->map[i].hash == hash && ht->map[i].len == len) {
+            STATS_COUNT (STATS_STRCMP, 1);
+            if (memcmp (ht->map[i].word, word, len) == 0) {
+                STATS_PROBES (((i - hash) & mask) + 1);
+                return &ht->map[i];
+            }
+        }
+        i = (i + 1) & mask;
     }
 
-    // If we reached NULL, word does not exist in this hashtable
-    if (wordPtr == NULL) {
-        return NULL;
-    }
+    // Reached an empty slot, word does not exist in this hashtable
+    STATS_PROBES (((i - hash) & mask) + 1);
+    return NULL;
+}
 
-    // Else, we have found the word
-    return wordPtr;
+/**
+ * Searches the given hashtable for this word..
+ * @param  ht      pointer to the hashtable to search in
+ * @param  word    char* to the word to search for
+ * @return pointer to the wordNode this word belongs, or NULL if it is not present
+ */
+struct wordNode* get_word (struct hashtable* ht, char* word) {
+    size_t len = strlen (word);
+    return ht_find (ht, word, len, hash_code (word, len));
 }
@@ -0,0 +1,696 @@
+/**************************************************************************************
+* Jack Umina
+* Created Nov, 2019
+* Reads and writes a trained hashtable as a single binary index file that queries
+* can mmap instead of re-training on every run.
+***************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "hashtable.h"
+#include "indexfile.h"
+#include "query.h"
+#include "stats.h"
+
+/**
+ * Rounds n up to the next multiple of 8 so every section stays aligned.
+ * @param  n a byte count
+ * @return n rounded up
+ */
+static uint64_t align8 (uint64_t n) {
+    return (n + 7) & ~(uint64_t) 7;
+}
+
+/**
+ * Checksum of the header with its own checksum field zeroed.
+ * @param  header pointer to the header
+ * @return the header checksum
+ */
+static uint64_t header_checksum (const struct index_header* header) {
+    struct index_header copy = *header;
+    copy.header_checksum = 0;
+    return hash_code ((const char*) &copy, sizeof (copy));
+}
+
+/**
+ * Quantizes a posting's score to an impact. Scores above 0 never round to 0.
+ * @param  score  the posting's score
+ * @param  scale  score of an impact of 1
+ * @return the impact
+ */
+static uint8_t quantize (double score, double scale) {
+    if (score <= 0) {
+        return 0;
+    }
+    long q = lround (score / scale);
+    return q < 1 ? 1 : q > IMPACT_MAX ? IMPACT_MAX : (uint8_t) q;
+}
+
+/**
+ * A term's word and slot, sorted by word.
+ */
+struct sorted_term {
+    const char* word;
+    uint32_t slot;
+};
+
+/**
+ * Compares two terms by their words, for qsort().
+ * @param  a pointer to the first term
+ * @param  b pointer to the second term
+ * @return negative, zero or positive as a sorts before, with or after b
+ */
+static int sorted_term_comparator (const void* a, const void* b) {
+    return strcmp (((const struct sorted_term*) a)->word, ((const struct sorted_term*) b)->word);
+}
+
+/**
+ * Lists the slots of the term directory in sorted order of their words.
+ * @param slots      the filled in term directory
+ * @param num_slots  number of slots
+ * @param strings    the strings the words point into
+ * @param sorted     array to fill in, one entry per term
+ */
+static void sort_terms (const struct index_term* slots, uint32_t num_slots, const char* strings, uint32_t* sorted) {
+    uint32_t num_terms = 0;
+    for (uint32_t j = 0; j < num_slots; j++) {
+        num_terms += slots[j].df != 0;
+    }
+
+    struct sorted_term* terms = (struct sorted_term*) malloc ((num_terms + 1) * sizeof (struct sorted_term));
+
+    // Check for allocation errors
+    if (terms == NULL) {
+        printf("Error: unable to allocate memory for sorted terms\n");
+        exit (0);
+    }
+
+    uint32_t n = 0;
+    for (uint32_t j = 0; j < num_slots; j++) {
+        if (slots[j].df != 0) {
+            terms[n].word = strings + slots[j].word_offset;
+            terms[n].slot = j;
+            n++;
+        }
+    }
+    qsort (terms, n, sizeof (struct sorted_term), sorted_term_comparator);
+
+    for (uint32_t i = 0; i < n; i++) {
+        sorted[i] = terms[i].slot;
+    }
+    free (terms);
+}
+
+/**
+ * Serializes a trained hashtable into an index file. The file is written to a
+ * temporary name and renamed into place so readers never see a partial index.
+ * Positions are stored when the hashtable recorded them.
+ * @param ht       pointer to the trained hashtable
+ * @param path     name of the file to create
+ * @param impacts  model to precompute impacts with, from this file's own statistics,
+ *                 or NULL to store none
+ */
+void index_write (struct hashtable* ht, const char* path, const struct scoring* impacts) {
+    double start = stats_begin ();
+
+    // Size the term directory for a load factor of at most HT_MAX_LOAD
+    uint32_t num_slots = 16;
+    while (num_slots * HT_MAX_LOAD < ht->num_elements) {
+        num_slots <<= 1;
+    }
+
+    // Count postings, their blocks, their encoded size and string bytes
+    uint64_t num_postings = 0;
+    uint64_t num_blocks = 0;
+    uint64_t postings_bytes = 0;
+    uint64_t positions_bytes = 0;
+    uint64_t strings_size = 0;
+    for (int i = 0; i < ht->num_buckets; i++) {
+        if (ht->map[i].word != NULL) {
+            num_postings += ht->map[i].df;
+            num_blocks += (ht->map[i].df + INDEX_BLOCK_SIZE - 1) / INDEX_BLOCK_SIZE;
+            postings_bytes += postings_size (&ht->map[i].postings);
+            strings_size += ht->map[i].len + 1;
+            if (ht->positions) {
+                positions_bytes += positions_size (ht->map[i].positions);
+            }
+        }
+    }
+    for (int i = 0; i < ht->num_docs; i++) {
+        strings_size += strlen (ht->docs[i].path) + 1;
+    }
+
+    // Impacts are scaled so the best scoring posting in this file gets IMPACT_MAX
+    struct scorer scorer = {SCORE_TFIDF, 0, 0, 0};
+    double max_score = 0;
+    if (impacts != NULL) {
+        uint64_t total_length = 0;
+        for (int i = 0; i < ht->num_docs; i++) {
+            total_length += ht->docs[i].length;
+        }
+        scorer_init (&scorer, impacts, ht->num_docs > 0 ? (double) total_length / ht->num_docs : 0);
+
+        for (int i = 0; i < ht->num_buckets; i++) {
+            struct wordNode* wordPtr = &ht->map[i];
+            if (wordPtr->word == NULL) {
+                continue;
+            }
+
+            double idf = scoring_idf (impacts, wordPtr->df, ht->num_docs);
+            struct postings_cursor cur;
+            postings_open (&cur, &wordPtr->postings);
+            while (postings_next (&cur)) {
+                double score = scorer_term (&scorer, cur.tf, ht->docs[cur.doc].length, idf);
+                if (score > max_score) {
+                    max_score = score;
+                }
+            }
+        }
+    }
+
+    // Lay out the sections
+    struct index_header header;
+    memset (&header, 0, sizeof (header));
+    memcpy (header.magic, INDEX_MAGIC, sizeof (INDEX_MAGIC));
+    header.version = INDEX_VERSION;
+    header.num_docs = ht->num_docs;
+    header.num_terms = ht->num_elements;
+    header.num_slots = num_slots;
+    if (impacts != NULL) {
+        header.impacts = 1;
+        header.impact_model = impacts->model;
+        header.impact_k1 = impacts->k1;
+        header.impact_b = impacts->b;
+        header.impact_scale = max_score > 0 ? max_score / IMPACT_MAX : 1;
+    }
+    header.positions = ht->positions != 0;
+    header.positions_size = positions_bytes;
+    header.num_postings = num_postings;
+    header.postings_size = postings_bytes;
+    header.num_blocks = num_blocks;
+    header.docs_offset = align8 (sizeof (header));
+    header.slots_offset = header.docs_offset + ht->num_docs * sizeof (struct index_doc);
+    header.blocks_offset = header.slots_offset + num_slots * sizeof (struct index_term);
+    header.postings_offset = header.blocks_offset + num_blocks * sizeof (struct index_block);
+    header.impacts_offset = header.postings_offset + postings_bytes;
+    header.block_positions_offset = align8 (header.impacts_offset + (impacts != NULL ? num_postings : 0));
+    header.sorted_offset = header.block_positions_offset + (ht->positions ? num_blocks * sizeof (uint32_t) : 0);
+    header.positions_offset = header.sorted_offset + ht->num_elements * sizeof (uint32_t);
+    header.strings_offset = header.positions_offset + positions_bytes;
+    header.file_size = align8 (header.strings_offset + strings_size);
+
+    char* image = (char*) calloc (1, header.file_size);
+
+    // Check for allocation errors
+    if (image == NULL) {
+        printf("Error: unable to allocate memory for index image\n");
+        exit (0);
+    }
+
+    struct index_doc* docs = (struct index_doc*) (image + header.docs_offset);
+    struct index_term* slots = (struct index_term*) (image + header.slots_offset);
+    struct index_block* blocks = (struct index_block*) (image + header.blocks_offset);
+    uint8_t* postings = (uint8_t*) (image + header.postings_offset);
+    uint8_t* impact_bytes = (uint8_t*) (image + header.impacts_offset);
+    uint32_t* block_positions = (uint32_t*) (image + header.block_positions_offset);
+    uint32_t* sorted = (uint32_t*) (image + header.sorted_offset);
+    uint8_t* positions = (uint8_t*) (image + header.positions_offset);
+    char* strings = image + header.strings_offset;
+    uint64_t string_pos = 0;
+
+    // Document table
+    for (int i = 0; i < ht->num_docs; i++) {
+        size_t len = strlen (ht->docs[i].path) + 1;
+        memcpy (strings + string_pos, ht->docs[i].path, len);
+        docs[i].path_offset = string_pos;
+        docs[i].mtime = ht->docs[i].mtime;
+        docs[i].length = ht->docs[i].length;
+        string_pos += len;
+    }
+
+    // Terms and their postings
+    uint64_t mask = num_slots - 1;
+    uint64_t posting_pos = 0;
+    uint64_t block_pos = 0;
+    uint64_t impact_pos = 0;
+    uint64_t positions_pos = 0;
+    for (int i = 0; i < ht->num_buckets; i++) {
+        struct wordNode* wordPtr = &ht->map[i];
+        if (wordPtr->word == NULL) {
+            continue;
+        }
+
+        // Find this word's slot in the new directory
+        uint64_t j = wordPtr->hash & mask;
+        while (slots[j].df != 0) {
+            j = (j + 1) & mask;
+        }
+
+        size_t len = wordPtr->len;
+        memcpy (strings + string_pos, wordPtr->word, len + 1);
+
+        slots[j].hash = wordPtr->hash;
+        slots[j].word_offset = string_pos;
+        slots[j].word_len = len;
+        slots[j].df = wordPtr->df;
+        slots[j].max_tf = postings_max_tf (&wordPtr->postings);
+        slots[j].postings_offset = posting_pos;
+        slots[j].blocks_offset = block_pos;
+        slots[j].impacts_offset = impact_pos;
+        slots[j].positions_offset = positions_pos;
+        string_pos += len + 1;
+
+        // Positions are copied as they are, blocks note where theirs start below
+        struct positions_cursor positions_cur;
+        if (ht->positions) {
+            positions_open_bytes (&positions_cur, positions + positions_pos);
+            positions_pos += positions_write (wordPtr->positions, positions + positions_pos);
+        }
+
+        double idf = impacts != NULL ? scoring_idf (impacts, wordPtr->df, ht->num_docs) : 0;
+
+        const uint8_t* start = postings + posting_pos;
+        posting_pos += postings_write (&wordPtr->postings, postings + posting_pos);
+
+        // Split the written postings into blocks, noting where each starts
+        struct postings_cursor cur;
+        struct index_block* block = NULL;
+        postings_open_bytes (&cur, start, wordPtr->df);
+        for (int n = 0; n < wordPtr->df; n++) {
+            if (n % INDEX_BLOCK_SIZE == 0) {
+                if (ht->positions) {
+                    block_positions[block_pos] = positions_cur.pos - (positions + slots[j].positions_offset);
+                }
+                block = &blocks[block_pos++];
+                block->offset = cur.pos - start;
+                block->max_tf = 0;
+            }
+            postings_next (&cur);
+            if (ht->positions) {
+                positions_skip (&positions_cur, cur.tf);
+            }
+            block->last_doc = cur.doc;
+            if (cur.tf > block->max_tf) {
+                block->max_tf = cur.tf;
+            }
+            if (impacts != NULL) {
+                double score = scorer_term (&scorer, cur.tf, ht->docs[cur.doc].length, idf);
+                impact_bytes[impact_pos++] = quantize (score, header.impact_scale);
+            }
+        }
+    }
+
+    sort_terms (slots, num_slots, strings, sorted);
+
+    header.body_checksum = hash_code (image + sizeof (header), header.file_size - sizeof (header));
+    header.header_checksum = header_checksum (&header);
+    memcpy (image, &header, sizeof (header));
+
+    // Write to a temporary file, then atomically replace the old index
+    char tmp_path[strlen (path) + 5];
+    sprintf (tmp_path, "%s.tmp", path);
+
+    FILE* f = fopen (tmp_path, "wb");
+    if (f == NULL) {
+        printf("Error in opening %s: %s\n", tmp_path, strerror (errno));
+        exit (0);
+    }
+    if (fwrite (image, 1, header.file_size, f) != header.file_size || fclose (f) != 0) {
+        printf("Error in writing %s: %s\n", tmp_path, strerror (errno));
+        exit (0);
+    }
+    if (rename (tmp_path, path) != 0) {
+        printf("Error in renaming %s: %s\n", tmp_path, strerror (errno));
+        exit (0);
+    }
+
+    free (image);
+    stats_end (STATS_INDEX_WRITE, start);
+}
+
+/**
+ * Checks that a section of count elements of size bytes each, starting at offset,
+ * lies within the file.
+ * @param  offset     first byte of the section
+ * @param  count      number of elements
+ * @param  size       bytes per element
+ * @param  file_size  size of the whole file
+ * @return 1 if it fits, 0 if it runs past the end
+ */
+static int section_fits (uint64_t offset, uint64_t count, uint64_t size, uint64_t file_size) {
+    return offset <= file_size && count <= (file_size - offset) / size;
+}
+
+/**
+ * Checks that a NUL terminated string starts inside the strings section and ends
+ * before it does.
+ * @param  strings       first byte of the strings section
+ * @param  strings_size  size of the strings section
+ * @param  offset        offset of the string in the section
+ * @param  len           length of the string
+ * @return 1 if it does, 0 if not
+ */
+static int string_fits (const char* strings, uint64_t strings_size, uint64_t offset, uint64_t len) {
+    return offset < strings_size && len < strings_size - offset && strings[offset + len] == '\0';
+}
+
+/**
+ * Checks that every section the header describes, every document path and every
+ * term's word, postings, blocks, impacts and positions lie within the file, so no
+ * offset read from it leads outside the mapping. Unlike the body checksum, this
+ * only reads the document table, the term directory and the sorted terms.
+ * @param  header  pointer to the header, already checksummed
+ * @param  base    first byte of the mapping
+ * @return 1 if the layout is sound, 0 if the file is corrupt
+ */
+static int layout_valid (const struct index_header* header, const char* base) {
+    uint64_t file_size = header->file_size;
+    if (!section_fits (header->docs_offset, header->num_docs, sizeof (struct index_doc), file_size)
+            || !section_fits (header->slots_offset, header->num_slots, sizeof (struct index_term), file_size)
+            || !section_fits (header->blocks_offset, header->num_blocks, sizeof (struct index_block), file_size)
+            || !section_fits (header->postings_offset, header->postings_size, 1, file_size)
+            || (header->impacts && !section_fits (header->impacts_offset, header->num_postings, 1, file_size))
+            || (header->positions && !section_fits (header->block_positions_offset, header->num_blocks,
+                    sizeof (uint32_t), file_size))
+            || !section_fits (header->sorted_offset, header->num_terms, sizeof (uint32_t), file_size)
+            || (header->positions && !section_fits (header->positions_offset, header->positions_size, 1, file_size))
+            || !section_fits (header->strings_offset, 0, 1, file_size)) {
+        return 0;
+    }
+
+    // Lookups probe with a mask and stop at an empty slot
+    uint32_t num_slots = header->num_slots;
+    if (num_slots == 0 || (num_slots & (num_slots - 1)) != 0 || header->num_terms >= num_slots) {
+        return 0;
+    }
+
+    const char* strings = base + header->strings_offset;
+    uint64_t strings_size = file_size - header->strings_offset;
+    const struct index_doc* docs = (const struct index_doc*) (base + header->docs_offset);
+    for (uint32_t i = 0; i < header->num_docs; i++) {
+        uint64_t offset = docs[i].path_offset;
+        if (offset >= strings_size || memchr (strings + offset, '\0', strings_size - offset) == NULL) {
+            return 0;
+        }
+    }
+
+    const struct index_term* slots = (const struct index_term*) (base + header->slots_offset);
+    uint32_t num_terms = 0;
+    for (uint32_t j = 0; j < num_slots; j++) {
+        const struct index_term* term = &slots[j];
+        if (term->df == 0) {
+            continue;
+        }
+        uint64_t num_blocks = (term->df + (uint64_t) INDEX_BLOCK_SIZE - 1) / INDEX_BLOCK_SIZE;
+        if (!string_fits (strings, strings_size, term->word_offset, term->word_len)
+                || term->postings_offset >= header->postings_size
+                || term->blocks_offset > header->num_blocks || num_blocks > header->num_blocks - term->blocks_offset
+                || (header->impacts && (term->impacts_offset > header->num_postings
+                        || term->df > header->num_postings - term->impacts_offset))
+                || (header->positions && term->positions_offset >= header->positions_size)) {
+            return 0;
+        }
+        num_terms++;
+    }
+    if (num_terms != header->num_terms) {
+        return 0;
+    }
+
+    const uint32_t* sorted = (const uint32_t*) (base + header->sorted_offset);
+    for (uint32_t i = 0; i < header->num_terms; i++) {
+        if (sorted[i] >= num_slots || slots[sorted[i]].df == 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Maps an index file into memory and validates its header and the offsets in its
+ * layout. The document table is the only part copied out of the mapping, its paths
+ * still point into it.
+ * @param  path    name of the index file
+ * @param  verify  when non-zero, also checksum the whole body (reads every page)
+ * @return pointer to the mapped index, or NULL if the file does not exist
+ */
+struct index_file* index_open (const char* path, int verify) {
+    double start = stats_begin ();
+    int fd = open (path, O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return NULL;
+        }
+        printf("Error in opening %s: %s\n", path, strerror (errno));
+        exit (0);
+    }
+
+    struct stat st;
+    if (fstat (fd, &st) != 0) {
+        printf("Error in reading %s: %s\n", path, strerror (errno));
+        exit (0);
+    }
+
+    if ((size_t) st.st_size < sizeof (struct index_header)) {
+        printf("Error: %s is not an index file\n", path);
+        exit (0);
+    }
+
+    void* base = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+
+    if (base == MAP_FAILED) {
+        printf("Error in mapping %s: %s\n", path, strerror (errno));
+        exit (0);
+    }
+
+    const struct index_header* header = (const struct index_header*) base;
+
+    // Check that this is an index file of our version and that it is complete. The
+    // version comes first, the header of another version has another size.
+    if (memcmp (header->magic, INDEX_MAGIC, sizeof (INDEX_MAGIC)) != 0) {
+        printf("Error: %s is not an index file\n", path);
+        exit (0);
+    }
+    if (header->version != INDEX_VERSION) {
+        printf("Error: %s has version %u, expected %d. Rebuild it with ./search index\n",
+                path, header->version, INDEX_VERSION);
+        exit (0);
+    }
+    if (header->header_checksum != header_checksum (header)) {
+        printf("Error: %s is not an index file\n", path);
+        exit (0);
+    }
+    if (header->file_size != (uint64_t) st.st_size) {
+        printf("Error: %s is truncated\n", path);
+        exit (0);
+    }
+    if (!layout_valid (header, (const char*) base) || (verify && header->body_checksum
+                != hash_code ((const char*) base + sizeof (*header), header->file_size - sizeof (*header)))) {
+        printf("Error: %s is corrupt\n", path);
+        exit (0);
+    }
+
+    struct index_file* idx = (struct index_file*) malloc (sizeof (struct index_file));
+
+    // Check for allocation errors
+    if (idx == NULL) {
+        printf("Error: unable to allocate memory for index_file\n");
+        exit (0);
+    }
+
+    idx->base = base;
+    idx->size = st.st_size;
+    idx->header = header;
+    idx->slots = (const struct index_term*) ((const char*) base + header->slots_offset);
+    idx->blocks = (const struct index_block*) ((const char*) base + header->blocks_offset);
+    idx->postings = (const uint8_t*) base + header->postings_offset;
+    idx->impacts = header->impacts ? (const uint8_t*) base + header->impacts_offset : NULL;
+    idx->block_positions = header->positions ? (const uint32_t*) ((const char*) base + header->block_positions_offset) : NULL;
+    idx->sorted = (const uint32_t*) ((const char*) base + header->sorted_offset);
+    idx->positions = header->positions ? (const uint8_t*) base + header->positions_offset : NULL;
+    idx->strings = (const char*) base + header->strings_offset;
+
+    // Document table with paths pointing into the mapped strings
+    const struct index_doc* docs = (const struct index_doc*) ((const char*) base + header->docs_offset);
+    idx->docs = (struct document*) malloc ((header->num_docs + 1) * sizeof (struct document));
+
+    // Check for allocation errors
+    if (idx->docs == NULL) {
+        printf("Error: unable to allocate memory for document table\n");
+        exit (0);
+    }
+
+    for (uint32_t i = 0; i < header->num_docs; i++) {
+        idx->docs[i].path = (char*) (idx->strings + docs[i].path_offset);
+        idx->docs[i].mtime = docs[i].mtime;
+        idx->docs[i].length = docs[i].length;
+    }
+
+    stats_end (STATS_INDEX_OPEN, start);
+    return idx;
+}
+
+/**
+ * Reads back the model an index file's impacts were computed with.
+ * @param  idx  pointer to the mapped index
+ * @param  sc   pointer to the scoring settings to fill in
+ * @return 1 if the index has impacts, 0 if it has none and sc is untouched
+ */
+int index_impacts (const struct index_file* idx, struct scoring* sc) {
+    if (!idx->header->impacts) {
+        return 0;
+    }
+    sc->model = (enum score_model) idx->header->impact_model;
+    sc->k1 = idx->header->impact_k1;
+    sc->b = idx->header->impact_b;
+    sc->impacts = 1;
+    return 1;
+}
+
+/**
+ * Unmaps the index file and frees the view.
+ * @param idx pointer to the mapped index
+ */
+void index_close (struct index_file* idx) {
+    free (idx->docs);
+    munmap (idx->base, idx->size);
+    free (idx);
+}
+
+/**
+ * Searches the term directory for this word.
+ * @param  idx   pointer to the mapped index
+ * @param  word  char* to the word to search for
+ * @return pointer to the term's slot, or NULL if the word is not indexed
+ */
+const struct index_term* index_lookup (const struct index_file* idx, const char* word) {
+    size_t len = strlen (word);
+    uint64_t hash = hash_code (word, len);
+    uint64_t mask = idx->header->num_slots - 1;
+    uint64_t i = hash & mask;
+
+    // Probe until we reach an empty slot
+    while (idx->slots[i].df != 0) {
+        const struct index_term* term = &idx->slots[i];
+        if (term->hash == hash && term->word_len == len) {
+            STATS_COUNT (STATS_STRCMP, 1);
+            if (memcmp (idx->strings + term->word_offset, word, len) == 0) {
+                STATS_PROBES (((i - hash) & mask) + 1);
+                return term;
+            }
+        }
+        i = (i + 1) & mask;
+    }
+
+    STATS_PROBES (((i - hash) & mask) + 1);
+    return NULL;
+}
+
+/**
+ * Word i of an index's terms in sorted order.
+ * @param  dict  pointer to the mapped index
+ * @param  i     index of the word in sorted order
+ * @return the word, in the mapping
+ */
+static char* sorted_word (const void* dict, uint32_t i) {
+    const struct index_file* idx = (const struct index_file*) dict;
+    return (char*) (idx->strings + idx->slots[idx->sorted[i]].word_offset);
+}
+
+/**
+ * Finds the words a wildcard or fuzzy word matches among the sorted terms, see
+ * query_dict_expand().
+ * @param  idx        pointer to the mapped index
+ * @param  w          pointer to the wildcard
+ * @param  words      array of at least max_words words to fill in, in sorted order,
+ *                    pointing into the mapping
+ * @param  max_words  most words to find
+ * @return number of words found
+ */
+int index_expand (const struct index_file* idx, const struct query_wildcard* w, char** words, int max_words) {
+    struct query_dict d = {idx, idx->header->num_terms, sorted_word};
+    return query_dict_expand (&d, w, words, max_words);
+}
+
+/**
+ * Positions a cursor on the first posting of a term.
+ * @param cur   pointer to the cursor
+ * @param idx   pointer to the mapped index
+ * @param term  pointer to the term's slot
+ */
+void index_cursor_open (struct index_cursor* cur, const struct index_file* idx, const struct index_term* term) {
+    cur->bytes = idx->postings + term->postings_offset;
+    cur->blocks = idx->blocks + term->blocks_offset;
+    cur->num_blocks = (term->df + INDEX_BLOCK_SIZE - 1) / INDEX_BLOCK_SIZE;
+    cur->df = term->df;
+    cur->next = 0;
+    cur->block = 0;
+    cur->shallow = 0;
+    cur->decoded = 0;
+    postings_open_bytes (&cur->postings, cur->bytes, term->df);
+    index_cursor_next (cur);
+}
+
+/**
+ * Moves the cursor to the first posting with a doc of at least target, skipping
+ * blocks that end before it without decoding them. The block is found by galloping,
+ * so a seek far ahead costs the log of the blocks skipped.
+ * @param  cur     pointer to the cursor
+ * @param  target  doc to move to
+ * @return 1 if such a posting exists, 0 at the end (cur->doc is then INDEX_END)
+ */
+int index_cursor_seek (struct index_cursor* cur, uint32_t target) {
+    if (cur->doc >= target) {
+        return cur->doc != INDEX_END;
+    }
+
+    // Jump to the first block that ends at or after target. Gallop over the blocks'
+    // last docs, doubling the step until one is passed, then binary search the step
+    if (cur->blocks[cur->block].last_doc < target) {
+        uint32_t lo = cur->block + 1;
+        uint32_t hi = lo;
+        uint32_t step = 1;
+        while (hi < cur->num_blocks && cur->blocks[hi].last_doc < target) {
+            lo = hi + 1;
+            hi += step;
+            step *= 2;
+        }
+        if (hi > cur->num_blocks) {
+            hi = cur->num_blocks;
+        }
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (cur->blocks[mid].last_doc < target) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+
+        uint32_t b = lo;
+        if (b == cur->num_blocks) {
+            cur->next = cur->df;
+            cur->doc = INDEX_END;
+            return 0;
+        }
+
+        // Gaps restart from the previous block's last doc
+        cur->postings.pos = cur->bytes + cur->blocks[b].offset;
+        cur->postings.doc = cur->blocks[b - 1].last_doc;
+        cur->postings.num_encoded = cur->df - b * INDEX_BLOCK_SIZE;
+        cur->next = b * INDEX_BLOCK_SIZE;
+    }
+
+    // The block holds a posting at or after target, decode up to it
+    while (index_cursor_next (cur) && cur->doc < target) {
+    }
+    return cur->doc != INDEX_END;
+}
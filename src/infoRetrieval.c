@@ -1,181 +1,127 @@
 /**************************************************************************************
 * Jack Umina
 * Created Nov, 2019
-* Handles processes of populating the hashtable, removing stop words, reading the
+* Handles processes of populating the hashtable, skipping stop words, reading the
 * search-query, and ranking the documents by relevancy.
 ***************************************************************************************/
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <math.h>
 #include <errno.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
 
 #include "hashtable.h"
 #include "infoRetrieval.h"
+#include "indexfile.h"
+#include "segments.h"
+#include "match.h"
 #include "sort.h"
+#include "stats.h"
+#include "tokenizer.h"
 
 /**
- * Computes the idf of the given word.
- * idf = log (N / df) ,
- * where N = number of documents in hashtable, and df = document frequency
- * @param  wn pointer to a wordNode
- * @return the computed idf
+ * Checks whether a word is a stop word, one that appears in every document and so
+ * has an idf of 0. Decided from the current statistics rather than at training time.
+ * @param  df        number of documents containing the word
+ * @param  num_docs  number of documents searched
+ * @return 1 if the word should be ignored, 0 otherwise
  */
-double get_idf (struct hashtable* ht, struct wordNode* wordPtr) {
-    double N = ht->num_docs;
-    double df = 0;
-
-    // Check to make sure word exists before accessing
-    if (wordPtr != NULL) {
-        df = wordPtr->df;
-    } else { // Add 1 to df to prevent divide by 0
-        df++;
-    }
-
-    return log10 (N / df);
+int is_stop_word (uint64_t df, uint64_t num_docs) {
+    return df >= num_docs;
 }
 
 /**
- * Searches the given hashtable for this word and doc_id pair.
- * @param  word    char* to the word to search for
- * @param  doc_id  char* to the document this word belongs in
- * @return the tf of this word in this doc_id
+ * Reads one document and adds each of its words to the hashtable.
+ * @param  ht    pointer to the hashtable
+ * @param  doc   pointer to the document's entry in the document table, its length is filled in
+ * @param  i     number of the document
  */
-int get_tf (struct wordNode* wordPtr, char* doc_id) {
-    // If wordPtr == NULL, word doesn't exists in hashtable, tf = 0
-    if (wordPtr == NULL) {
-        return 0;
+void train_document (struct hashtable* ht, struct document* doc, uint32_t i) {
+    int fd = open (doc->path, O_RDONLY);
+    struct stat st;
+
+    // Check for files we can't open
+    if (fd < 0 || fstat (fd, &st) != 0) {
+        printf("Error in opening %s: ", doc->path);
+        printf("%s\n", strerror(errno));
+        exit(0);
     }
 
-    // Set pointer to head of doc list
-    struct docNode* docPtr = wordPtr->docHead;
+    // Small documents are read in one go, large ones a block at a time
+    size_t capacity = (size_t) st.st_size < TOKENIZER_BLOCK ? (size_t) st.st_size + 1 : TOKENIZER_BLOCK;
+    char* buf = (char*) malloc (capacity);
 
-    // Loop through doc list searching for the document
-    while (docPtr != NULL && strcmp (docPtr->doc_id, doc_id) != 0) {
-        docPtr = docPtr->next;
+    // Check for allocation errors
+    if (buf == NULL) {
+        printf("Error: unable to allocate memory for read buffer\n");
+        exit (0);
     }
 
-    // If we reached NULL, this word does not belong in the particular document
-    if (docPtr == NULL) {
-        return 0;
-    }
+    struct token_list list;
+    token_list_init (&list);
 
-    // Else, we found the word
-    return docPtr->tf;
-}
+    size_t filled = 0;
+    int at_eof = 0;
+    doc->length = 0;
 
-/**
- * Removes all words in hash table whose idf = 0.
- * @param ht pointer to the hashtable
- */
-void stop_words (struct hashtable* ht) {
-    // Loop through buckets in hashtable
-    for (int i = 0; i < ht->num_buckets; i++) {
-
-        // Get head of word list at this bucket
-        struct wordNode* wordPtr = ht->map[i];
-        // Temp pointer to point to node before wordPtr to stitch list together
-        struct wordNode* lastPtr = NULL;
-
-        // Loop through word list
-        while (wordPtr != NULL) {
-
-            // If the idf of this word == 0, it is a stop word and we need to remove it
-            if (get_idf (ht, wordPtr) == 0) {
-
-                // Free the fields of this wordPtr
-                free (wordPtr->word);
-                destroy_docList (wordPtr->docHead);
-
-				// If this is the first word in the bucket
-				if (lastPtr == NULL) {
-					ht->map[i] = wordPtr->next;	
-					
-					// If this is the ONLY word in this bucket
-					if (wordPtr->next == NULL) {
-						init_empty_wordNode (&ht->map[i]);
-					}
-
-					free (wordPtr);
-					wordPtr = ht->map[i]->next;
-				} else { // Stich the node before this to the one after this
-					lastPtr->next = wordPtr->next;
-					free (wordPtr);
-					wordPtr = lastPtr->next;
-				}
-
-            } else {
-				lastPtr = wordPtr;
-				wordPtr = wordPtr->next;
-			}
+    while (!at_eof) {
+        // Fill the buffer up, after any unfinished word carried over from the last block
+        ssize_t n = read (fd, buf + filled, capacity - filled);
+        if (n < 0) {
+            printf("Error in reading %s: ", doc->path);
+            printf("%s\n", strerror(errno));
+            exit(0);
+        }
+        filled += n;
+        at_eof = (n == 0);
+        STATS_COUNT (STATS_BYTES_READ, n);
+        if (!at_eof && filled < capacity) {
+            continue;
+        }
+
+        // Split the block into lowercase words and add each one to the hashtable
+        list.num_tokens = 0;
+        size_t consumed = tokenize (buf, filled, at_eof, &list);
+        for (int j = 0; j < list.num_tokens; j++) {
+            ht_insert (ht, list.tokens[j].word, list.tokens[j].len, i, doc->length + j);
+        }
+        doc->length += list.num_tokens;
+
+        // Carry the unfinished word over, growing the buffer if it is one huge word
+        memmove (buf, buf + consumed, filled - consumed);
+        filled -= consumed;
+        if (filled == capacity) {
+            capacity *= 2;
+            buf = (char*) realloc (buf, capacity);
+
+            // Check for allocation errors
+            if (buf == NULL) {
+                printf("Error: unable to allocate memory for read buffer\n");
+                exit (0);
+            }
         }
     }
+
+    token_list_destroy (&list);
+    free (buf);
+    close (fd);
 }
 
 /**
- * Takes a set of documents and populates the hashtable.
+ * Takes a set of documents and populates the hashtable. Stop words are kept, they
+ * are skipped at query time instead so the index stays valid as documents change.
  * @param  ht    pointer to the hashtable
  */
 void train (struct hashtable* ht) {
-    // Pointer to file
-    FILE* f;
-
     // Loop through the set of documents
     for (int i = 0; i < ht->num_docs; i++) {
-        f = fopen (ht->docIDs[i], "r");
-
-        // Check for NULL files
-        if (f == NULL) {
-            printf("Error in opening %s: ", ht->docIDs[i]);
-            printf("%s\n", strerror(errno));
-            exit(0);
-        }
-
-        char c;
-        char* word = (char*) malloc (21 * sizeof (char));
-
-        // Check for allocation errors
-        if (word == NULL) {
-            printf("Error: unable to allocate memory for word\n");
-            exit (0);
-        }
-
-        int j = 0;
-
-        // Read each char from doc until EOF
-        while ((c = getc (f)) != EOF) {
-            // If char is a space or \n, this is the end of a word
-            if (c == ' ' || c == '\n') {
-                // Set the last char of the word as the string terminator
-                word[j] = '\0';
-                ht_insert (ht, word, ht->docIDs[i]);
-                word = (char*) malloc (21 * sizeof (char));
-
-                // Check for allocation errors
-                if (word == NULL) {
-                    printf("Error: unable to allocate memory for word\n");
-                    exit (0);
-                }
-
-                j = 0;
-            } else {
-				// Make the character lowercase for case-insensitivity
-                word[j] = tolower (c);
-                j++;
-            }
-        }
-        // If j did not get reset to 0, then add this word to hashtable
-        if (j != 0) {
-            ht_insert (ht, word, ht->docIDs[i]);
-        } else { // We need to free this word since it is not in the hashtable
-			free (word);
-		}
-        fclose (f);
+        train_document (ht, &ht->docs[i], i);
     }
-    // Remove stop words from hashtable as last step of training process
-    stop_words (ht);
 }
 
 /**
@@ -192,129 +138,399 @@ void str_tolower (char* str) {
 }
 
 /**
- * Reads in search query from user at console.
- * @param str        the string that needs to be split into separate words
- * @paran query_len  parameter will hold the length of the search_query
- * @return array of strings where each string is each search term
+ * Average length of a hashtable's documents, for BM25, collected while training.
+ * @param  ht  pointer to the hashtable
+ * @return the average length, 0 without documents
  */
-char** read_query (char* str, int* query_len) {
-    if (str == NULL) {
-        printf("Error: search query cannot be empty.\n");
-        exit (0);
+static double average_length (const struct hashtable* ht) {
+    uint64_t total_length = 0;
+    for (int i = 0; i < ht->num_docs; i++) {
+        total_length += ht->docs[i].length;
     }
+    return ht->num_docs > 0 ? (double) total_length / ht->num_docs : 0;
+}
 
-    char** search_query = (char**) malloc (2 * sizeof (char*));
+/**
+ * Checks whether the idfs and average length cached in a hashtable hold for its
+ * current statistics under a scoring model.
+ * @param  ht  pointer to the hashtable
+ * @param  sc  pointer to the scoring settings
+ * @return 1 if every word's idf is up to date, 0 if not
+ */
+static int stats_fresh (const struct hashtable* ht, const struct scoring* sc) {
+    return ht->stats_docs == ht->num_docs && ht->stats_model == sc->model;
+}
 
-    if (search_query == NULL) {
-        printf("Memory Error: Not enough space for search_query.\n");
-        exit (0);
+/**
+ * Caches the idf of every frozen term under the scoring model, 0 for stop words,
+ * and the average document length, so queries read them instead of taking a
+ * logarithm for each term and summing every document's length. Call it once
+ * training is done. It only recomputes them when the number of documents or the
+ * model changed since the last call, and the hashtable must not be scored from
+ * other threads meanwhile.
+ * @param ht  pointer to the trained hashtable, frozen with ht_freeze()
+ * @param sc  pointer to the scoring settings
+ */
+void finalize_stats (struct hashtable* ht, const struct scoring* sc) {
+    // Without frozen terms there is nowhere to cache the idfs
+    if (ht->terms.word_offset == NULL || stats_fresh (ht, sc)) {
+        return;
     }
 
-    search_query[0] = strtok (str, " ");
-	str_tolower (search_query[0]);
-
-    // Loop through str and extract each word
-    int i = 1;
-    while ((search_query[i] = strtok (NULL, " ")) != NULL) {
-
-		// Make the search term lowercase
-		str_tolower (search_query[i]);
-
-		// Realloc space for another term
-        search_query = (char**) realloc (search_query, (i+2) * sizeof (char*));
-
-        if (search_query == NULL) {
-            printf("Memory Error: Not enough space for search_query.\n");
-            exit (0);
-        }
-
-        i++;
+    struct frozen_terms* terms = &ht->terms;
+    for (uint32_t t = 0; t < terms->num_terms; t++) {
+        terms->idf[t] = is_stop_word (terms->df[t], ht->num_docs) ? 0 : scoring_idf (sc, terms->df[t], ht->num_docs);
     }
-    *query_len = i;
-    return search_query;
+    ht->stats_avg_length = average_length (ht);
+    ht->stats_docs = ht->num_docs;
+    ht->stats_model = sc->model;
 }
 
 /**
- * Computes the tf-idf score for this document and givens set of search terms
+ * Computes the score of every document for the given set of search terms.
+ * Each search term is looked up once and its idf computed once, or read from the
+ * cache finalize_stats() keeps, then its postings are walked once, adding each
+ * posting's score into a dense array indexed by document number, so documents
+ * that contain none of the search terms are never visited. Postings frozen with
+ * ht_freeze_postings() are read straight from their arrays.
  * @param  ht           pointer to the hashtable we are working with
+ * @param  sc           pointer to the scoring settings
  * @param  search_query string array of search terms
  * @param  query_len    length of the search query
- * @param  doc_id       char* to the doc_id we are computing tf-idf for
- * @return              the relevancy score of this doc_id against the given search_query
+ * @return              array of ht->num_docs relevancy scores indexed by document number
  */
-double compute_tf_idf (struct hashtable* ht, char** search_query, int query_len, char* doc_id) {
-    // Relevancy score for this doc
-    double r = 0;
+double* accumulate_scores (struct hashtable* ht, const struct scoring* sc, char** search_query, int query_len) {
+    // Relevancy score for each doc
+    double* acc = (double*) calloc (ht->num_docs, sizeof (double));
+
+    // Check for allocation errors
+    if (acc == NULL) {
+        printf("Error: unable to allocate memory for score accumulator\n");
+        exit (0);
+    }
+
+    // The average document length for BM25 is cached along with the idfs
+    int cached = stats_fresh (ht, sc);
+    struct scorer scorer;
+    scorer_init (&scorer, sc, cached ? ht->stats_avg_length : average_length (ht));
+    int uses_length = scorer_uses_length (&scorer);
 
     // Loop through words in search_query
     for (int j = 0; j < query_len; j++) {
-        // Find the word in the hashtable
+        // Find the word in the hashtable, words that don't exist add nothing and
+        // neither do stop words, the words found in every document
         struct wordNode* wordPtr = get_word (ht, search_query[j]);
+        if (wordPtr == NULL) {
+            continue;
+        }
+        double idf;
+        if (cached) {
+            idf = ht->terms.idf[wordPtr->term];
+        } else {
+            idf = is_stop_word (wordPtr->df, ht->num_docs) ? 0 : scoring_idf (sc, wordPtr->df, ht->num_docs);
+        }
+        if (idf == 0) {
+            continue;
+        }
 
-        // Get the tf and idf for this word, doc_id pair
-        int tf = get_tf (wordPtr, doc_id);
-        double idf = get_idf (ht, wordPtr);
+        if (sc->weights != NULL) {
+            idf *= sc->weights[j];
+        }
 
-        // Compute tf*idf and add it to the score for this doc
-        r += (tf * idf);
+        // Add the posting's score to each doc containing this word
+        const struct frozen_terms* terms = &ht->terms;
+        if (terms->docs != NULL) {
+            uint64_t end = terms->postings_offset[wordPtr->term + 1];
+            for (uint64_t p = terms->postings_offset[wordPtr->term]; p < end; p++) {
+                uint32_t doc = terms->docs[p];
+                uint32_t length = uses_length ? terms->lengths[doc] : 0;
+                acc[doc] += scorer_term (&scorer, terms->tfs[p], length, idf);
+            }
+        } else {
+            struct postings_cursor cur;
+            postings_open (&cur, &wordPtr->postings);
+            while (postings_next (&cur)) {
+                uint32_t length = uses_length ? ht->docs[cur.doc].length : 0;
+                acc[cur.doc] += scorer_term (&scorer, cur.tf, length, idf);
+            }
+        }
+        STATS_COUNT (STATS_POSTINGS_SCANNED, wordPtr->df);
     }
-    return r;
+    return acc;
 }
 
+// What output_results() writes, see output_select()
+static int outputs = OUTPUT_ALL;
+
 /**
- * Print the contents of the most relvant document to console and list all files and
- * their scores in order in search_scores.txt
- * @param  ht           pointer to the hashtable we are working with
- * @param scores array of relevancy_scores
+ * Chooses what output_results() writes, so benchmarks can skip printing.
+ * @param which  OUTPUT_DOCUMENT and OUTPUT_SCORES or'd together, 0 for nothing
+ */
+void output_select (int which) {
+    outputs = which;
+}
+
+/**
+ * Writes a whole buffer to a file descriptor, however many calls it takes.
+ * @param  fd   descriptor to write to
+ * @param  buf  bytes to write
+ * @param  len  number of bytes
+ * @return 0 on success, -1 with errno set if a write failed
  */
-void output_results (struct hashtable* ht, struct relevancy_score* scores) {
-    // Open the file with the highest relevancy score
-    FILE* f = fopen (scores[0].doc_id, "r");
+static int write_all (int fd, const char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write (fd, buf, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        // A write of nothing leaves errno as it was, so give it a reason
+        if (n == 0) {
+            errno = EIO;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * Copies a file to stdout. The kernel moves the bytes with sendfile() where it can,
+ * otherwise they are read and written in large blocks.
+ * @param path  name of the file
+ */
+static void print_document (const char* path) {
+    int fd = open (path, O_RDONLY);
+    struct stat st;
 
     // Check for NULL to prevent crash
-    if (f == NULL) {
-        printf("Error: %s is NULL.\n", scores[0].doc_id);
+    if (fd < 0 || fstat (fd, &st) != 0) {
+        printf("Error: %s is NULL.\n", path);
+        if (fd >= 0) {
+            close (fd);
+        }
         return;
     }
 
-    // Print the cotents of the file, char by char
-    char c;
-    while ((c = getc (f)) != EOF) {
-        printf("%c", c);
+    // Anything printf() buffered goes out before the document
+    fflush (stdout);
+
+    off_t offset = 0;
+    while (offset < st.st_size) {
+        ssize_t n = sendfile (STDOUT_FILENO, fd, &offset, st.st_size - offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
     }
 
-    fclose (f);
+    // Some outputs refuse sendfile(), copy what is left the ordinary way
+    char buf[OUTPUT_BLOCK_SIZE];
+    ssize_t n;
+    while (offset < st.st_size && (n = pread (fd, buf, sizeof (buf), offset)) > 0) {
+        if (write_all (STDOUT_FILENO, buf, n) != 0) {
+            break;
+        }
+        offset += n;
+    }
 
-    // Create search_scores.txt
-    f = fopen ("search_scores.txt", "w");
+    close (fd);
+}
 
-    // Print each file and its score
-    for (int i = 0; i < ht->num_docs; i++) {
-        fprintf (f, "%s:%f\n", scores[i].doc_id, scores[i].score);
+/**
+ * Lists the ranked files and their scores in order in search_scores.txt, formatted
+ * into one large buffer that is written out whenever it fills.
+ * @param docs      document table the scores refer to
+ * @param scores    array of relevancy_scores, ranked
+ * @param num_docs  number of entries in scores to write
+ */
+static void write_scores (const struct document* docs, const struct relevancy_score* scores, int num_docs) {
+    int fd = open ("search_scores.txt", O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        printf("Error in opening search_scores.txt: %s\n", strerror (errno));
+        return;
+    }
+
+    size_t cap = OUTPUT_SCORES_BUFFER;
+    size_t len = 0;
+    char* buf = (char*) malloc (cap);
+
+    // Check for allocation errors
+    if (buf == NULL) {
+        printf("Error: unable to allocate memory for search_scores.txt\n");
+        exit (0);
+    }
+
+    // errno is saved as soon as a write fails, before anything else can change it
+    int error = 0;
+    for (int i = 0; i < num_docs; i++) {
+        const char* path = docs[scores[i].doc].path;
+        size_t path_len = strlen (path);
+        size_t line_max = path_len + OUTPUT_SCORE_MAX + 2;
+
+        // Write out the lines so far when the next one might not fit
+        if (cap - len < line_max) {
+            if (write_all (fd, buf, len) != 0) {
+                error = errno;
+                break;
+            }
+            len = 0;
+            if (cap < line_max) {
+                cap = line_max;
+                buf = (char*) realloc (buf, cap);
+
+                // Check for allocation errors
+                if (buf == NULL) {
+                    printf("Error: unable to allocate memory for search_scores.txt\n");
+                    exit (0);
+                }
+            }
+        }
+
+        // <path>:<score> with the score as printf ("%f") writes it
+        memcpy (buf + len, path, path_len);
+        len += path_len;
+        buf[len++] = ':';
+        len += snprintf (buf + len, OUTPUT_SCORE_MAX, "%f", scores[i].score);
+        buf[len++] = '\n';
     }
 
-    fclose (f);
+    if (error == 0 && write_all (fd, buf, len) != 0) {
+        error = errno;
+    }
+    if (error != 0) {
+        printf("Error in writing search_scores.txt: %s\n", strerror (error));
+    }
+
+    free (buf);
+    close (fd);
 }
 
 /**
- * Ranks the documents in order of their tf-idf scores and outputs results.
+ * Print the contents of the most relvant document to console and list the ranked
+ * files and their scores in order in search_scores.txt, leaving out whatever
+ * output_select() turned off.
+ * @param docs      document table the scores refer to
+ * @param scores    array of relevancy_scores, ranked
+ * @param num_docs  number of entries in scores to write
+ */
+void output_results (const struct document* docs, struct relevancy_score* scores, int num_docs) {
+    double start = stats_begin ();
+
+    // A phrase query may match nothing, leave an empty list of scores
+    if (num_docs == 0 && (outputs & OUTPUT_DOCUMENT)) {
+        printf("No documents match the search query\n");
+    }
+
+    if (num_docs > 0 && (outputs & OUTPUT_DOCUMENT)) {
+        print_document (docs[scores[0].doc].path);
+    }
+    if (outputs & OUTPUT_SCORES) {
+        write_scores (docs, scores, num_docs);
+    }
+
+    stats_end (STATS_OUTPUT, start);
+}
+
+/**
+ * Expands every wildcard and fuzzy word of a query with the words of the
+ * hashtable, see query_select_words() and query_expand().
+ * @param ht  pointer to the hashtable, frozen with ht_freeze()
+ * @param sc  pointer to the scoring settings, which choose how fuzzy words are scored
+ * @param q   pointer to the parsed query
+ */
+void expand_query (struct hashtable* ht, const struct scoring* sc, struct query* q) {
+    char* words[QUERY_MAX_EXPANSIONS];
+    uint64_t df[QUERY_MAX_EXPANSIONS];
+    double weights[QUERY_MAX_EXPANSIONS];
+    for (int w = 0; w < q->num_wildcards; w++) {
+        const struct query_wildcard* wildcard = &q->wildcards[w];
+        int n = ht_expand (ht, wildcard, words, QUERY_MAX_EXPANSIONS);
+
+        // Picking the closest word needs to know which words are in the most documents
+        if (wildcard->distance > 0 && sc->fuzzy == FUZZY_BEST) {
+            for (int i = 0; i < n; i++) {
+                df[i] = get_word (ht, words[i])->df;
+            }
+        }
+        n = query_select_words (wildcard, sc->fuzzy, words, df, n, weights);
+        query_expand (q, w, words, weights, n);
+    }
+}
+
+/**
+ * Scores the documents against the search query and ranks the best k. Only reads
+ * the hashtable, so several threads may score queries at once. When the query has
+ * a filter, only the documents it matches are ranked.
  * @param  ht            pointer to the hashtable
- * @param  search_query  string array of search terms
- * @param  query_len     length of the search query
+ * @param  sc            pointer to the scoring settings
+ * @param  q             pointer to the parsed query
+ * @param  k             number of top results wanted, 0 ranks every document
+ * @param  num_results   set to the number of ranked entries at the front of the array
+ * @return array of relevancy scores, free it when done
  */
-void rank (struct hashtable* ht, char** search_query, int query_len) {
+struct relevancy_score* score_query (struct hashtable* ht, const struct scoring* sc, const struct query* q,
+        int k, int* num_results) {
+    double start = stats_begin ();
+
+    // Score every document in one pass over the query's postings, weighting the
+    // terms a fuzzy word expanded to by how close they are
+    struct scoring weighted = *sc;
+    weighted.weights = q->weights;
+    double* acc = accumulate_scores (ht, &weighted, q->terms, q->num_terms);
+
     // Array of relevancy_score structs
-    struct relevancy_score scores[ht->num_docs];
+    struct relevancy_score* scores = (struct relevancy_score*) malloc ((ht->num_docs + 1) * sizeof (struct relevancy_score));
 
-    // Loop through documents and compute tf-idf for each one,
-    for (int i = 0; i < ht->num_docs; i++) {
-        //scores[i] = (struct relevancy_score) malloc (sizeof (struct relevancy_score));
-        scores[i].doc_id = ht->docIDs[i];
-        scores[i].score = compute_tf_idf (ht, search_query, query_len, ht->docIDs[i]);
+    // Check for allocation errors
+    if (scores == NULL) {
+        printf("Error: unable to allocate memory for scores\n");
+        exit (0);
+    }
+
+    int num_docs = 0;
+    if (q->root >= 0) {
+        uint32_t num_matches;
+        uint32_t* matches = query_match_ht (ht, q, &num_matches);
+        for (uint32_t i = 0; i < num_matches; i++) {
+            scores[i].doc = matches[i];
+            scores[i].score = acc[matches[i]];
+        }
+        num_docs = num_matches;
+        free (matches);
+    } else {
+        for (int i = 0; i < ht->num_docs; i++) {
+            scores[i].doc = i;
+            scores[i].score = acc[i];
+        }
+        num_docs = ht->num_docs;
     }
+    free (acc);
+    STATS_COUNT (STATS_DOCS_SCORED, num_docs);
+
+    // Rank the best k docs according to their scores
+    *num_results = top_k (scores, num_docs, k > 0 ? k : num_docs);
+    stats_end (STATS_SCORE, start);
+    return scores;
+}
+
+/**
+ * Ranks the documents in order of their scores and outputs results.
+ * @param  ht  pointer to the hashtable
+ * @param  sc  pointer to the scoring settings
+ * @param  q   pointer to the parsed query
+ * @param  k   number of top results to write, 0 writes every document
+ */
+void rank (struct hashtable* ht, const struct scoring* sc, const struct query* q, int k) {
+    int num_results;
+    struct relevancy_score* scores = score_query (ht, sc, q, k, &num_results);
 
-    // Sort the doc_ids according to their tf-idf scores
-    sort (ht, scores);
+    output_results (ht->docs, scores, num_results);
 
-    output_results (ht, scores);
+    free (scores);
 }
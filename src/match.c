@@ -0,0 +1,536 @@
+/**************************************************************************************
+* Jack Umina
+* Created Nov, 2019
+* Matching of Boolean filters, phrases and NEAR/k constraints.
+***************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hashtable.h"
+#include "infoRetrieval.h"
+#include "indexfile.h"
+#include "segments.h"
+#include "match.h"
+
+/**
+ * One word of a filter or of a constraint, walked through an index file or through
+ * the in-memory lists of a hashtable.
+ */
+struct match_term {
+    // Index file: a cursor able to seek, and a second cursor over the block of
+    // the current posting, for finding its positions
+    const struct index_file* idx;
+    const struct index_term* term;
+    struct index_cursor cur;
+    struct postings_cursor block;
+    uint32_t at;
+
+    // In-memory lists: postings and, for constraints, positions read in step
+    struct postings_cursor postings;
+    int has_positions;
+    uint32_t unread;
+
+    struct positions_cursor positions;
+    uint32_t doc;
+    uint32_t tf;
+
+    // Decoded positions of the current posting, and where a match got to in them
+    uint32_t* pos;
+    uint32_t cap;
+    uint32_t k;
+};
+
+/**
+ * Positions a term on the first posting of a word in an index file.
+ * @param t     pointer to the term
+ * @param idx   pointer to the mapped index
+ * @param term  pointer to the word's slot
+ */
+static void term_open_index (struct match_term* t, const struct index_file* idx, const struct index_term* term) {
+    t->idx = idx;
+    t->term = term;
+    t->at = INDEX_END;
+    index_cursor_open (&t->cur, idx, term);
+    t->doc = t->cur.doc;
+    t->tf = t->cur.tf;
+}
+
+/**
+ * Positions a term on the first posting of a word in a hashtable.
+ * @param t          pointer to the term
+ * @param wordPtr    pointer to the word
+ * @param positions  non-zero to read positions too, the word must have them
+ */
+static void term_open_list (struct match_term* t, const struct wordNode* wordPtr, int positions) {
+    t->idx = NULL;
+    t->has_positions = positions;
+    postings_open (&t->postings, &wordPtr->postings);
+    if (positions) {
+        positions_open (&t->positions, wordPtr->positions);
+    }
+    postings_next (&t->postings);
+    t->doc = t->postings.doc;
+    t->tf = t->postings.tf;
+    t->unread = positions ? t->tf : 0;
+}
+
+/**
+ * Moves a term to its first posting with a doc of at least target.
+ * @param  t       pointer to the term
+ * @param  target  doc to move to
+ * @return 1 if there is such a posting, 0 at the end (t->doc is then INDEX_END)
+ */
+static int term_seek (struct match_term* t, uint32_t target) {
+    if (t->idx != NULL) {
+        index_cursor_seek (&t->cur, target);
+        t->doc = t->cur.doc;
+        t->tf = t->cur.tf;
+        return t->doc != INDEX_END;
+    }
+
+    while (t->doc < target) {
+        positions_skip (&t->positions, t->unread);
+        if (!postings_next (&t->postings)) {
+            t->doc = INDEX_END;
+            return 0;
+        }
+        t->doc = t->postings.doc;
+        t->tf = t->postings.tf;
+        t->unread = t->has_positions ? t->tf : 0;
+    }
+    return t->doc != INDEX_END;
+}
+
+/**
+ * Decodes the positions of a term's current posting into t->pos. Called at most
+ * once per posting.
+ * @param t pointer to the term
+ */
+static void term_positions (struct match_term* t) {
+    if (t->tf > t->cap) {
+        t->cap = t->tf;
+        t->pos = (uint32_t*) realloc (t->pos, t->cap * sizeof (uint32_t));
+
+        // Check for allocation errors
+        if (t->pos == NULL) {
+            printf("Error: unable to allocate memory for positions\n");
+            exit (0);
+        }
+    }
+
+    if (t->idx != NULL) {
+        // Start from the block of the posting, unless an earlier posting of the same
+        // block was read already, then skip the positions of the postings before it
+        uint32_t n = t->cur.next - 1;
+        uint32_t b = n / INDEX_BLOCK_SIZE;
+        if (t->at == INDEX_END || t->at > n || t->at / INDEX_BLOCK_SIZE != b) {
+            const struct index_block* blocks = t->idx->blocks + t->term->blocks_offset;
+            postings_open_bytes (&t->block, t->idx->postings + t->term->postings_offset + blocks[b].offset,
+                    t->term->df - b * INDEX_BLOCK_SIZE);
+            t->block.doc = b > 0 ? blocks[b - 1].last_doc : 0;
+            positions_open_bytes (&t->positions, t->idx->positions + t->term->positions_offset
+                    + t->idx->block_positions[t->term->blocks_offset + b]);
+            t->at = b * INDEX_BLOCK_SIZE;
+        }
+        while (t->at < n) {
+            postings_next (&t->block);
+            positions_skip (&t->positions, t->block.tf);
+            t->at++;
+        }
+        postings_next (&t->block);
+        t->at++;
+    }
+
+    // The first position is as it is, the rest are gaps
+    uint32_t p = 0;
+    for (uint32_t i = 0; i < t->tf; i++) {
+        p += positions_next (&t->positions);
+        t->pos[i] = p;
+    }
+    t->unread = 0;
+}
+
+/**
+ * Checks whether the words occur one right after the other, in order.
+ * @param  terms  the phrase's words, positioned on the same doc with positions decoded
+ * @param  n      number of words
+ * @return 1 if the phrase occurs in the doc, 0 if not
+ */
+static int phrase_holds (struct match_term* terms, int n) {
+    for (int i = 0; i < n; i++) {
+        terms[i].k = 0;
+    }
+
+    // Try each occurrence of the first word as the start of the phrase, every
+    // later word only moves forward through its positions
+    for (uint32_t a = 0; a < terms[0].tf; a++) {
+        uint32_t start = terms[0].pos[a];
+        int i = 1;
+        while (i < n) {
+            struct match_term* t = &terms[i];
+            while (t->k < t->tf && t->pos[t->k] < start + i) {
+                t->k++;
+            }
+            if (t->k == t->tf) {
+                return 0;
+            }
+            if (t->pos[t->k] != start + i) {
+                break;
+            }
+            i++;
+        }
+        if (i == n) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Checks whether two words occur at most distance positions apart.
+ * @param  a         first word, with positions decoded
+ * @param  b         second word, on the same doc with positions decoded
+ * @param  distance  largest distance allowed
+ * @return 1 if they do, 0 if not
+ */
+static int near_holds (const struct match_term* a, const struct match_term* b, uint32_t distance) {
+    // Merge the two position lists, the closest pairs are neighbours in the merge
+    uint32_t i = 0;
+    uint32_t j = 0;
+    while (i < a->tf && j < b->tf) {
+        uint32_t x = a->pos[i];
+        uint32_t y = b->pos[j];
+        if (x < y) {
+            if (y - x <= distance) {
+                return 1;
+            }
+            i++;
+        } else if (y < x) {
+            if (x - y <= distance) {
+                return 1;
+            }
+            j++;
+        } else {
+            // The same token, only possible when both words are the same word
+            i++;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Moves a constraint's words to the first doc at or after target where all of
+ * them occur and the constraint holds. The words' postings are intersected by
+ * seeking each to the largest doc any of them is on, and positions are only
+ * decoded once all of them agree on a doc.
+ * @param  terms   the constraint's words, opened
+ * @param  c       pointer to the constraint
+ * @param  target  doc to start from, never less than on the call before
+ * @return the doc, INDEX_END if there is none
+ */
+static uint32_t constraint_seek (struct match_term* terms, const struct query_constraint* c, uint32_t target) {
+    while (1) {
+        int agreed = 0;
+        while (!agreed) {
+            agreed = 1;
+            for (int i = 0; i < c->num_terms; i++) {
+                if (!term_seek (&terms[i], target)) {
+                    return INDEX_END;
+                }
+                if (terms[i].doc > target) {
+                    target = terms[i].doc;
+                    agreed = 0;
+                    break;
+                }
+            }
+        }
+
+        for (int i = 0; i < c->num_terms; i++) {
+            term_positions (&terms[i]);
+        }
+        int holds = c->kind == CONSTRAINT_PHRASE ? phrase_holds (terms, c->num_terms)
+                : near_holds (&terms[0], &terms[1], c->distance);
+        if (holds) {
+            return target;
+        }
+        target++;
+    }
+}
+
+/**
+ * Where one node of a filter is up to.
+ */
+struct match_node {
+    struct match_term* terms;
+    uint32_t doc;
+    int started;
+    int missing;
+};
+
+/**
+ * A query's filter evaluated over one index file or hashtable.
+ */
+struct matcher {
+    const struct query* q;
+    struct match_node* nodes;
+    struct match_term* terms;
+    int num_terms;
+    uint32_t num_docs;
+};
+
+/**
+ * Allocates a matcher's nodes, with a term for each word node and each word of a
+ * constraint node.
+ * @param m  pointer to the matcher to set up
+ * @param q  pointer to the parsed query
+ */
+static void matcher_init (struct matcher* m, const struct query* q) {
+    m->q = q;
+    m->num_terms = 0;
+    for (int i = 0; i < q->num_nodes; i++) {
+        if (q->nodes[i].kind == QUERY_WORD) {
+            m->num_terms++;
+        } else if (q->nodes[i].kind == QUERY_CONSTRAINT) {
+            m->num_terms += q->constraints[q->nodes[i].arg].num_terms;
+        }
+    }
+
+    m->nodes = (struct match_node*) calloc (q->num_nodes + 1, sizeof (struct match_node));
+    m->terms = (struct match_term*) calloc (m->num_terms + 1, sizeof (struct match_term));
+
+    // Check for allocation errors
+    if (m->nodes == NULL || m->terms == NULL) {
+        printf("Error: unable to allocate memory for query matching\n");
+        exit (0);
+    }
+
+    struct match_term* t = m->terms;
+    for (int i = 0; i < q->num_nodes; i++) {
+        m->nodes[i].terms = t;
+        if (q->nodes[i].kind == QUERY_WORD) {
+            t++;
+        } else if (q->nodes[i].kind == QUERY_CONSTRAINT) {
+            t += q->constraints[q->nodes[i].arg].num_terms;
+        }
+    }
+}
+
+/**
+ * Frees a matcher's nodes and terms.
+ * @param m pointer to the matcher
+ */
+static void matcher_free (struct matcher* m) {
+    for (int i = 0; i < m->num_terms; i++) {
+        free (m->terms[i].pos);
+    }
+    free (m->terms);
+    free (m->nodes);
+}
+
+/**
+ * Opens a term on a word of an index file or hashtable.
+ * @param  t          pointer to the term
+ * @param  idx        pointer to the mapped index, or NULL to read ht
+ * @param  ht         pointer to the hashtable when idx is NULL
+ * @param  word       the word
+ * @param  positions  non-zero if the word's positions will be read
+ * @return 1 if the word is there, 0 if not
+ */
+static int open_word (struct match_term* t, const struct index_file* idx, struct hashtable* ht, char* word,
+        int positions) {
+    if (idx != NULL) {
+        const struct index_term* term = index_lookup (idx, word);
+        if (term == NULL) {
+            return 0;
+        }
+        term_open_index (t, idx, term);
+        return 1;
+    }
+
+    struct wordNode* wordPtr = get_word (ht, word);
+    if (wordPtr == NULL) {
+        return 0;
+    }
+    term_open_list (t, wordPtr, positions);
+    return 1;
+}
+
+/**
+ * Positions every node of the filter before the first doc of an index file or
+ * hashtable. Words missing from it, wildcards that matched no words, and
+ * constraints without positions to check, match nothing.
+ * @param m    pointer to the matcher
+ * @param idx  pointer to the mapped index, or NULL to read ht
+ * @param ht   pointer to the hashtable when idx is NULL
+ */
+static void matcher_open (struct matcher* m, const struct index_file* idx, struct hashtable* ht) {
+    const struct query* q = m->q;
+    int positions = idx != NULL ? idx->positions != NULL : ht->positions;
+    m->num_docs = idx != NULL ? idx->header->num_docs : (uint32_t) ht->num_docs;
+
+    for (int i = 0; i < q->num_nodes; i++) {
+        struct match_node* node = &m->nodes[i];
+        node->started = 0;
+        node->missing = 0;
+
+        if (q->nodes[i].kind == QUERY_WORD) {
+            node->missing = !open_word (node->terms, idx, ht, q->nodes[i].word, 0);
+        } else if (q->nodes[i].kind == QUERY_CONSTRAINT) {
+            const struct query_constraint* c = &q->constraints[q->nodes[i].arg];
+            node->missing = !positions;
+            for (int j = 0; j < c->num_terms && !node->missing; j++) {
+                node->missing = !open_word (&node->terms[j], idx, ht, q->constraint_terms[c->first + j], 1);
+            }
+        } else if (q->nodes[i].kind == QUERY_WILDCARD) {
+            node->missing = 1;
+        }
+    }
+}
+
+/**
+ * Finds the first doc at or after target that a node matches. Targets must not
+ * decrease between calls on the same node, and a node keeps the doc it found, so
+ * asking again for a target it has already passed costs nothing.
+ * @param  m       pointer to the matcher
+ * @param  i       index of the node
+ * @param  target  doc to start from
+ * @return the doc, INDEX_END if there is none
+ */
+static uint32_t node_seek (struct matcher* m, int i, uint32_t target) {
+    const struct query_node* qn = &m->q->nodes[i];
+    struct match_node* node = &m->nodes[i];
+    if (node->started && node->doc >= target) {
+        return node->doc;
+    }
+    node->started = 1;
+
+    uint32_t doc = INDEX_END;
+    if (node->missing) {
+        doc = INDEX_END;
+    } else if (qn->kind == QUERY_WORD) {
+        term_seek (node->terms, target);
+        doc = node->terms->doc;
+    } else if (qn->kind == QUERY_CONSTRAINT) {
+        doc = constraint_seek (node->terms, &m->q->constraints[qn->arg], target);
+    } else if (qn->kind == QUERY_AND) {
+        // Leapfrog the two sides until they agree on a doc
+        doc = node_seek (m, qn->left, target);
+        while (doc != INDEX_END) {
+            uint32_t right = node_seek (m, qn->right, doc);
+            if (right == doc) {
+                break;
+            }
+            doc = right == INDEX_END ? INDEX_END : node_seek (m, qn->left, right);
+        }
+    } else if (qn->kind == QUERY_OR) {
+        uint32_t left = node_seek (m, qn->left, target);
+        uint32_t right = node_seek (m, qn->right, target);
+        doc = left < right ? left : right;
+    } else {
+        // The first doc the negated node skips over
+        doc = target;
+        while (doc < m->num_docs && node_seek (m, qn->left, doc) == doc) {
+            doc++;
+        }
+        if (doc >= m->num_docs) {
+            doc = INDEX_END;
+        }
+    }
+
+    node->doc = doc;
+    return doc;
+}
+
+/**
+ * Collects every doc of an index file or hashtable that the filter matches.
+ * @param  m    pointer to the matcher, opened
+ * @param  seg  segment of the index file, to skip its deleted docs, or NULL
+ * @param  out  array of at least m->num_docs entries
+ * @return number of docs written to out
+ */
+static uint32_t match_docs (struct matcher* m, const struct segment* seg, uint32_t* out) {
+    uint32_t count = 0;
+    uint32_t doc = node_seek (m, m->q->root, 0);
+    while (doc != INDEX_END) {
+        if (seg == NULL || !segment_is_deleted (seg, doc)) {
+            out[count++] = doc;
+        }
+        doc = node_seek (m, m->q->root, doc + 1);
+    }
+    return count;
+}
+
+/**
+ * Allocates the array of matches.
+ * @param  size  most matches there can be
+ * @return the array
+ */
+static uint32_t* alloc_matches (uint32_t size) {
+    uint32_t* matches = (uint32_t*) malloc ((size + 1) * sizeof (uint32_t));
+
+    // Check for allocation errors
+    if (matches == NULL) {
+        printf("Error: unable to allocate memory for query matches\n");
+        exit (0);
+    }
+    return matches;
+}
+
+/**
+ * Finds the live documents of a set that match the query's filter. Without
+ * positions in every segment, phrases and NEAR/k constraints match nothing, see
+ * segments_positions().
+ * @param  set          pointer to the set
+ * @param  q            pointer to the parsed query, with a filter
+ * @param  num_matches  set to the number of matching documents
+ * @return sorted array of document numbers across the set, free it when done
+ */
+uint32_t* query_match (const struct segment_set* set, const struct query* q, uint32_t* num_matches) {
+    uint32_t* matches = alloc_matches (set->num_docs);
+    *num_matches = 0;
+    if (q->root < 0) {
+        return matches;
+    }
+
+    // Segments come in document order, so each one's matches go after the last
+    struct matcher m;
+    matcher_init (&m, q);
+    for (int s = 0; s < set->num_segments; s++) {
+        const struct segment* seg = &set->segs[s];
+        uint32_t* out = matches + *num_matches;
+
+        matcher_open (&m, seg->idx, NULL);
+        uint32_t count = match_docs (&m, seg, out);
+        for (uint32_t i = 0; i < count; i++) {
+            out[i] += seg->base;
+        }
+        *num_matches += count;
+    }
+    matcher_free (&m);
+    return matches;
+}
+
+/**
+ * Finds the documents of a trained hashtable that match the query's filter.
+ * Without positions, phrases and NEAR/k constraints match nothing.
+ * @param  ht           pointer to the hashtable
+ * @param  q            pointer to the parsed query, with a filter
+ * @param  num_matches  set to the number of matching documents
+ * @return sorted array of document numbers, free it when done
+ */
+uint32_t* query_match_ht (struct hashtable* ht, const struct query* q, uint32_t* num_matches) {
+    uint32_t* matches = alloc_matches (ht->num_docs);
+    *num_matches = 0;
+    if (q->root < 0) {
+        return matches;
+    }
+
+    struct matcher m;
+    matcher_init (&m, q);
+    matcher_open (&m, NULL, ht);
+    *num_matches = match_docs (&m, NULL, matches);
+    matcher_free (&m);
+    return matches;
+}
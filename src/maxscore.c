@@ -0,0 +1,257 @@
+/**************************************************************************************
+* Jack Umina
+* Created Nov, 2019
+* Document-at-a-time top-k scoring with MaxScore pruning.
+***************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hashtable.h"
+#include "infoRetrieval.h"
+#include "indexfile.h"
+#include "segments.h"
+#include "maxscore.h"
+#include "sort.h"
+
+/**
+ * One query term's postings within a segment.
+ */
+struct maxscore_list {
+    struct index_cursor cur;
+    double idf;
+    double max_score;
+    int term;
+};
+
+/**
+ * Checks whether a document scoring at most bound could still enter the top k.
+ * Documents are visited in increasing order, so a tie with the worst entry loses.
+ * @param  heap   the top k so far, heap[0] ranks last
+ * @param  size   number of entries in the heap
+ * @param  k      number of results wanted
+ * @param  bound  upper bound on the document's score
+ * @return 1 if it could enter, 0 if it can be skipped
+ */
+static inline int can_enter (const struct relevancy_score* heap, int size, int k, double bound) {
+    return size < k || bound * (1 + MAXSCORE_SLACK) >= heap[0].score;
+}
+
+/**
+ * Scores one segment's documents into the top k heap.
+ * @param seg    pointer to the segment
+ * @param lengths  the segment's document lengths
+ * @param scorer pointer to the query's scorer
+ * @param lists  the query terms found in this segment, sorted by increasing max_score
+ * @param n      number of lists
+ * @param contrib  array of query_len contributions, all 0, left all 0
+ * @param query_len  length of the search query
+ * @param heap   the top k so far
+ * @param size   number of entries in the heap, updated
+ * @param k      number of results wanted
+ * @param stats  counters to add this segment's work to
+ */
+static void score_segment (const struct segment* seg, const uint32_t* lengths,
+        const struct scorer* scorer, struct maxscore_list* lists, int n,
+        double* contrib, int query_len, struct relevancy_score* heap, int* size, int k,
+        struct query_stats* stats) {
+    // cum[i] bounds what lists 0..i can add together
+    double cum[n + 1];
+    double sum = 0;
+    for (int i = 0; i < n; i++) {
+        sum += lists[i].max_score;
+        cum[i] = sum;
+    }
+
+    // Lists before e are non-essential: together they cannot lift a document into the top k
+    int e = 0;
+    while (e < n && !can_enter (heap, *size, k, cum[e])) {
+        e++;
+    }
+
+    while (e < n) {
+        // The next candidate is the smallest doc on an essential list
+        uint32_t doc = INDEX_END;
+        for (int i = e; i < n; i++) {
+            if (lists[i].cur.doc < doc) {
+                doc = lists[i].cur.doc;
+            }
+        }
+        if (doc == INDEX_END) {
+            break;
+        }
+
+        if (seg->num_deleted == 0 || !segment_is_deleted (seg, doc)) {
+            uint32_t length = scorer_uses_length (scorer) ? lengths[doc] : 0;
+            double partial = 0;
+            for (int i = e; i < n; i++) {
+                if (lists[i].cur.doc == doc) {
+                    contrib[lists[i].term] = scorer_term (scorer, lists[i].cur.tf, length, lists[i].idf);
+                    partial += contrib[lists[i].term];
+                }
+            }
+
+            // Bound the rest with the block maxima of the non-essential lists
+            double bound = partial;
+            for (int i = 0; i < e; i++) {
+                if (lists[i].cur.doc <= doc) {
+                    bound += scorer_bound (scorer, index_cursor_block_max (&lists[i].cur, doc), lists[i].idf);
+                }
+            }
+
+            int pruned = !can_enter (heap, *size, k, bound);
+
+            // Add the non-essential lists, largest first, while the document can still make it
+            for (int i = e - 1; i >= 0 && !pruned; i--) {
+                if (!can_enter (heap, *size, k, partial + cum[i])) {
+                    pruned = 1;
+                    break;
+                }
+                if (index_cursor_seek (&lists[i].cur, doc) && lists[i].cur.doc == doc) {
+                    contrib[lists[i].term] = scorer_term (scorer, lists[i].cur.tf, length, lists[i].idf);
+                    partial += contrib[lists[i].term];
+                }
+            }
+
+            if (pruned) {
+                stats->docs_pruned++;
+            } else {
+                // Sum in query order, exactly as the exhaustive scorer does
+                struct relevancy_score entry = {seg->base + doc, 0};
+                for (int j = 0; j < query_len; j++) {
+                    if (contrib[j] != 0) {
+                        entry.score += contrib[j];
+                    }
+                }
+                stats->docs_scored++;
+
+                // A fuller heap raises the bar, so more lists become non-essential
+                if (top_k_push (heap, size, k, entry) && *size == k) {
+                    while (e < n && !can_enter (heap, *size, k, cum[e])) {
+                        e++;
+                    }
+                }
+            }
+
+            for (int i = 0; i < n; i++) {
+                contrib[lists[i].term] = 0;
+            }
+        }
+
+        // Move the essential lists past this doc
+        for (int i = 0; i < n; i++) {
+            if (lists[i].cur.doc == doc && i >= e) {
+                index_cursor_next (&lists[i].cur);
+            }
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        stats->postings_decoded += lists[i].cur.decoded;
+    }
+}
+
+/**
+ * Ranks the best k live documents for the search query without scoring every
+ * document. Gives exactly the same results as segments_score_exhaustive().
+ * @param  set           pointer to the set
+ * @param  sc            pointer to the scoring settings
+ * @param  search_query  string array of search terms
+ * @param  query_len     length of the search query
+ * @param  k             number of top results wanted, must be positive
+ * @param  num_results   set to the number of ranked entries in the array
+ * @param  stats         counters to add this query's work to, may be NULL
+ * @return array of relevancy scores numbered across the set, free it when done
+ */
+struct relevancy_score* maxscore_top_k (const struct segment_set* set, const struct scoring* sc,
+        char** search_query, int query_len, int k, int* num_results, struct query_stats* stats) {
+    const struct index_term** terms = (const struct index_term**) malloc ((query_len * set->num_segments + 1) * sizeof (struct index_term*));
+    double* idf = (double*) malloc ((query_len + 1) * sizeof (double));
+    double* contrib = (double*) calloc (query_len + 1, sizeof (double));
+    struct maxscore_list* lists = (struct maxscore_list*) malloc ((query_len + 1) * sizeof (struct maxscore_list));
+    struct relevancy_score* heap = (struct relevancy_score*) malloc ((k + 1) * sizeof (struct relevancy_score));
+
+    // Check for allocation errors
+    if (terms == NULL || idf == NULL || contrib == NULL || lists == NULL || heap == NULL) {
+        printf("Error: unable to allocate memory for top k scoring\n");
+        exit (0);
+    }
+
+    struct query_stats local;
+    memset (&local, 0, sizeof (local));
+
+    segments_lookup (set, sc, search_query, query_len, terms, idf);
+
+    struct scorer scorer;
+    scorer_init (&scorer, sc, segments_avg_length (set, sc));
+
+    int size = 0;
+    for (int s = 0; s < set->num_segments; s++) {
+        const struct segment* seg = &set->segs[s];
+
+        // Open the terms found in this segment, in order of increasing max score
+        int n = 0;
+        for (int j = 0; j < query_len; j++) {
+            const struct index_term* term = terms[j * set->num_segments + s];
+            if (idf[j] == 0 || term == NULL) {
+                continue;
+            }
+
+            struct maxscore_list list;
+            index_cursor_open (&list.cur, seg->idx, term);
+            list.idf = idf[j];
+            list.max_score = scorer_bound (&scorer, term->max_tf, idf[j]);
+            list.term = j;
+            local.postings_total += term->df;
+
+            int i = n++;
+            while (i > 0 && lists[i - 1].max_score > list.max_score) {
+                lists[i] = lists[i - 1];
+                i--;
+            }
+            lists[i] = list;
+        }
+
+        score_segment (seg, set->lengths + seg->base, &scorer, lists, n, contrib, query_len, heap, &size, k, &local);
+    }
+
+    // Fewer than k documents contain a term, the rest of the top k are the
+    // lowest numbered documents scoring 0, like the exhaustive ranking
+    if (size < k) {
+        char* ranked = (char*) calloc (set->num_docs + 1, sizeof (char));
+
+        // Check for allocation errors
+        if (ranked == NULL) {
+            printf("Error: unable to allocate memory for top k scoring\n");
+            exit (0);
+        }
+
+        for (int i = 0; i < size; i++) {
+            ranked[heap[i].doc] = 1;
+        }
+        for (uint32_t doc = 0; doc < set->num_docs && size < k; doc++) {
+            if (!ranked[doc] && !segments_is_deleted (set, doc)) {
+                struct relevancy_score entry = {doc, 0};
+                top_k_push (heap, &size, k, entry);
+            }
+        }
+        free (ranked);
+    }
+
+    sort (heap, size);
+    *num_results = size;
+
+    if (stats != NULL) {
+        stats->docs_scored += local.docs_scored;
+        stats->docs_pruned += local.docs_pruned;
+        stats->postings_decoded += local.postings_decoded;
+        stats->postings_total += local.postings_total;
+    }
+
+    free (lists);
+    free (contrib);
+    free (idf);
+    free (terms);
+    return heap;
+}
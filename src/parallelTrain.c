@@ -0,0 +1,229 @@
+/**************************************************************************************
+* Jack Umina
+* Created Nov, 2019
+* Trains the hashtable with several worker threads. Each worker indexes whole
+* documents into its own private shard, then the shards are merged in parallel.
+***************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "hashtable.h"
+#include "infoRetrieval.h"
+#include "parallelTrain.h"
+#include "stats.h"
+
+/**
+ * State shared by every worker. next_doc is the document queue, handed out in
+ * increasing order so each shard sees its documents in increasing order too.
+ */
+struct train_job {
+    struct hashtable* ht;
+    struct hashtable** shards;
+    struct arena* merge_arenas;
+    int num_workers;
+    pthread_mutex_t lock;
+    uint32_t next_doc;
+};
+
+struct train_worker {
+    struct train_job* job;
+    int id;
+};
+
+/**
+ * Pulls documents off the queue and indexes them into this worker's shard.
+ * @param  arg pointer to this worker's train_worker
+ * @return NULL
+ */
+static void* index_worker (void* arg) {
+    struct train_worker* worker = (struct train_worker*) arg;
+    struct train_job* job = worker->job;
+    struct hashtable* shard = job->shards[worker->id];
+
+    while (1) {
+        pthread_mutex_lock (&job->lock);
+        uint32_t doc = job->next_doc++;
+        pthread_mutex_unlock (&job->lock);
+
+        if (doc >= (uint32_t) job->ht->num_docs) {
+            break;
+        }
+
+        train_document (shard, &job->ht->docs[doc], doc);
+    }
+    stats_flush ();
+    return NULL;
+}
+
+/**
+ * Merges the postings of every word in this worker's range of ht->map. Each
+ * document lives in exactly one shard, so this interleaves the shards' sorted
+ * postings by doc. New chunks come from this worker's own arena.
+ * @param  arg pointer to this worker's train_worker
+ * @return NULL
+ */
+static void* merge_worker (void* arg) {
+    struct train_worker* worker = (struct train_worker*) arg;
+    struct train_job* job = worker->job;
+    struct hashtable* ht = job->ht;
+    struct arena* arena = &job->merge_arenas[worker->id];
+    int num_shards = job->num_workers;
+
+    int start = (int) ((int64_t) ht->num_buckets * worker->id / num_shards);
+    int end = (int) ((int64_t) ht->num_buckets * (worker->id + 1) / num_shards);
+
+    struct postings_cursor cursors[num_shards];
+    struct positions_cursor positions[num_shards];
+    int live[num_shards];
+
+    for (int i = start; i < end; i++) {
+        struct wordNode* wordPtr = &ht->map[i];
+        if (wordPtr->word == NULL) {
+            continue;
+        }
+
+        // Open a cursor on this word's postings in every shard that has it
+        for (int s = 0; s < num_shards; s++) {
+            struct wordNode* shardWord = ht_find (job->shards[s], wordPtr->word, wordPtr->len, wordPtr->hash);
+            live[s] = 0;
+            if (shardWord != NULL) {
+                postings_open (&cursors[s], &shardWord->postings);
+                live[s] = postings_next (&cursors[s]);
+                if (shardWord->positions != NULL) {
+                    positions_open (&positions[s], shardWord->positions);
+                }
+            }
+        }
+
+        // Repeatedly append the lowest doc among the shards' cursors
+        while (1) {
+            int min = -1;
+            for (int s = 0; s < num_shards; s++) {
+                if (live[s] && (min < 0 || cursors[s].doc < cursors[min].doc)) {
+                    min = s;
+                }
+            }
+            if (min < 0) {
+                break;
+            }
+
+            postings_append (arena, &wordPtr->postings, cursors[min].doc, cursors[min].tf);
+            wordPtr->df++;
+            if (wordPtr->positions != NULL) {
+                positions_copy (arena, wordPtr->positions, cursors[min].doc, &positions[min], cursors[min].tf);
+            }
+            live[min] = postings_next (&cursors[min]);
+        }
+    }
+    stats_flush ();
+    return NULL;
+}
+
+/**
+ * Runs fn on num_workers threads, one train_worker each, and waits for them.
+ * @param job  shared state
+ * @param fn   thread body
+ */
+static void run_workers (struct train_job* job, void* (*fn) (void*)) {
+    pthread_t threads[job->num_workers];
+    struct train_worker workers[job->num_workers];
+
+    for (int w = 0; w < job->num_workers; w++) {
+        workers[w].job = job;
+        workers[w].id = w;
+        if (pthread_create (&threads[w], NULL, fn, &workers[w]) != 0) {
+            printf("Error: unable to start worker thread\n");
+            exit (0);
+        }
+    }
+    for (int w = 0; w < job->num_workers; w++) {
+        pthread_join (threads[w], NULL);
+    }
+}
+
+/**
+ * Takes a set of documents and populates the hashtable using num_workers threads.
+ * Produces the same words, dfs and postings as train().
+ * @param  ht           pointer to the hashtable, must be empty
+ * @param  num_workers  number of threads to index and merge with
+ */
+void train_parallel (struct hashtable* ht, int num_workers) {
+    struct train_job job;
+    job.ht = ht;
+    job.num_workers = num_workers;
+    job.next_doc = 0;
+    pthread_mutex_init (&job.lock, NULL);
+
+    job.shards = (struct hashtable**) malloc (num_workers * sizeof (struct hashtable*));
+    job.merge_arenas = (struct arena*) malloc (num_workers * sizeof (struct arena));
+
+    // Check for allocation errors
+    if (job.shards == NULL || job.merge_arenas == NULL) {
+        printf("Error: unable to allocate memory for shards\n");
+        exit (0);
+    }
+
+    for (int w = 0; w < num_workers; w++) {
+        job.shards[w] = ht_create (HT_DEFAULT_BUCKETS);
+        job.shards[w]->positions = ht->positions;
+        arena_init (&job.merge_arenas[w], ARENA_CHUNK_SIZE);
+    }
+
+    // Phase 1: index documents into private shards, no locking besides the queue
+    run_workers (&job, index_worker);
+
+    // Phase 2: collect the vocabulary. This is the only serial step and is
+    // proportional to the number of distinct words, not to the corpus size.
+    for (int w = 0; w < num_workers; w++) {
+        struct hashtable* shard = job.shards[w];
+        for (int i = 0; i < shard->num_buckets; i++) {
+            if (shard->map[i].word == NULL) {
+                continue;
+            }
+
+            ht_add_word (ht, shard->map[i].word, shard->map[i].len, shard->map[i].hash);
+        }
+    }
+
+    // Phase 3: merge postings, each thread owning a disjoint range of ht->map
+    // and re-encoding into its own arena
+    run_workers (&job, merge_worker);
+
+    // The merged postings live in the merge arenas, so ht takes those over
+    for (int w = 0; w < num_workers; w++) {
+        arena_adopt (&ht->postings, &job.merge_arenas[w]);
+        ht_destroy (job.shards[w]);
+    }
+    free (job.shards);
+    free (job.merge_arenas);
+    pthread_mutex_destroy (&job.lock);
+}
+
+/**
+ * Creates a hashtable for the given files and trains it.
+ * @param  paths        array of file paths, copied into the document table
+ * @param  num_docs     number of paths
+ * @param  num_buckets  initial bucket hint
+ * @param  num_workers  number of training threads, 1 trains on the calling thread
+ * @param  positions    non-zero to also record token positions, for phrase queries
+ * @return pointer to the trained hashtable
+ */
+struct hashtable* train_files (char** paths, int num_docs, int num_buckets, int num_workers, int positions) {
+    double start = stats_begin ();
+    struct hashtable* ht = ht_create (num_buckets);
+
+    ht->docs = doc_table_create (paths, num_docs);
+    ht->num_docs = num_docs;
+    ht->positions = positions;
+
+    if (num_workers > 1) {
+        train_parallel (ht, num_workers);
+    } else {
+        train (ht);
+    }
+    stats_end (STATS_TRAIN, start);
+    return ht;
+}
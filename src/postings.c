@@ -0,0 +1,321 @@
+/**************************************************************************************
+* Jack Umina
+* Created Nov, 2019
+* Compressed postings lists. Each posting is stored as two varints, the gap from the
+* previous posting's doc and the tf, so a typical posting takes 2-3 bytes.
+* Positions lists store each posting's token positions the same way.
+***************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "postings.h"
+
+/**
+ * Encodes value as a varint, 7 bits per byte with the high bit set on all but the last.
+ * @param  out buffer with room for 5 bytes
+ * @param  value value to encode
+ * @return number of bytes written
+ */
+static int write_varint (uint8_t* out, uint32_t value) {
+    int n = 0;
+    while (value >= 0x80) {
+        out[n++] = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t) value;
+    return n;
+}
+
+/**
+ * Number of bytes write_varint() uses for value.
+ * @param  value value to encode
+ * @return encoded size
+ */
+static int varint_size (uint32_t value) {
+    int n = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        n++;
+    }
+    return n;
+}
+
+/**
+ * Finds room for more encoded bytes at the end of a chain of chunks.
+ * @param  a       arena new chunks are allocated from
+ * @param  head    pointer to the first chunk of the chain, NULL if it is empty
+ * @param  tail    pointer to the last chunk of the chain
+ * @param  needed  number of bytes that must fit in the returned chunk
+ * @return the last chunk, with at least needed bytes free
+ */
+static struct postings_chunk* chunk_with_room (struct arena* a, struct postings_chunk** head,
+        struct postings_chunk** tail, uint32_t needed) {
+    struct postings_chunk* chunk = *tail;
+
+    // Start a new chunk twice the size of the last, so a posting never spans two
+    if (chunk == NULL || chunk->cap - chunk->len < needed) {
+        uint32_t cap = chunk == NULL ? POSTINGS_MIN_CHUNK : chunk->cap * 2;
+        if (cap > POSTINGS_MAX_CHUNK) {
+            cap = POSTINGS_MAX_CHUNK;
+        }
+
+        struct postings_chunk* next = (struct postings_chunk*) arena_alloc (a,
+                sizeof (struct postings_chunk) + cap, sizeof (void*));
+        next->next = NULL;
+        next->len = 0;
+        next->cap = cap;
+
+        if (chunk == NULL) {
+            *head = next;
+        } else {
+            chunk->next = next;
+        }
+        *tail = next;
+        chunk = next;
+    }
+    return chunk;
+}
+
+/**
+ * Encodes the list's open posting into its chunks.
+ * @param a     arena new chunks are allocated from
+ * @param list  pointer to the list, must have an open posting
+ */
+static void flush_open (struct arena* a, struct postings_list* list) {
+    struct postings_chunk* chunk = chunk_with_room (a, &list->head, &list->tail, POSTINGS_MAX_ENCODED);
+
+    chunk->len += write_varint (chunk->bytes + chunk->len, list->open_doc - list->last_encoded_doc);
+    chunk->len += write_varint (chunk->bytes + chunk->len, list->open_tf);
+    list->last_encoded_doc = list->open_doc;
+    list->num_encoded++;
+    if (list->open_tf > list->max_tf) {
+        list->max_tf = list->open_tf;
+    }
+    list->open_tf = 0;
+}
+
+/**
+ * Initialize an empty postings list.
+ * @param list pointer to the list
+ */
+void postings_init (struct postings_list* list) {
+    list->head = NULL;
+    list->tail = NULL;
+    list->num_encoded = 0;
+    list->last_encoded_doc = 0;
+    list->open_doc = 0;
+    list->open_tf = 0;
+    list->max_tf = 0;
+}
+
+/**
+ * Records one occurrence of a word in doc. Docs must arrive in increasing order.
+ * @param  a     arena new chunks are allocated from
+ * @param  list  pointer to the list
+ * @param  doc   number of the document
+ * @return 1 if doc is new to this list (the df grew), 0 if only its tf grew
+ */
+int postings_add (struct arena* a, struct postings_list* list, uint32_t doc) {
+    if (list->open_tf != 0 && list->open_doc == doc) {
+        list->open_tf++;
+        return 0;
+    }
+    postings_append (a, list, doc, 1);
+    return 1;
+}
+
+/**
+ * Appends a whole posting with a known tf. doc must be above every doc in the list.
+ * @param a     arena new chunks are allocated from
+ * @param list  pointer to the list
+ * @param doc   number of the document
+ * @param tf    term frequency in doc
+ */
+void postings_append (struct arena* a, struct postings_list* list, uint32_t doc, uint32_t tf) {
+    if (list->open_tf != 0) {
+        flush_open (a, list);
+    }
+    list->open_doc = doc;
+    list->open_tf = tf;
+}
+
+/**
+ * Largest tf of any posting in the list, kept up to date as postings are added.
+ * @param  list pointer to the list
+ * @return the largest tf, 0 for an empty list
+ */
+uint32_t postings_max_tf (const struct postings_list* list) {
+    return list->open_tf > list->max_tf ? list->open_tf : list->max_tf;
+}
+
+/**
+ * Number of bytes postings_write() needs for this list.
+ * @param  list pointer to the list
+ * @return size of the contiguous encoding
+ */
+uint64_t postings_size (const struct postings_list* list) {
+    uint64_t size = 0;
+    for (const struct postings_chunk* chunk = list->head; chunk != NULL; chunk = chunk->next) {
+        size += chunk->len;
+    }
+    if (list->open_tf != 0) {
+        size += varint_size (list->open_doc - list->last_encoded_doc) + varint_size (list->open_tf);
+    }
+    return size;
+}
+
+/**
+ * Writes the list as contiguous varints, including its open posting.
+ * @param  list  pointer to the list
+ * @param  out   buffer of at least postings_size() bytes
+ * @return number of bytes written
+ */
+uint64_t postings_write (const struct postings_list* list, uint8_t* out) {
+    uint64_t n = 0;
+
+    // The chunks are already encoded, so they are copied as they are
+    for (const struct postings_chunk* chunk = list->head; chunk != NULL; chunk = chunk->next) {
+        memcpy (out + n, chunk->bytes, chunk->len);
+        n += chunk->len;
+    }
+    if (list->open_tf != 0) {
+        n += write_varint (out + n, list->open_doc - list->last_encoded_doc);
+        n += write_varint (out + n, list->open_tf);
+    }
+    return n;
+}
+
+/**
+ * Positions a cursor before the first posting of an in-memory list.
+ * @param cur   pointer to the cursor
+ * @param list  pointer to the list, must not change while the cursor is used
+ */
+void postings_open (struct postings_cursor* cur, const struct postings_list* list) {
+    cur->chunk = list->head;
+    cur->pos = list->head == NULL ? NULL : list->head->bytes;
+    cur->end = list->head == NULL ? NULL : list->head->bytes + list->head->len;
+    cur->num_encoded = list->num_encoded;
+    cur->open_doc = list->open_doc;
+    cur->open_tf = list->open_tf;
+    cur->doc = 0;
+    cur->tf = 0;
+}
+
+/**
+ * Positions a cursor before the first posting of a contiguous encoding.
+ * @param cur    pointer to the cursor
+ * @param bytes  first byte of the encoding
+ * @param count  number of postings encoded
+ */
+void postings_open_bytes (struct postings_cursor* cur, const uint8_t* bytes, uint32_t count) {
+    // With no chunk to move on to, the whole encoding is treated as one chunk
+    cur->chunk = NULL;
+    cur->pos = bytes;
+    cur->end = NULL;
+    cur->num_encoded = count;
+    cur->open_doc = 0;
+    cur->open_tf = 0;
+    cur->doc = 0;
+    cur->tf = 0;
+}
+
+/**
+ * Initialize an empty positions list.
+ * @param list pointer to the list
+ */
+void positions_init (struct positions_list* list) {
+    list->head = NULL;
+    list->tail = NULL;
+    list->last_doc = 0;
+    list->last_pos = 0;
+}
+
+/**
+ * Records the position of one occurrence of a word, right after the matching
+ * postings_add(). Positions must arrive in increasing order within a doc.
+ * @param a     arena new chunks are allocated from
+ * @param list  pointer to the list
+ * @param doc   number of the document
+ * @param pos   number of the token within the document
+ */
+void positions_add (struct arena* a, struct positions_list* list, uint32_t doc, uint32_t pos) {
+    // The first position in a doc is stored as it is, the rest as gaps
+    if (list->head == NULL || doc != list->last_doc) {
+        list->last_doc = doc;
+        list->last_pos = 0;
+    }
+
+    struct postings_chunk* chunk = chunk_with_room (a, &list->head, &list->tail, 5);
+    chunk->len += write_varint (chunk->bytes + chunk->len, pos - list->last_pos);
+    list->last_pos = pos;
+}
+
+/**
+ * Number of bytes positions_write() needs for this list.
+ * @param  list pointer to the list
+ * @return size of the contiguous encoding
+ */
+uint64_t positions_size (const struct positions_list* list) {
+    uint64_t size = 0;
+    for (const struct postings_chunk* chunk = list->head; chunk != NULL; chunk = chunk->next) {
+        size += chunk->len;
+    }
+    return size;
+}
+
+/**
+ * Writes the list as contiguous varints.
+ * @param  list  pointer to the list
+ * @param  out   buffer of at least positions_size() bytes
+ * @return number of bytes written
+ */
+uint64_t positions_write (const struct positions_list* list, uint8_t* out) {
+    uint64_t n = 0;
+    for (const struct postings_chunk* chunk = list->head; chunk != NULL; chunk = chunk->next) {
+        memcpy (out + n, chunk->bytes, chunk->len);
+        n += chunk->len;
+    }
+    return n;
+}
+
+/**
+ * Positions a cursor before the positions of the first posting of an in-memory list.
+ * @param cur   pointer to the cursor
+ * @param list  pointer to the list, must not change while the cursor is used
+ */
+void positions_open (struct positions_cursor* cur, const struct positions_list* list) {
+    cur->chunk = list->head;
+    cur->pos = list->head == NULL ? NULL : list->head->bytes;
+    cur->end = list->head == NULL ? NULL : list->head->bytes + list->head->len;
+}
+
+/**
+ * Positions a cursor on a contiguous encoding.
+ * @param cur    pointer to the cursor
+ * @param bytes  first byte of the positions to read
+ */
+void positions_open_bytes (struct positions_cursor* cur, const uint8_t* bytes) {
+    // With no chunk to move on to, the whole encoding is treated as one chunk
+    cur->chunk = NULL;
+    cur->pos = bytes;
+    cur->end = NULL;
+}
+
+/**
+ * Appends the positions of one posting read from a cursor, for merging lists.
+ * @param a     arena new chunks are allocated from
+ * @param list  pointer to the list to append to
+ * @param doc   number of the document in list
+ * @param cur   cursor on the posting's positions, advanced past them
+ * @param tf    term frequency of the posting
+ */
+void positions_copy (struct arena* a, struct positions_list* list, uint32_t doc,
+        struct positions_cursor* cur, uint32_t tf) {
+    uint32_t pos = 0;
+    for (uint32_t i = 0; i < tf; i++) {
+        pos += positions_next (cur);
+        positions_add (a, list, doc, pos);
+    }
+}
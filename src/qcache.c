@@ -0,0 +1,434 @@
+/**************************************************************************************
+* Jack Umina
+* Created Nov, 2019
+* Cache of ranked results keyed by normalized query, with least recently used eviction.
+***************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hashtable.h"
+#include "qcache.h"
+
+#define QCACHE_INITIAL_BUCKETS 64
+
+/**
+ * Compares two search terms, for qsort().
+ * @param  a pointer to the first term
+ * @param  b pointer to the second term
+ * @return negative, zero or positive as a sorts before, with or after b
+ */
+static int term_comparator (const void* a, const void* b) {
+    return strcmp (*(char* const*) a, *(char* const*) b);
+}
+
+/**
+ * Compares two wildcards by their patterns, then by the edits they allow, for qsort().
+ * @param  a pointer to the first wildcard
+ * @param  b pointer to the second wildcard
+ * @return negative, zero or positive as a sorts before, with or after b
+ */
+static int wildcard_comparator (const void* a, const void* b) {
+    const struct query_wildcard* x = (const struct query_wildcard*) a;
+    const struct query_wildcard* y = (const struct query_wildcard*) b;
+    int cmp = strcmp (x->pattern, y->pattern);
+    return cmp != 0 ? cmp : x->distance - y->distance;
+}
+
+/**
+ * Allocates a zeroed bucket array.
+ * @param  num_buckets  number of buckets, a power of 2
+ * @return the buckets
+ */
+static struct qcache_entry** alloc_buckets (uint32_t num_buckets) {
+    struct qcache_entry** buckets = (struct qcache_entry**) calloc (num_buckets, sizeof (struct qcache_entry*));
+
+    // Check for allocation errors
+    if (buckets == NULL) {
+        printf("Error: unable to allocate memory for query cache\n");
+        exit (0);
+    }
+    return buckets;
+}
+
+/**
+ * Creates an empty cache.
+ * @param  budget  most bytes of keys, results and bookkeeping to keep
+ * @return pointer to the cache
+ */
+struct qcache* qcache_create (size_t budget) {
+    struct qcache* cache = (struct qcache*) calloc (1, sizeof (struct qcache));
+
+    // Check for allocation errors
+    if (cache == NULL) {
+        printf("Error: unable to allocate memory for query cache\n");
+        exit (0);
+    }
+
+    cache->num_buckets = QCACHE_INITIAL_BUCKETS;
+    cache->buckets = alloc_buckets (cache->num_buckets);
+    cache->budget = budget;
+    pthread_mutex_init (&cache->lock, NULL);
+    return cache;
+}
+
+/**
+ * Frees one entry.
+ * @param entry pointer to the entry
+ */
+static void free_entry (struct qcache_entry* entry) {
+    free (entry->key);
+    free (entry->results);
+    free (entry);
+}
+
+/**
+ * Frees every entry and empties the cache, without touching its counters.
+ * @param cache pointer to the cache, locked
+ */
+static void clear (struct qcache* cache) {
+    struct qcache_entry* entry = cache->head;
+    while (entry != NULL) {
+        struct qcache_entry* next = entry->next;
+        free_entry (entry);
+        entry = next;
+    }
+    memset (cache->buckets, 0, cache->num_buckets * sizeof (struct qcache_entry*));
+    cache->head = NULL;
+    cache->tail = NULL;
+    cache->num_entries = 0;
+    cache->bytes = 0;
+}
+
+/**
+ * Frees a cache and every entry in it.
+ * @param cache pointer to the cache
+ */
+void qcache_destroy (struct qcache* cache) {
+    clear (cache);
+    pthread_mutex_destroy (&cache->lock);
+    free (cache->buckets);
+    free (cache);
+}
+
+/**
+ * Writes a word with its length in front, so the word can hold any character.
+ * @param  key   buffer to write to
+ * @param  word  the word
+ * @return number of characters written
+ */
+static size_t key_word (char* key, const char* word) {
+    return sprintf (key, "%zu'%s", strlen (word), word);
+}
+
+/**
+ * Writes a node of a query's filter and everything under it, operator first.
+ * @param  q    pointer to the parsed query
+ * @param  i    index of the node
+ * @param  key  buffer to write to
+ * @return number of characters written
+ */
+static size_t key_node (const struct query* q, int i, char* key) {
+    const struct query_node* node = &q->nodes[i];
+    size_t len = 0;
+
+    if (node->kind == QUERY_WORD) {
+        len += sprintf (key, "w");
+        len += key_word (key + len, node->word);
+    } else if (node->kind == QUERY_WILDCARD) {
+        len += sprintf (key, "*%d.", q->wildcards[node->arg].distance);
+        len += key_word (key + len, node->word);
+    } else if (node->kind == QUERY_CONSTRAINT) {
+        const struct query_constraint* c = &q->constraints[node->arg];
+        if (c->kind == CONSTRAINT_PHRASE) {
+            len += sprintf (key, "p%d.", c->num_terms);
+        } else {
+            len += sprintf (key, "n%u.", c->distance);
+        }
+        for (int j = 0; j < c->num_terms; j++) {
+            len += key_word (key + len, q->constraint_terms[c->first + j]);
+        }
+    } else if (node->kind == QUERY_NOT) {
+        len += sprintf (key, "!");
+        len += key_node (q, node->left, key + len);
+    } else {
+        len += sprintf (key, node->kind == QUERY_AND ? "&" : "|");
+        len += key_node (q, node->left, key + len);
+        len += key_node (q, node->right, key + len);
+    }
+    return len;
+}
+
+/**
+ * Sorts the terms of a query and joins them into its cache key. Repeated terms are
+ * kept, they count once for each time they appear when the query is scored.
+ * Scoring the sorted terms gives a reordered query the same results to the bit.
+ * The query's filter goes in front, written so that it ends unambiguously, then
+ * a ':' and the terms, then a ';' and the patterns of the scored wildcards, each
+ * with a ~ and the edits it allows.
+ * Wildcards are sorted too, so their words are added to the terms in the same
+ * order when the query is expanded.
+ * @param  q  pointer to the parsed query, not yet expanded, its terms and
+ *            wildcards are sorted in place
+ * @return the key, free it when done
+ */
+char* qcache_key (struct query* q) {
+    qsort (q->terms, q->num_terms, sizeof (char*), term_comparator);
+    qsort (q->wildcards, q->num_wildcards, sizeof (struct query_wildcard), wildcard_comparator);
+    for (int w = 0; w < q->num_wildcards; w++) {
+        if (q->wildcards[w].node >= 0) {
+            q->nodes[q->wildcards[w].node].arg = w;
+        }
+    }
+
+    // Every word of the filter costs its length and two numbers at most
+    size_t size = 3;
+    for (int i = 0; i < q->num_terms; i++) {
+        size += strlen (q->terms[i]) + 1;
+    }
+    for (int i = 0; i < q->num_nodes; i++) {
+        size += 32 + (q->nodes[i].word != NULL ? strlen (q->nodes[i].word) : 0);
+    }
+    for (int w = 0; w < q->num_wildcards; w++) {
+        size += strlen (q->wildcards[w].pattern) + 16;
+    }
+    for (int c = 0; c < q->num_constraints; c++) {
+        for (int j = 0; j < q->constraints[c].num_terms; j++) {
+            size += 24 + strlen (q->constraint_terms[q->constraints[c].first + j]);
+        }
+    }
+    char* key = (char*) malloc (size);
+
+    // Check for allocation errors
+    if (key == NULL) {
+        printf("Error: unable to allocate memory for query key\n");
+        exit (0);
+    }
+
+    size_t len = q->root >= 0 ? key_node (q, q->root, key) : 0;
+
+    // Terms never contain spaces, query_parse() splits on them
+    len += sprintf (key + len, ":");
+    for (int i = 0; i < q->num_terms; i++) {
+        len += sprintf (key + len, i == 0 ? "%s" : " %s", q->terms[i]);
+    }
+    len += sprintf (key + len, ";");
+    for (int w = 0, n = 0; w < q->num_wildcards; w++) {
+        if (q->wildcards[w].scored) {
+            len += sprintf (key + len, n++ == 0 ? "%s~%d" : " %s~%d", q->wildcards[w].pattern, q->wildcards[w].distance);
+        }
+    }
+    return key;
+}
+
+/**
+ * Unlinks an entry from the recency list.
+ * @param cache  pointer to the cache, locked
+ * @param entry  pointer to the entry
+ */
+static void list_remove (struct qcache* cache, struct qcache_entry* entry) {
+    if (entry->prev != NULL) {
+        entry->prev->next = entry->next;
+    } else {
+        cache->head = entry->next;
+    }
+    if (entry->next != NULL) {
+        entry->next->prev = entry->prev;
+    } else {
+        cache->tail = entry->prev;
+    }
+}
+
+/**
+ * Links an entry in as the most recently used.
+ * @param cache  pointer to the cache, locked
+ * @param entry  pointer to the entry
+ */
+static void list_push_front (struct qcache* cache, struct qcache_entry* entry) {
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if (cache->head != NULL) {
+        cache->head->prev = entry;
+    } else {
+        cache->tail = entry;
+    }
+    cache->head = entry;
+}
+
+/**
+ * Finds the entry of a key.
+ * @param  cache  pointer to the cache, locked
+ * @param  key    the query's key
+ * @param  hash   hash_code() of the key
+ * @return pointer to the entry, or NULL if the key is not cached
+ */
+static struct qcache_entry* find (const struct qcache* cache, const char* key, uint64_t hash) {
+    struct qcache_entry* entry = cache->buckets[hash & (cache->num_buckets - 1)];
+    while (entry != NULL && (entry->hash != hash || strcmp (entry->key, key) != 0)) {
+        entry = entry->chain;
+    }
+    return entry;
+}
+
+/**
+ * Removes the least recently used entry.
+ * @param cache pointer to the cache, locked and not empty
+ */
+static void evict (struct qcache* cache) {
+    struct qcache_entry* victim = cache->tail;
+    struct qcache_entry** link = &cache->buckets[victim->hash & (cache->num_buckets - 1)];
+    while (*link != victim) {
+        link = &(*link)->chain;
+    }
+    *link = victim->chain;
+
+    list_remove (cache, victim);
+    cache->num_entries--;
+    cache->bytes -= victim->bytes;
+    cache->evictions++;
+    free_entry (victim);
+}
+
+/**
+ * Doubles the number of buckets, rehashing every entry with its stored hash.
+ * @param cache pointer to the cache, locked
+ */
+static void grow (struct qcache* cache) {
+    uint32_t num_buckets = cache->num_buckets * 2;
+    struct qcache_entry** buckets = alloc_buckets (num_buckets);
+
+    for (struct qcache_entry* entry = cache->head; entry != NULL; entry = entry->next) {
+        struct qcache_entry** bucket = &buckets[entry->hash & (num_buckets - 1)];
+        entry->chain = *bucket;
+        *bucket = entry;
+    }
+
+    free (cache->buckets);
+    cache->buckets = buckets;
+    cache->num_buckets = num_buckets;
+}
+
+/**
+ * Looks a query up and copies out its results. Counts a hit or a miss.
+ * @param  cache        pointer to the cache
+ * @param  key          the query's qcache_key()
+ * @param  num_results  set to the number of results on a hit
+ * @return a copy of the results, free it when done, or NULL on a miss
+ */
+struct relevancy_score* qcache_get (struct qcache* cache, const char* key, int* num_results) {
+    uint64_t hash = hash_code (key, strlen (key));
+
+    pthread_mutex_lock (&cache->lock);
+    struct qcache_entry* entry = find (cache, key, hash);
+    if (entry == NULL) {
+        cache->misses++;
+        pthread_mutex_unlock (&cache->lock);
+        return NULL;
+    }
+
+    // Copy out under the lock, another thread may evict the entry right after
+    size_t size = entry->num_results * sizeof (struct relevancy_score);
+    struct relevancy_score* results = (struct relevancy_score*) malloc (size > 0 ? size : 1);
+
+    // Check for allocation errors
+    if (results == NULL) {
+        printf("Error: unable to allocate memory for cached results\n");
+        exit (0);
+    }
+    memcpy (results, entry->results, size);
+    *num_results = entry->num_results;
+
+    list_remove (cache, entry);
+    list_push_front (cache, entry);
+    cache->hits++;
+    pthread_mutex_unlock (&cache->lock);
+    return results;
+}
+
+/**
+ * Caches a copy of a query's results, evicting the least recently used entries until
+ * it fits. Results larger than the whole budget are not cached.
+ * @param cache        pointer to the cache
+ * @param key          the query's qcache_key()
+ * @param results      ranked results
+ * @param num_results  number of results
+ */
+void qcache_put (struct qcache* cache, const char* key, const struct relevancy_score* results, int num_results) {
+    size_t key_len = strlen (key);
+    size_t size = num_results * sizeof (struct relevancy_score);
+    size_t bytes = sizeof (struct qcache_entry) + sizeof (struct qcache_entry*) + key_len + 1 + size;
+    if (bytes > cache->budget) {
+        return;
+    }
+    uint64_t hash = hash_code (key, key_len);
+
+    // Build the entry before taking the lock
+    struct qcache_entry* entry = (struct qcache_entry*) malloc (sizeof (struct qcache_entry));
+    char* key_copy = (char*) malloc (key_len + 1);
+    struct relevancy_score* results_copy = (struct relevancy_score*) malloc (size > 0 ? size : 1);
+
+    // Check for allocation errors
+    if (entry == NULL || key_copy == NULL || results_copy == NULL) {
+        printf("Error: unable to allocate memory for cached results\n");
+        exit (0);
+    }
+    memcpy (key_copy, key, key_len + 1);
+    memcpy (results_copy, results, size);
+    entry->key = key_copy;
+    entry->hash = hash;
+    entry->results = results_copy;
+    entry->num_results = num_results;
+    entry->bytes = bytes;
+
+    pthread_mutex_lock (&cache->lock);
+
+    // Another thread may have answered the same query meanwhile
+    if (find (cache, key, hash) != NULL) {
+        pthread_mutex_unlock (&cache->lock);
+        free_entry (entry);
+        return;
+    }
+
+    while (cache->bytes + bytes > cache->budget) {
+        evict (cache);
+    }
+    if (cache->num_entries >= cache->num_buckets) {
+        grow (cache);
+    }
+
+    struct qcache_entry** bucket = &cache->buckets[hash & (cache->num_buckets - 1)];
+    entry->chain = *bucket;
+    *bucket = entry;
+    list_push_front (cache, entry);
+    cache->num_entries++;
+    cache->bytes += bytes;
+    pthread_mutex_unlock (&cache->lock);
+}
+
+/**
+ * Drops every entry, called whenever the index the results came from changes.
+ * @param cache pointer to the cache
+ */
+void qcache_invalidate (struct qcache* cache) {
+    pthread_mutex_lock (&cache->lock);
+    clear (cache);
+    cache->invalidations++;
+    pthread_mutex_unlock (&cache->lock);
+}
+
+/**
+ * Reads the cache's counters.
+ * @param cache  pointer to the cache
+ * @param stats  filled in with the counters
+ */
+void qcache_get_stats (struct qcache* cache, struct qcache_stats* stats) {
+    pthread_mutex_lock (&cache->lock);
+    stats->hits = cache->hits;
+    stats->misses = cache->misses;
+    stats->evictions = cache->evictions;
+    stats->invalidations = cache->invalidations;
+    stats->num_entries = cache->num_entries;
+    stats->bytes = cache->bytes;
+    pthread_mutex_unlock (&cache->lock);
+}
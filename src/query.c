@@ -0,0 +1,913 @@
+/**************************************************************************************
+* Jack Umina
+* Created Nov, 2019
+* Parses search queries with quoted phrases, NEAR/k, wildcards, fuzzy words and
+* Boolean operators, and finds the indexed words that wildcards and fuzzy words
+* stand for.
+***************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hashtable.h"
+#include "infoRetrieval.h"
+#include "query.h"
+#include "stats.h"
+
+enum lex_kind {
+    LEX_WORD,
+    LEX_NEAR,
+    LEX_AND,
+    LEX_OR,
+    LEX_NOT,
+    LEX_OPEN,
+    LEX_CLOSE,
+    LEX_QUOTE
+};
+
+/**
+ * A piece of a query: a word, an operator, a parenthesis or a quote. distance is
+ * the k of a NEAR/k, or the edits a fuzzy word allows.
+ */
+struct lex_token {
+    enum lex_kind kind;
+    char* word;
+    uint32_t distance;
+};
+
+/**
+ * Where parsing is up to in the tokens of a query.
+ */
+struct parser {
+    struct lex_token* tokens;
+    int num_tokens;
+    int pos;
+    struct query* q;
+    int num_constraint_terms;
+    int negated;
+    int depth;
+    char* last_word;
+};
+
+/**
+ * Checks whether a word is a NEAR/k operator. Words are lowercase by now.
+ * @param  word      the word
+ * @param  distance  set to k if it is
+ * @return 1 if the word is NEAR/k with k a number, 0 otherwise
+ */
+static int parse_near (const char* word, uint32_t* distance) {
+    if (strncmp (word, "near/", 5) != 0 || word[5] == '\0') {
+        return 0;
+    }
+
+    uint32_t k = 0;
+    for (const char* c = word + 5; *c != '\0'; c++) {
+        if (*c < '0' || *c > '9' || k > 100000000) {
+            return 0;
+        }
+        k = k * 10 + (*c - '0');
+    }
+    *distance = k;
+    return 1;
+}
+
+/**
+ * Checks whether a word of the query is a wildcard.
+ * @param  word  the word
+ * @return 1 if it has a * or ? in it, 0 if not
+ */
+static int is_wildcard (const char* word) {
+    return strpbrk (word, "*?") != NULL;
+}
+
+/**
+ * Checks whether a word is fuzzy, ending in ~, ~1 or ~2, and cuts the ~ off if
+ * so. A wildcard is not fuzzy, and a word longer than QUERY_MAX_FUZZY_LENGTH or
+ * ending in ~0 is just the word.
+ * @param  word  the word
+ * @return the edits it allows, 0 if it is not fuzzy
+ */
+static uint32_t parse_fuzzy (char* word) {
+    char* tilde = strrchr (word, '~');
+    if (tilde == NULL || tilde == word || is_wildcard (word)) {
+        return 0;
+    }
+
+    uint32_t distance = QUERY_MAX_DISTANCE;
+    if (tilde[1] != '\0') {
+        if (tilde[1] < '0' || tilde[1] > '0' + QUERY_MAX_DISTANCE || tilde[2] != '\0') {
+            return 0;
+        }
+        distance = tilde[1] - '0';
+    }
+    *tilde = '\0';
+    return tilde - word > QUERY_MAX_FUZZY_LENGTH ? 0 : distance;
+}
+
+/**
+ * Splits a query on spaces into tokens. Operators are only recognized in capitals
+ * and outside of phrases, parentheses and quotes may be attached to words.
+ * @param  str     the query, split and lowercased in place
+ * @param  tokens  array of at least strlen (str) tokens
+ * @return number of tokens
+ */
+static int lex (char* str, struct lex_token* tokens) {
+    int n = 0;
+    int in_phrase = 0;
+    char* save;
+
+    for (char* p = strtok_r (str, " ", &save); p != NULL; p = strtok_r (NULL, " ", &save)) {
+        // Opening parentheses and quote in front, the closing ones at the end
+        char* word = p;
+        while (!in_phrase && *p == '(') {
+            tokens[n++].kind = LEX_OPEN;
+            p++;
+        }
+        if (!in_phrase && (strcmp (p, "AND") == 0 || strcmp (p, "OR") == 0 || strcmp (p, "NOT") == 0)) {
+            tokens[n++].kind = p[0] == 'A' ? LEX_AND : p[0] == 'O' ? LEX_OR : LEX_NOT;
+            continue;
+        }
+        if (*p == '"') {
+            // A quote in front opens a phrase, or closes the open one
+            tokens[n++].kind = LEX_QUOTE;
+            in_phrase = !in_phrase;
+            p++;
+        }
+
+        size_t len = strlen (p);
+        int closes = 0;
+        while (len > 0 && p[len - 1] == ')') {
+            closes++;
+            len--;
+        }
+        int quoted = len > 0 && p[len - 1] == '"';
+        len -= quoted;
+        quoted &= in_phrase;
+
+        // Inside a phrase a parenthesis is part of the word
+        if (in_phrase && !quoted) {
+            len += closes;
+            closes = 0;
+        }
+
+        if (len > 0) {
+            char* end = p + len;
+            char last = *end;
+            *end = '\0';
+            str_tolower (p);
+
+            // A word's distance is the edits it allows when it is fuzzy
+            tokens[n].word = p;
+            tokens[n].distance = 0;
+            int bare = p == word && last == '\0';
+            tokens[n].kind = !in_phrase && bare && parse_near (p, &tokens[n].distance) ? LEX_NEAR : LEX_WORD;
+            if (tokens[n].kind == LEX_WORD && !in_phrase) {
+                tokens[n].distance = parse_fuzzy (p);
+            }
+            n++;
+        }
+
+        if (quoted) {
+            tokens[n++].kind = LEX_QUOTE;
+            in_phrase = !in_phrase;
+        }
+        for (int i = 0; i < closes; i++) {
+            tokens[n++].kind = LEX_CLOSE;
+        }
+    }
+    return n;
+}
+
+/**
+ * Adds a node to the query.
+ * @param  q      pointer to the query
+ * @param  kind   kind of node
+ * @param  word   word of a word node
+ * @param  arg    constraint of a constraint node
+ * @param  left   first child of an operator node
+ * @param  right  second child of an AND or OR node
+ * @return index of the node
+ */
+static int add_node (struct query* q, enum query_node_kind kind, char* word, int arg, int left, int right) {
+    struct query_node* node = &q->nodes[q->num_nodes];
+    node->kind = kind;
+    node->word = word;
+    node->arg = arg;
+    node->left = left;
+    node->right = right;
+    return q->num_nodes++;
+}
+
+/**
+ * Joins two nodes with AND or OR, either of which may be missing.
+ * @param  q      pointer to the query
+ * @param  kind   QUERY_AND or QUERY_OR
+ * @param  left   first node, or -1
+ * @param  right  second node, or -1
+ * @return index of the joined node, -1 if both are missing
+ */
+static int combine (struct query* q, enum query_node_kind kind, int left, int right) {
+    if (left < 0) {
+        return right;
+    }
+    if (right < 0) {
+        return left;
+    }
+    return add_node (q, kind, NULL, 0, left, right);
+}
+
+/**
+ * Checks whether a token stands for the indexed words it matches, a wildcard or a
+ * fuzzy word.
+ * @param  t  pointer to the token
+ * @return 1 if it does, 0 if not
+ */
+static int is_expanded (const struct lex_token* t) {
+    return t->kind == LEX_WORD && (t->distance > 0 || is_wildcard (t->word));
+}
+
+/**
+ * Records a wildcard or fuzzy word of the query, its words scored unless it is
+ * under NOT.
+ * @param p     pointer to the parser
+ * @param t     pointer to its token
+ * @param node  index of its node, or -1 if it only scores
+ */
+static void add_wildcard (struct parser* p, const struct lex_token* t, int node) {
+    struct query_wildcard* w = &p->q->wildcards[p->q->num_wildcards++];
+    w->pattern = t->word;
+    w->distance = t->distance;
+    w->node = node;
+    w->scored = p->negated % 2 == 0;
+    p->last_word = t->word;
+}
+
+/**
+ * Records a word of the query, scored unless it is under NOT.
+ * @param p     pointer to the parser
+ * @param word  the word
+ */
+static void add_term (struct parser* p, char* word) {
+    if (p->negated % 2 == 0) {
+        p->q->terms[p->q->num_terms++] = word;
+    }
+    p->last_word = word;
+}
+
+/**
+ * Adds a constraint over the words from first up to the last constraint word.
+ * @param  p         pointer to the parser
+ * @param  kind      kind of constraint
+ * @param  first     index of its first word in constraint_terms
+ * @param  distance  largest distance between the words of a NEAR constraint
+ * @return index of the constraint's node
+ */
+static int add_constraint (struct parser* p, enum constraint_kind kind, int first, uint32_t distance) {
+    struct query* q = p->q;
+    struct query_constraint* c = &q->constraints[q->num_constraints];
+    c->kind = kind;
+    c->first = first;
+    c->num_terms = p->num_constraint_terms - first;
+    c->distance = distance;
+    return add_node (q, QUERY_CONSTRAINT, NULL, q->num_constraints++, -1, -1);
+}
+
+static int parse_or (struct parser* p);
+
+/**
+ * Parses a word, a phrase, a NEAR/k joining the previous word to the next one, or
+ * an expression in parentheses.
+ * @param  p pointer to the parser
+ * @return index of the node, -1 if the tokens there form nothing
+ */
+static int parse_primary (struct parser* p) {
+    struct query* q = p->q;
+
+    // A closing parenthesis belongs to the caller
+    if (p->tokens[p->pos].kind == LEX_CLOSE) {
+        return -1;
+    }
+
+    struct lex_token* t = &p->tokens[p->pos++];
+    if (is_expanded (t)) {
+        int node = add_node (q, QUERY_WILDCARD, t->word, q->num_wildcards, -1, -1);
+        add_wildcard (p, t, node);
+        return node;
+    }
+    if (t->kind == LEX_WORD) {
+        add_term (p, t->word);
+        return add_node (q, QUERY_WORD, t->word, 0, -1, -1);
+    }
+
+    if (t->kind == LEX_QUOTE) {
+        int first = p->num_constraint_terms;
+        while (p->pos < p->num_tokens && p->tokens[p->pos].kind != LEX_QUOTE) {
+            if (p->tokens[p->pos].kind == LEX_WORD) {
+                add_term (p, p->tokens[p->pos].word);
+                q->constraint_terms[p->num_constraint_terms++] = p->tokens[p->pos].word;
+            }
+            p->pos++;
+        }
+        p->pos += p->pos < p->num_tokens;
+
+        // A phrase of one word only needs the word
+        int len = p->num_constraint_terms - first;
+        if (len == 0) {
+            return -1;
+        }
+        if (len == 1) {
+            p->num_constraint_terms--;
+            return add_node (q, QUERY_WORD, q->constraint_terms[first], 0, -1, -1);
+        }
+        return add_constraint (p, CONSTRAINT_PHRASE, first, 0);
+    }
+
+    if (t->kind == LEX_NEAR) {
+        if (p->last_word == NULL || p->pos == p->num_tokens || p->tokens[p->pos].kind != LEX_WORD) {
+            return -1;
+        }
+        int first = p->num_constraint_terms;
+        q->constraint_terms[p->num_constraint_terms++] = p->last_word;
+        q->constraint_terms[p->num_constraint_terms++] = p->tokens[p->pos].word;
+        add_term (p, p->tokens[p->pos++].word);
+        return add_constraint (p, CONSTRAINT_NEAR, first, t->distance);
+    }
+
+    // Parentheses nested too deep are ignored, their closing ones are skipped later
+    if (t->kind == LEX_OPEN && p->depth < QUERY_MAX_DEPTH) {
+        p->depth++;
+        int node = parse_or (p);
+        p->depth--;
+        if (p->pos < p->num_tokens && p->tokens[p->pos].kind == LEX_CLOSE) {
+            p->pos++;
+        }
+        return node;
+    }
+
+    // Stray operators
+    return -1;
+}
+
+/**
+ * Parses a primary after any number of NOTs, an even number of which cancel out.
+ * @param  p pointer to the parser
+ * @return index of the node, -1 if the tokens there form nothing
+ */
+static int parse_not (struct parser* p) {
+    int nots = 0;
+    while (p->pos < p->num_tokens && p->tokens[p->pos].kind == LEX_NOT) {
+        nots++;
+        p->pos++;
+    }
+    if (p->pos == p->num_tokens) {
+        return -1;
+    }
+
+    p->negated += nots % 2;
+    int node = parse_primary (p);
+    p->negated -= nots % 2;
+
+    if (nots % 2 == 0 || node < 0) {
+        return node;
+    }
+    return add_node (p->q, QUERY_NOT, NULL, 0, node, -1);
+}
+
+/**
+ * Parses operands joined by AND, or by nothing, which means the same.
+ * @param  p pointer to the parser
+ * @return index of the node, -1 if the tokens there form nothing
+ */
+static int parse_and (struct parser* p) {
+    int node = parse_not (p);
+    while (p->pos < p->num_tokens && p->tokens[p->pos].kind != LEX_OR && p->tokens[p->pos].kind != LEX_CLOSE) {
+        if (p->tokens[p->pos].kind == LEX_AND) {
+            p->pos++;
+            continue;
+        }
+        node = combine (p->q, QUERY_AND, node, parse_not (p));
+    }
+    return node;
+}
+
+/**
+ * Parses operands joined by OR.
+ * @param  p pointer to the parser
+ * @return index of the node, -1 if the tokens there form nothing
+ */
+static int parse_or (struct parser* p) {
+    int node = parse_and (p);
+    while (p->pos < p->num_tokens && p->tokens[p->pos].kind == LEX_OR) {
+        p->pos++;
+        node = combine (p->q, QUERY_OR, node, parse_and (p));
+    }
+    return node;
+}
+
+/**
+ * Splits a query into lowercase words and picks out its phrases, NEAR/k operators
+ * and Boolean operators. Stray quotes, parentheses and operators are ignored.
+ * @param  str  the query, split and lowercased in place
+ * @param  q    pointer to the query to fill in, release with query_free()
+ * @return 0 on success, or -1 if the query needs more than QUERY_MAX_NODES nodes,
+ *         in which case q is already released
+ */
+int query_parse (char* str, struct query* q) {
+    double start = stats_begin ();
+    if (str == NULL) {
+        printf("Error: search query cannot be empty.\n");
+        exit (0);
+    }
+
+    // Every token takes at least one character, and every word, constraint word
+    // and node at most one token, or three for nodes
+    size_t size = strlen (str) + 1;
+    struct lex_token* tokens = (struct lex_token*) malloc (size * sizeof (struct lex_token));
+    q->terms = (char**) malloc (size * sizeof (char*));
+    q->constraint_terms = (char**) malloc (size * sizeof (char*));
+    q->constraints = (struct query_constraint*) malloc (size * sizeof (struct query_constraint));
+    q->nodes = (struct query_node*) malloc (3 * size * sizeof (struct query_node));
+    q->wildcards = (struct query_wildcard*) malloc (size * sizeof (struct query_wildcard));
+
+    // Check for allocation errors
+    if (tokens == NULL || q->terms == NULL || q->constraint_terms == NULL || q->constraints == NULL
+            || q->nodes == NULL || q->wildcards == NULL) {
+        printf("Error: unable to allocate memory for query\n");
+        exit (0);
+    }
+
+    q->weights = NULL;
+    q->num_terms = 0;
+    q->num_constraints = 0;
+    q->num_nodes = 0;
+    q->root = -1;
+    q->num_wildcards = 0;
+
+    struct parser p;
+    memset (&p, 0, sizeof (p));
+    p.tokens = tokens;
+    p.num_tokens = lex (str, tokens);
+    p.q = q;
+
+    int boolean = 0;
+    for (int i = 0; i < p.num_tokens; i++) {
+        enum lex_kind kind = tokens[i].kind;
+        boolean |= kind == LEX_AND || kind == LEX_OR || kind == LEX_NOT || kind == LEX_OPEN || kind == LEX_CLOSE;
+    }
+
+    while (p.pos < p.num_tokens) {
+        if (boolean) {
+            // Whatever is left after a stray closing parenthesis must match too
+            if (tokens[p.pos].kind == LEX_CLOSE) {
+                p.pos++;
+                continue;
+            }
+            q->root = combine (q, QUERY_AND, q->root, parse_or (&p));
+        } else if (is_expanded (&tokens[p.pos])) {
+            add_wildcard (&p, &tokens[p.pos++], -1);
+        } else if (tokens[p.pos].kind == LEX_WORD) {
+            // Without operators, only phrases and NEAR/k filter and words just score
+            add_term (&p, tokens[p.pos++].word);
+        } else {
+            q->root = combine (q, QUERY_AND, q->root, parse_primary (&p));
+        }
+    }
+
+    free (tokens);
+    stats_end (STATS_PARSE, start);
+
+    // Matching recurses through the nodes, so a query with too many is refused
+    // whole rather than answered without some of its operands
+    if (q->num_nodes > QUERY_MAX_NODES) {
+        query_free (q);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Checks whether a word matches a wildcard pattern, where * matches any characters
+ * and ? any one character.
+ * @param  pattern  the pattern
+ * @param  word     the word
+ * @return 1 if the whole word matches, 0 if not
+ */
+int query_wildcard_match (const char* pattern, const char* word) {
+    // On a mismatch, let the last * take one more character and try again from there
+    const char* star = NULL;
+    const char* retry = NULL;
+    while (*word != '\0') {
+        if (*pattern == '*') {
+            star = pattern++;
+            retry = word;
+        } else if (*pattern == '?' || (*pattern != '\0' && *pattern == *word)) {
+            pattern++;
+            word++;
+        } else if (star != NULL) {
+            pattern = star + 1;
+            word = ++retry;
+        } else {
+            return 0;
+        }
+    }
+    while (*pattern == '*') {
+        pattern++;
+    }
+    return *pattern == '\0';
+}
+
+/**
+ * Counts the insertions, deletions and substitutions that turn one word into
+ * another.
+ * @param  a    the first word
+ * @param  b    the second word
+ * @param  max  largest distance of interest
+ * @return the distance, or max + 1 if it is larger than max
+ */
+int query_edit_distance (const char* a, const char* b, int max) {
+    size_t m = strlen (a);
+    size_t n = strlen (b);
+    if ((m > n ? m - n : n - m) > (size_t) max) {
+        return max + 1;
+    }
+
+    int* row = (int*) malloc ((n + 1) * sizeof (int));
+
+    // Check for allocation errors
+    if (row == NULL) {
+        printf("Error: unable to allocate memory for edit distance\n");
+        exit (0);
+    }
+
+    // row[j] is the distance from the first i characters of a to the first j of b
+    for (size_t j = 0; j <= n; j++) {
+        row[j] = j;
+    }
+    for (size_t i = 1; i <= m; i++) {
+        int diagonal = row[0];
+        row[0] = i;
+        for (size_t j = 1; j <= n; j++) {
+            int above = row[j];
+            int best = diagonal + (a[i - 1] != b[j - 1]);
+            best = above + 1 < best ? above + 1 : best;
+            best = row[j - 1] + 1 < best ? row[j - 1] + 1 : best;
+            row[j] = best;
+            diagonal = above;
+        }
+    }
+
+    int distance = row[n] > max ? max + 1 : row[n];
+    free (row);
+    return distance;
+}
+
+/**
+ * Weight of a word a fuzzy word expands to, 1 / (1 + distance), so the word
+ * itself counts fully and each edit away counts less.
+ * @param  distance  edits between the two words
+ * @return the weight
+ */
+double query_fuzzy_weight (int distance) {
+    return 1.0 / (1 + distance);
+}
+
+/**
+ * Finds the first word at or after lo that does not sort before a prefix, the
+ * first len characters of word, or with past set, the first one after every word
+ * with that prefix. Gallops from lo before the binary search, so words a few
+ * places on are found in a few steps.
+ * @param  d     pointer to the dictionary
+ * @param  lo    index of the first word to consider
+ * @param  word  word to take the prefix of
+ * @param  len   length of the prefix
+ * @param  past  1 to skip the words with the prefix, 0 to stop at the first of them
+ * @return index of the word, d->num_words if there is none
+ */
+static uint32_t dict_search (const struct query_dict* d, uint32_t lo, const char* word, size_t len, int past) {
+    uint32_t hi = lo;
+    uint32_t step = 1;
+    while (hi < d->num_words) {
+        int cmp = strncmp (d->word (d->dict, hi), word, len);
+        if (cmp > 0 || (!past && cmp == 0)) {
+            break;
+        }
+        lo = hi + 1;
+        hi = step < d->num_words - hi ? hi + step : d->num_words;
+        step *= 2;
+    }
+
+    // The answer is in lo up to hi, hi included
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = strncmp (d->word (d->dict, mid), word, len);
+        if (cmp < 0 || (past && cmp == 0)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * Finds the words of a dictionary that a wildcard pattern matches, among those
+ * starting with its part before the first * or ?.
+ * @param  d          pointer to the dictionary
+ * @param  pattern    the pattern, see query_wildcard_match()
+ * @param  words      array of at least max_words words to fill in
+ * @param  max_words  most words to find
+ * @return number of words found
+ */
+static int expand_pattern (const struct query_dict* d, const char* pattern, char** words, int max_words) {
+    size_t len = strcspn (pattern, "*?");
+
+    int n = 0;
+    for (uint32_t i = dict_search (d, 0, pattern, len, 0); i < d->num_words && n < max_words; i++) {
+        char* word = d->word (d->dict, i);
+        if (strncmp (word, pattern, len) != 0) {
+            break;
+        }
+        if (query_wildcard_match (pattern, word)) {
+            words[n++] = word;
+        }
+    }
+    return n;
+}
+
+/**
+ * Finds the words of a dictionary at most some edits away from a word. Walks the
+ * sorted words as a trie: row r of the edit distance table holds the distances from
+ * the first r characters of the current word to every prefix of the fuzzy word, and
+ * the rows for the characters a word shares with the one before are kept. Once
+ * every entry of a row is over the distance, so is every word with that prefix,
+ * and they are all skipped with one binary search. A row is never more than
+ * length + distance + 1 characters deep, since a longer prefix is too far already.
+ * @param  d          pointer to the dictionary
+ * @param  fuzzy      the fuzzy word, at most QUERY_MAX_FUZZY_LENGTH characters
+ * @param  distance   most edits allowed
+ * @param  words      array of at least max_words words to fill in
+ * @param  max_words  most words to find
+ * @return number of words found
+ */
+static int expand_fuzzy (const struct query_dict* d, const char* fuzzy, int distance, char** words, int max_words) {
+    int rows[(QUERY_MAX_FUZZY_LENGTH + QUERY_MAX_DISTANCE + 2) * (QUERY_MAX_FUZZY_LENGTH + 1)];
+    size_t m = strlen (fuzzy);
+    size_t width = m + 1;
+    for (size_t j = 0; j <= m; j++) {
+        rows[j] = j;
+    }
+
+    // Rows 0 up to depth are those of the first depth characters of prev
+    const char* prev = "";
+    size_t depth = 0;
+
+    int n = 0;
+    uint32_t i = 0;
+    while (i < d->num_words && n < max_words) {
+        char* word = d->word (d->dict, i);
+        size_t r = 0;
+        while (r < depth && word[r] == prev[r]) {
+            r++;
+        }
+        prev = word;
+
+        // Fill in a row for each further character, until the word ends or is too far
+        int pruned = 0;
+        for (; word[r] != '\0'; r++) {
+            const int* above = rows + r * width;
+            int* row = rows + (r + 1) * width;
+            row[0] = r + 1;
+            int least = row[0];
+            for (size_t j = 1; j <= m; j++) {
+                int best = above[j - 1] + (word[r] != fuzzy[j - 1]);
+                best = above[j] + 1 < best ? above[j] + 1 : best;
+                best = row[j - 1] + 1 < best ? row[j - 1] + 1 : best;
+                row[j] = best;
+                least = best < least ? best : least;
+            }
+            if (least > distance) {
+                pruned = 1;
+                r++;
+                break;
+            }
+        }
+        depth = r;
+
+        if (pruned) {
+            i = dict_search (d, i + 1, word, r, 1);
+            continue;
+        }
+        if (rows[r * width + m] <= distance) {
+            words[n++] = word;
+        }
+        i++;
+    }
+    return n;
+}
+
+/**
+ * Finds the words of a sorted dictionary that a wildcard matches. A pattern's
+ * words all start with its part before the first * or ?, which is found by binary
+ * search, so this takes time logarithmic in the size of the dictionary plus the
+ * number of words with that prefix. A fuzzy word is matched by working out the
+ * edit distance a character at a time down the prefixes shared by neighbouring
+ * words, and skipping, with a galloping search, every word that starts with a
+ * prefix already too far from it, rather than comparing it with every word.
+ * @param  d          pointer to the dictionary
+ * @param  w          pointer to the wildcard
+ * @param  words      array of at least max_words words to fill in, in sorted order
+ * @param  max_words  most words to find
+ * @return number of words found
+ */
+int query_dict_expand (const struct query_dict* d, const struct query_wildcard* w, char** words, int max_words) {
+    if (w->distance > 0) {
+        return expand_fuzzy (d, w->pattern, w->distance, words, max_words);
+    }
+    return expand_pattern (d, w->pattern, words, max_words);
+}
+
+/**
+ * Compares two words, for qsort().
+ * @param  a pointer to the first word
+ * @param  b pointer to the second word
+ * @return negative, zero or positive as a sorts before, with or after b
+ */
+static int word_comparator (const void* a, const void* b) {
+    return strcmp (*(char* const*) a, *(char* const*) b);
+}
+
+/**
+ * Sorts words, drops repeats and keeps the first QUERY_MAX_EXPANSIONS, to combine
+ * the expansions of a pattern from several dictionaries.
+ * @param  words      array of words, sorted in place
+ * @param  num_words  number of words
+ * @return number of words kept at the front of the array
+ */
+int query_unique_words (char** words, int num_words) {
+    qsort (words, num_words, sizeof (char*), word_comparator);
+
+    int n = 0;
+    for (int i = 0; i < num_words && n < QUERY_MAX_EXPANSIONS; i++) {
+        if (n == 0 || strcmp (words[n - 1], words[i]) != 0) {
+            words[n++] = words[i];
+        }
+    }
+    return n;
+}
+
+/**
+ * Decides what a wildcard is scored as from the words it matches. A fuzzy word
+ * in FUZZY_BEST mode keeps only its closest word, every other wildcard keeps all
+ * of them, weighted by distance if it is fuzzy.
+ * @param  w          pointer to the wildcard
+ * @param  mode       how fuzzy words are scored
+ * @param  words      the words it matches, in sorted order, the kept words are
+ *                    moved to the front
+ * @param  df         number of documents each word is in, only read for a fuzzy
+ *                    word in FUZZY_BEST mode, which skips words in none
+ * @param  num_words  number of words
+ * @param  weights    array of num_words weights to fill in for the kept words
+ * @return number of words kept
+ */
+int query_select_words (const struct query_wildcard* w, enum fuzzy_mode mode, char** words, const uint64_t* df,
+        int num_words, double* weights) {
+    if (w->distance == 0) {
+        for (int i = 0; i < num_words; i++) {
+            weights[i] = 1;
+        }
+        return num_words;
+    }
+
+    if (mode == FUZZY_EXPAND) {
+        for (int i = 0; i < num_words; i++) {
+            weights[i] = query_fuzzy_weight (query_edit_distance (w->pattern, words[i], w->distance));
+        }
+        return num_words;
+    }
+
+    // The closest word, then the one in most documents, then the first in sorted order
+    int best = -1;
+    int best_distance = 0;
+    for (int i = 0; i < num_words; i++) {
+        if (df[i] == 0) {
+            continue;
+        }
+        int distance = query_edit_distance (w->pattern, words[i], w->distance);
+        if (best < 0 || distance < best_distance || (distance == best_distance && df[i] > df[best])) {
+            best = i;
+            best_distance = distance;
+        }
+    }
+    if (best < 0) {
+        return 0;
+    }
+    words[0] = words[best];
+    weights[0] = 1;
+    return 1;
+}
+
+/**
+ * Turns a node into an OR of words, split in halves so the tree stays shallow.
+ * Takes 2 * (num_words - 1) new nodes.
+ * @param q          pointer to the query, with room for the new nodes
+ * @param target     index of the node to overwrite
+ * @param words      the words
+ * @param num_words  number of words, at least 1
+ */
+static void expand_node (struct query* q, int target, char** words, int num_words) {
+    if (num_words == 1) {
+        q->nodes[target].kind = QUERY_WORD;
+        q->nodes[target].word = words[0];
+        return;
+    }
+
+    int half = num_words / 2;
+    int left = add_node (q, QUERY_WORD, NULL, 0, -1, -1);
+    int right = add_node (q, QUERY_WORD, NULL, 0, -1, -1);
+    expand_node (q, left, words, half);
+    expand_node (q, right, words + half, num_words - half);
+
+    q->nodes[target].kind = QUERY_OR;
+    q->nodes[target].word = NULL;
+    q->nodes[target].left = left;
+    q->nodes[target].right = right;
+}
+
+/**
+ * Replaces a wildcard with the words it matches. The words are added to the
+ * scored terms unless the wildcard is under NOT, and its filter node becomes an
+ * OR of them. The words must outlive the query.
+ * @param q          pointer to the parsed query
+ * @param wildcard   index of the wildcard, expanded only once
+ * @param words      the words it matches, in sorted order
+ * @param weights    weight of each word when scored, or NULL if they count once
+ * @param num_words  number of words, a wildcard with none matches nothing
+ */
+void query_expand (struct query* q, int wildcard, char** words, const double* weights, int num_words) {
+    const struct query_wildcard* w = &q->wildcards[wildcard];
+    if (num_words == 0) {
+        return;
+    }
+
+    if (w->scored) {
+        q->terms = (char**) realloc (q->terms, (q->num_terms + num_words + 1) * sizeof (char*));
+
+        // Check for allocation errors
+        if (q->terms == NULL) {
+            printf("Error: unable to allocate memory for query\n");
+            exit (0);
+        }
+
+        // Weights are only kept once some term has one other than 1
+        int weighted = q->weights != NULL;
+        for (int i = 0; weights != NULL && i < num_words; i++) {
+            weighted |= weights[i] != 1;
+        }
+        if (weighted) {
+            double* grown = (double*) realloc (q->weights, (q->num_terms + num_words + 1) * sizeof (double));
+
+            // Check for allocation errors
+            if (grown == NULL) {
+                printf("Error: unable to allocate memory for query\n");
+                exit (0);
+            }
+
+            for (int j = 0; q->weights == NULL && j < q->num_terms; j++) {
+                grown[j] = 1;
+            }
+            for (int i = 0; i < num_words; i++) {
+                grown[q->num_terms + i] = weights != NULL ? weights[i] : 1;
+            }
+            q->weights = grown;
+        }
+
+        memcpy (q->terms + q->num_terms, words, num_words * sizeof (char*));
+        q->num_terms += num_words;
+    }
+
+    if (w->node >= 0) {
+        q->nodes = (struct query_node*) realloc (q->nodes, (q->num_nodes + 2 * num_words) * sizeof (struct query_node));
+
+        // Check for allocation errors
+        if (q->nodes == NULL) {
+            printf("Error: unable to allocate memory for query\n");
+            exit (0);
+        }
+
+        expand_node (q, w->node, words, num_words);
+    }
+}
+
+/**
+ * Frees the arrays of a parsed query, not the string it points into.
+ * @param q pointer to the query
+ */
+void query_free (struct query* q) {
+    free (q->terms);
+    free (q->weights);
+    free (q->constraint_terms);
+    free (q->constraints);
+    free (q->nodes);
+    free (q->wildcards);
+}
@@ -0,0 +1,85 @@
+/**************************************************************************************
+* Jack Umina
+* Created Nov, 2019
+* Relevance models: tf-idf and BM25.
+***************************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "scoring.h"
+
+/**
+ * Sets up tf-idf scoring, the default.
+ * @param sc pointer to the scoring settings
+ */
+void scoring_init (struct scoring* sc) {
+    sc->model = SCORE_TFIDF;
+    sc->k1 = BM25_DEFAULT_K1;
+    sc->b = BM25_DEFAULT_B;
+    sc->impacts = 0;
+    sc->fuzzy = FUZZY_EXPAND;
+    sc->collection = NULL;
+    sc->weights = NULL;
+}
+
+/**
+ * Parses a model name: tfidf, bm25, or bm25:<k1>,<b>.
+ * @param  sc    pointer to the scoring settings to fill in
+ * @param  spec  the model name
+ * @return 1 if it was understood, 0 otherwise
+ */
+int scoring_parse (struct scoring* sc, const char* spec) {
+    if (strcmp (spec, "tfidf") == 0) {
+        sc->model = SCORE_TFIDF;
+        return 1;
+    }
+    if (strcmp (spec, "bm25") == 0) {
+        sc->model = SCORE_BM25;
+        sc->k1 = BM25_DEFAULT_K1;
+        sc->b = BM25_DEFAULT_B;
+        return 1;
+    }
+
+    double k1, b;
+    char end;
+    if (sscanf (spec, "bm25:%lf,%lf%c", &k1, &b, &end) == 2 && k1 >= 0 && b >= 0 && b <= 1) {
+        sc->model = SCORE_BM25;
+        sc->k1 = k1;
+        sc->b = b;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Computes the idf of a term under the model.
+ * @param  sc        pointer to the scoring settings
+ * @param  df        number of documents containing the term, at least 1
+ * @param  num_docs  number of documents searched
+ * @return the idf
+ */
+double scoring_idf (const struct scoring* sc, uint64_t df, uint64_t num_docs) {
+    double N = num_docs;
+
+    if (sc->model == SCORE_TFIDF) {
+        return log10 (N / df);
+    }
+
+    // Never negative, unlike the original Robertson-Sparck Jones weight
+    return log (1 + (N - df + 0.5) / (df + 0.5));
+}
+
+/**
+ * Prepares the scoring of one query.
+ * @param scorer      pointer to the scorer to fill in
+ * @param sc          pointer to the scoring settings
+ * @param avg_length  average length in tokens of the documents searched
+ */
+void scorer_init (struct scorer* scorer, const struct scoring* sc, double avg_length) {
+    scorer->model = sc->model;
+    scorer->k1_plus_1 = sc->k1 + 1;
+    scorer->norm = sc->k1 * (1 - sc->b);
+    scorer->slope = avg_length > 0 ? sc->k1 * sc->b / avg_length : 0;
+}
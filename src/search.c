@@ -2,70 +2,476 @@
 #include <stdlib.h>
 #include <string.h>
 #include <glob.h>
+#include <unistd.h>
 
 #include "hashtable.h"
 #include "infoRetrieval.h"
+#include "indexfile.h"
+#include "parallelTrain.h"
+#include "qcache.h"
+#include "query.h"
+#include "scoring.h"
+#include "segments.h"
+#include "server.h"
+#include "shards.h"
+#include "sort.h"
+#include "stats.h"
 
-int main (int argc, char** argv) {
-
-	// Check that the number of arguments are correct
-    if (argc != 3) {
-		printf ("Error: Incorrect format of arguments\n");
+/**
+ * Globs p5docs/ for the text files to index.
+ * @param result glob_t to fill in, release with globfree()
+ */
+static void find_docs (glob_t* result) {
+    double start = stats_begin ();
+    if (glob("./p5docs/*.txt", 0, 0, result) != 0) {
+        printf("Error: Problem with glob\n");
         exit (0);
     }
 
-    // Check if second argument is valid number for buckets
-    int num_buckets;
-	// If argv[1] is not a number, atoi() will return 0
-	if ( (num_buckets = atoi (argv[1])) == 0 ) {
-		printf ("Error: number of buckets cannot be 0\n");
+	// Check if glob finds more than 1 file
+	if (result->gl_pathc == 1) {
+		printf ("Error: glob only found 1 matching file\n");
 		exit (0);
 	}
+    stats_end (STATS_GLOB, start);
+}
 
-	// Check if third argument is a valid search query
-	if (strcmp (argv[2], "") == 0) {
-		printf ("Error: search query cannot be empty\n");
+/**
+ * Parses a positive count such as a bucket hint or a number of workers.
+ * @param  arg   command line argument holding the number
+ * @param  what  name of the setting for the error message
+ * @return the number
+ */
+static int parse_count (char* arg, const char* what) {
+    int n;
+
+	// If arg is not a number, atoi() will return 0
+	if ((n = atoi (arg)) <= 0) {
+		printf ("Error: number of %s must be a positive number\n", what);
 		exit (0);
 	}
+    return n;
+}
 
+// Where -S writes the stats when the process exits
+static const char* stats_path = NULL;
+
+/**
+ * Writes the stats collected during the run to stats_path, registered with atexit().
+ */
+static void write_stats (void) {
+    FILE* f = fopen (stats_path, "w");
+    if (f == NULL) {
+        fprintf (stderr, "Error in opening %s\n", stats_path);
+        return;
+    }
+    stats_write (f);
+    fclose (f);
+}
+
+/**
+ * Switches to scoring from the impacts stored in the index, which also fixes the
+ * model to the one they were computed with.
+ * @param set  pointer to the opened index, or NULL if there is none
+ * @param sc   pointer to the scoring settings
+ */
+static void use_impacts (const struct segment_set* set, struct scoring* sc) {
+    if (set == NULL || !segments_impacts (set, sc)) {
+        printf ("Error: -i needs an index built with ./search -i index\n");
+        exit (0);
+    }
+}
+
+/**
+ * Parses a query, exiting if it has too many words and operators to answer.
+ * @param str  the query, split and lowercased in place
+ * @param q    pointer to the query to fill in
+ */
+static void parse_query (char* str, struct query* q) {
+    if (query_parse (str, q) != 0) {
+        printf ("Error: search query has more than %d words and operators\n", QUERY_MAX_NODES);
+        exit (0);
+    }
+}
+
+/**
+ * Checks that phrases and NEAR/k constraints can be answered from the index.
+ * @param set  pointer to the opened index
+ * @param q    pointer to the parsed query
+ */
+static void need_positions (const struct segment_set* set, const struct query* q) {
+    if (q->num_constraints > 0 && !segments_positions (set)) {
+        printf ("Error: phrase queries need an index built with ./search -p index\n");
+        exit (0);
+    }
+}
+
+/**
+ * Prints how much work answering a query took to stderr, for -v.
+ * @param stats  counters of the query's work
+ */
+static void print_query_stats (const struct query_stats* stats) {
+    fprintf (stderr, "%lu documents scored, %lu skipped, %lu of %lu postings decoded\n",
+            (unsigned long) stats->docs_scored, (unsigned long) stats->docs_pruned,
+            (unsigned long) stats->postings_decoded, (unsigned long) stats->postings_total);
+}
+
+/**
+ * Globs p5docs/ and trains a new hashtable on it.
+ * @param  num_buckets  initial bucket hint
+ * @param  num_workers  number of training threads, 1 trains on the calling thread
+ * @param  positions    non-zero to also record where each word occurs
+ * @return pointer to the trained hashtable
+ */
+static struct hashtable* build (int num_buckets, int num_workers, int positions) {
 	// Glob for text files
     glob_t result;
+    find_docs (&result);
 
-    if (glob("./p5docs/*.txt", 0, 0, &result) != 0) {
-        printf("Error: Problem with glob\n");
+    // Create the data structure and train it
+    struct hashtable* ht = train_files (result.gl_pathv, result.gl_pathc, num_buckets, num_workers, positions);
+	globfree (&result);
+
+    return ht;
+}
+
+/**
+ * Usage:
+ *   ./search [-j workers] [-m model -i] [-p] index [num_buckets]
+ *                                                 train on p5docs/ and save the index to search.idx
+ *   ./search [-j workers] [-m model -i] [-p] update [num_buckets]
+ *                                                 index new and changed files in a new segment,
+ *                                                 tombstone changed and removed ones
+ *   ./search merge                                merge every segment, dropping deleted documents
+ *   ./search verify                               check search.idx and its segments against their checksums
+ *   ./search [-j workers] [-k results | -a] [-m model | -i] [-f fuzzy] [-o output] [-v] [num_buckets] <query>
+ *                                                 answer a query, from search.idx when it exists
+ *   ./search [-j workers] [-k results | -a] [-m model | -i] [-f fuzzy] [-p] [-s socket] [-t threads] [-c megabytes] serve [num_buckets]
+ *                                                 answer queries from stdin, or from socket clients
+ *   ./search -n shards [-j workers] [-p] index [num_buckets]
+ *   ./search -n shards [-k results | -a] [-m model] [-f fuzzy] [-o output] [-v] <query>
+ *   ./search -n shards [-k results | -a] [-m model] [-f fuzzy] [-s socket] [-t threads] [-c megabytes] serve
+ *                                                 the same, split across that many shard processes
+ * A query may use "phrases", NEAR/k, AND, OR, NOT, parentheses, wildcards and fuzzy~
+ * words, see query.h.
+ * -j trains with that many threads.
+ * -m scores with tfidf (default), bm25, or bm25:<k1>,<b> (default 1.2,0.75).
+ * -i when indexing, also stores each posting's -m score quantized to a byte. When
+ *    querying, sums those instead of scoring, with the model the index was built with.
+ * -f scores a fuzzy~ word as every word close to it, weighted by distance (expand,
+ *    the default), or as the closest word only (best).
+ * -p when indexing, also stores where each word occurs, for "quoted phrases" and
+ *    NEAR/k in queries. The serve command trains with positions too when there is
+ *    no index, and a query without an index does whenever it needs them.
+ * -k writes the top results to search_scores.txt (default 10), -a writes every document.
+ * -o prints the best document and writes search_scores.txt (all, the default), only
+ *    one of them (doc or scores), or neither (none), for timing queries.
+ * -n splits the index into search.idx.shard0 onwards, each answered by its own process,
+ *    with the same scores and ranking as one index. Impacts cannot be sharded.
+ * -v prints how many documents were scored and skipped to stderr.
+ * -s serves clients of a Unix domain socket instead of stdin, on -t threads (default 4).
+ * -c caches up to that many megabytes of answers when serving (default 64), 0 turns it off.
+ * -S writes the time spent in each phase as JSON to that file when the program exits,
+ *    with hashtable, postings and I/O counters too in a make STATS=1 build.
+ */
+int main (int argc, char** argv) {
+    int num_workers = 1;
+    int num_results = RANK_DEFAULT_K;
+    int num_threads = SERVER_DEFAULT_THREADS;
+    char* socket_path = NULL;
+    int verbose = 0;
+    int positions = 0;
+    int num_shards = 0;
+    size_t cache_mb = QCACHE_DEFAULT_BUDGET >> 20;
+    struct scoring sc;
+    int opt;
+
+    scoring_init (&sc);
+
+    // Options come before the positional arguments
+    while ((opt = getopt (argc, argv, "+j:k:am:if:pn:o:s:t:c:vS:")) != -1) {
+        switch (opt) {
+            case 'j':
+                num_workers = parse_count (optarg, "workers");
+                break;
+            case 'k':
+                num_results = parse_count (optarg, "results");
+                break;
+            case 'a':
+                num_results = 0;
+                break;
+            case 'm':
+                if (!scoring_parse (&sc, optarg)) {
+                    printf ("Error: scoring model must be tfidf, bm25 or bm25:<k1>,<b>\n");
+                    exit (0);
+                }
+                break;
+            case 'i':
+                sc.impacts = 1;
+                break;
+            case 'f':
+                if (strcmp (optarg, "expand") == 0) {
+                    sc.fuzzy = FUZZY_EXPAND;
+                } else if (strcmp (optarg, "best") == 0) {
+                    sc.fuzzy = FUZZY_BEST;
+                } else {
+                    printf ("Error: fuzzy matching must be expand or best\n");
+                    exit (0);
+                }
+                break;
+            case 'p':
+                positions = 1;
+                break;
+            case 'n':
+                num_shards = parse_count (optarg, "shards");
+                break;
+            case 'o':
+                if (strcmp (optarg, "all") == 0) {
+                    output_select (OUTPUT_ALL);
+                } else if (strcmp (optarg, "doc") == 0) {
+                    output_select (OUTPUT_DOCUMENT);
+                } else if (strcmp (optarg, "scores") == 0) {
+                    output_select (OUTPUT_SCORES);
+                } else if (strcmp (optarg, "none") == 0) {
+                    output_select (0);
+                } else {
+                    printf ("Error: output must be all, doc, scores or none\n");
+                    exit (0);
+                }
+                break;
+            case 's':
+                socket_path = optarg;
+                break;
+            case 't':
+                num_threads = parse_count (optarg, "threads");
+                break;
+            case 'c':
+                // 0 turns the cache off, so it cannot go through parse_count()
+                if (strcmp (optarg, "0") == 0) {
+                    cache_mb = 0;
+                } else {
+                    cache_mb = parse_count (optarg, "cache megabytes");
+                }
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            case 'S':
+                stats_path = optarg;
+                stats_enable ();
+                atexit (write_stats);
+                break;
+            default:
+                printf ("Error: Incorrect format of arguments\n");
+                exit (0);
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
+	// Check that the number of arguments are correct
+    if (argc != 2 && argc != 3) {
+		printf ("Error: Incorrect format of arguments\n");
         exit (0);
     }
 
-	// Check if glob finds more than 1 file
-	if (result.gl_pathc == 1) {
-		printf ("Error: glob only found 1 matching file\n");
+    // The bucket count is only a sizing hint now, the hashtable grows as needed
+    int num_buckets = HT_DEFAULT_BUCKETS;
+
+    // Impacts are quantized with each index's own statistics, which a shard lacks
+    if (num_shards > 0 && sc.impacts) {
+        printf ("Error: -i cannot be used with -n\n");
+        exit (0);
+    }
+    if (num_shards > 0 && (strcmp (argv[1], "update") == 0 || strcmp (argv[1], "merge") == 0
+            || strcmp (argv[1], "verify") == 0)) {
+        printf ("Error: -n only works with index, serve and queries\n");
+        exit (0);
+    }
+
+    // Sharded build step: train each shard on its range of the files
+    if (num_shards > 0 && strcmp (argv[1], "index") == 0) {
+        if (argc == 3) {
+            num_buckets = parse_count (argv[2], "buckets");
+        }
+
+        glob_t result;
+        find_docs (&result);
+        shards_build (INDEX_FILE, result.gl_pathv, result.gl_pathc, num_shards, num_buckets, num_workers,
+                positions);
+        globfree (&result);
+        return 0;
+    }
+
+    // Build step: train once and write the index as a single segment
+    if (strcmp (argv[1], "index") == 0) {
+        if (argc == 3) {
+            num_buckets = parse_count (argv[2], "buckets");
+        }
+
+        struct hashtable* ht = build (num_buckets, num_workers, positions);
+        segments_rebuild (INDEX_FILE, ht, sc.impacts ? &sc : NULL);
+        ht_destroy (ht);
+        return 0;
+    }
+
+    // Incremental step: only train the files that are new or changed
+    if (strcmp (argv[1], "update") == 0) {
+        if (argc == 3) {
+            num_buckets = parse_count (argv[2], "buckets");
+        }
+
+        struct segment_set* set = segments_open (INDEX_FILE, 0);
+        if (set == NULL) {
+            set = segments_create (0);
+        }
+
+        glob_t result;
+        find_docs (&result);
+        segments_update (set, INDEX_FILE, result.gl_pathv, result.gl_pathc, num_buckets, num_workers,
+                sc.impacts ? &sc : NULL, positions);
+        globfree (&result);
+
+        segments_close (set);
+        return 0;
+    }
+
+    if (argc == 2 && strcmp (argv[1], "merge") == 0) {
+        struct segment_set* set = segments_open (INDEX_FILE, 0);
+        if (set == NULL) {
+            printf ("Error: %s does not exist\n", INDEX_FILE);
+            exit (0);
+        }
+        segments_merge (set, INDEX_FILE);
+        printf ("%s: %d segments, %u documents\n", INDEX_FILE, set->num_segments, set->num_live);
+        segments_close (set);
+        return 0;
+    }
+
+    // Server: load or build the index once, then answer queries until stdin ends
+    if (strcmp (argv[1], "serve") == 0) {
+        if (argc == 3) {
+            num_buckets = parse_count (argv[2], "buckets");
+        }
+
+        struct server s;
+        server_init (&s, num_shards > 0 ? NULL : INDEX_FILE, num_results, &sc, cache_mb << 20);
+        if (sc.impacts) {
+            use_impacts (s.segs, &s.scoring);
+        }
+        if (num_shards > 0) {
+            s.shards = shards_start (INDEX_FILE, num_shards, &sc);
+        } else if (s.segs == NULL) {
+            // Every query reads the idfs and postings laid out here, a single query
+            // below just computes the idfs of its own terms
+            s.ht = build (num_buckets, num_workers, positions);
+            ht_freeze (s.ht);
+            ht_freeze_postings (s.ht);
+            finalize_stats (s.ht, &s.scoring);
+        }
+
+        if (socket_path != NULL) {
+            serve_socket (&s, socket_path, num_threads);
+        }
+
+        struct server_stats stats = {0, 0, 0};
+        serve_stream (&s, stdin, stdout, &stats);
+        server_print_stats (&s, "stdin", &stats);
+
+        server_destroy (&s);
+        return 0;
+    }
+
+    // Integrity check of an existing index
+    if (argc == 2 && strcmp (argv[1], "verify") == 0) {
+        struct segment_set* set = segments_open (INDEX_FILE, 1);
+        if (set == NULL) {
+            printf ("Error: %s does not exist\n", INDEX_FILE);
+            exit (0);
+        }
+        printf ("%s: %d segments, %u documents, %u deleted, OK\n", INDEX_FILE,
+                set->num_segments, set->num_live, set->num_docs - set->num_live);
+        segments_close (set);
+        return 0;
+    }
+
+    char* query = argv[argc - 1];
+
+    if (argc == 3) {
+        num_buckets = parse_count (argv[1], "buckets");
+    }
+
+	// Check if last argument is a valid search query
+	if (strcmp (query, "") == 0) {
+		printf ("Error: search query cannot be empty\n");
 		exit (0);
 	}
 
-    // Create the data structure
-    struct hashtable* ht = ht_create (num_buckets);
+    // Shards parse the query themselves, so hand them the string as typed
+    if (num_shards > 0) {
+        struct shard_pool* pool = shards_start (INDEX_FILE, num_shards, &sc);
 
-    ht->docIDs = result.gl_pathv;
-    ht->num_docs = result.gl_pathc;
+        // Parse a copy, only to check that the shards can answer it
+        char* copy = strdup (query);
 
-    int* query_len = (int*) malloc (sizeof (int));
+        // Check for allocation errors
+        if (copy == NULL) {
+            printf ("Error: unable to allocate memory for query\n");
+            exit (0);
+        }
 
-    // Check for allocation errors
-    if (query_len == NULL) {
-        printf("Error: unable to allocate memory for query_len\n");
-        exit (0);
+        struct query q;
+        parse_query (copy, &q);
+        if (q.num_constraints > 0 && !pool->positions) {
+            printf ("Error: phrase queries need an index built with ./search -n %d -p index\n", num_shards);
+            exit (0);
+        }
+        query_free (&q);
+        free (copy);
+
+        struct query_stats stats;
+        memset (&stats, 0, sizeof (stats));
+        shards_rank (pool, query, num_results, &stats);
+        if (verbose) {
+            print_query_stats (&stats);
+        }
+        shards_stop (pool);
+        return 0;
+    }
+
+	// Split the str provided into search terms, phrases and NEAR/k constraints
+    struct query q;
+    parse_query (query, &q);
+
+    // Answer straight from the index when one has been built
+    struct segment_set* set = segments_open (INDEX_FILE, 0);
+    if (sc.impacts) {
+        use_impacts (set, &sc);
     }
+    if (set != NULL) {
+        need_positions (set, &q);
+        segments_expand_query (set, &sc, &q);
 
-	// Split the str provided into an array of strings
-    char** search_query = read_query (argv[2], query_len);
+        struct query_stats stats;
+        memset (&stats, 0, sizeof (stats));
+        segments_rank (set, &sc, &q, num_results, &stats);
+        if (verbose) {
+            print_query_stats (&stats);
+        }
+        segments_close (set);
+        query_free (&q);
+        return 0;
+    }
 
-	// Train the hashtable, then rank the files based on the query
-    train (ht);
-    rank (ht, search_query, *query_len);
+	// Train the hashtable, with positions if the query needs them, then rank the files
+    struct hashtable* ht = build (num_buckets, num_workers, positions || q.num_constraints > 0);
+    if (q.num_wildcards > 0) {
+        ht_freeze (ht);
+        expand_query (ht, &sc, &q);
+    }
+    rank (ht, &sc, &q, num_results);
 
 	// Deallocate memory
 	ht_destroy (ht);
-	free (search_query);
-	free (query_len);
-	globfree (&result);
+	query_free (&q);
 }
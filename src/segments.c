@@ -0,0 +1,1256 @@
+/**************************************************************************************
+* Jack Umina
+* Created Nov, 2019
+* An index made of immutable segments, with tombstones for deleted documents and
+* statistics summed over the segments at query time.
+***************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "hashtable.h"
+#include "infoRetrieval.h"
+#include "indexfile.h"
+#include "parallelTrain.h"
+#include "segments.h"
+#include "maxscore.h"
+#include "match.h"
+#include "sort.h"
+#include "stats.h"
+
+/**
+ * Builds the file name of a segment.
+ * @param buf   buffer to write the name to
+ * @param size  size of buf
+ * @param path  name of the manifest
+ * @param id    id of the segment
+ */
+static void segment_path (char* buf, size_t size, const char* path, uint32_t id) {
+    snprintf (buf, size, "%s.%u", path, id);
+}
+
+/**
+ * Number of 64-bit words in the tombstone bitmap of a segment.
+ * @param  num_docs number of documents in the segment
+ * @return size of the bitmap in words
+ */
+static size_t bitmap_words (uint32_t num_docs) {
+    return (num_docs + 63) / 64;
+}
+
+/**
+ * Recomputes each segment's base, the document counts and the document table
+ * after segments were added or removed.
+ * @param set pointer to the set
+ */
+static void segments_refresh (struct segment_set* set) {
+    set->num_docs = 0;
+    set->num_live = 0;
+    set->live_length = 0;
+    for (int s = 0; s < set->num_segments; s++) {
+        set->segs[s].base = set->num_docs;
+        set->num_docs += set->segs[s].idx->header->num_docs;
+        set->num_live += set->segs[s].idx->header->num_docs - set->segs[s].num_deleted;
+    }
+
+    free (set->docs);
+    free (set->lengths);
+    set->docs = (struct document*) malloc ((set->num_docs + 1) * sizeof (struct document));
+    set->lengths = (uint32_t*) malloc ((set->num_docs + 1) * sizeof (uint32_t));
+
+    // Check for allocation errors
+    if (set->docs == NULL || set->lengths == NULL) {
+        printf("Error: unable to allocate memory for document table\n");
+        exit (0);
+    }
+
+    for (int s = 0; s < set->num_segments; s++) {
+        const struct segment* seg = &set->segs[s];
+        memcpy (set->docs + seg->base, seg->idx->docs, seg->idx->header->num_docs * sizeof (struct document));
+
+        for (uint32_t i = 0; i < seg->idx->header->num_docs; i++) {
+            set->lengths[seg->base + i] = seg->idx->docs[i].length;
+            if (!segment_is_deleted (seg, i)) {
+                set->live_length += seg->idx->docs[i].length;
+            }
+        }
+    }
+}
+
+/**
+ * Finds the segment holding a document.
+ * @param  set  pointer to the set
+ * @param  doc  number of the document across the set
+ * @return index of the segment in set->segs
+ */
+static int segment_of (const struct segment_set* set, uint32_t doc) {
+    int s = set->num_segments - 1;
+    while (s > 0 && set->segs[s].base > doc) {
+        s--;
+    }
+    return s;
+}
+
+/**
+ * Creates a set with no segments.
+ * @param  next_id  id for the first segment added, ids are never reused
+ * @return pointer to the set
+ */
+struct segment_set* segments_create (uint32_t next_id) {
+    struct segment_set* set = (struct segment_set*) calloc (1, sizeof (struct segment_set));
+
+    // Check for allocation errors
+    if (set == NULL) {
+        printf("Error: unable to allocate memory for segment_set\n");
+        exit (0);
+    }
+
+    set->next_id = next_id;
+    segments_refresh (set);
+    return set;
+}
+
+/**
+ * Reads the manifest and checks that it is intact.
+ * @param  path  name of the manifest
+ * @return the manifest, starting with its manifest_header, or NULL if it does not
+ *         exist. Free it when done.
+ */
+static char* read_manifest (const char* path) {
+    FILE* f = fopen (path, "rb");
+    if (f == NULL) {
+        if (errno == ENOENT) {
+            return NULL;
+        }
+        printf("Error in opening %s: %s\n", path, strerror (errno));
+        exit (0);
+    }
+
+    struct stat st;
+    if (fstat (fileno (f), &st) != 0) {
+        printf("Error in reading %s: %s\n", path, strerror (errno));
+        exit (0);
+    }
+
+    size_t size = st.st_size;
+    char* buf = (char*) malloc (size + 1);
+
+    // Check for allocation errors
+    if (buf == NULL) {
+        printf("Error: unable to allocate memory for manifest\n");
+        exit (0);
+    }
+
+    if (fread (buf, 1, size, f) != size) {
+        printf("Error in reading %s: %s\n", path, strerror (errno));
+        exit (0);
+    }
+    fclose (f);
+
+    // Check that this is a manifest of our version and that it is intact
+    struct manifest_header* header = (struct manifest_header*) buf;
+    if (size < sizeof (*header) || memcmp (header->magic, MANIFEST_MAGIC, sizeof (MANIFEST_MAGIC)) != 0) {
+        printf("Error: %s is not an index manifest. Rebuild it with ./search index\n", path);
+        exit (0);
+    }
+    if (header->version != MANIFEST_VERSION) {
+        printf("Error: %s has version %u, expected %d. Rebuild it with ./search index\n",
+                path, header->version, MANIFEST_VERSION);
+        exit (0);
+    }
+
+    uint64_t checksum = header->checksum;
+    header->checksum = 0;
+    if (checksum != hash_code (buf, size)) {
+        printf("Error: %s is corrupt\n", path);
+        exit (0);
+    }
+
+    struct manifest_segment* entries = (struct manifest_segment*) (buf + sizeof (*header));
+    size_t expected = sizeof (*header) + header->num_segments * sizeof (struct manifest_segment);
+    if (expected <= size) {
+        for (uint32_t s = 0; s < header->num_segments; s++) {
+            expected += bitmap_words (entries[s].num_docs) * sizeof (uint64_t);
+        }
+    }
+    if (expected != size) {
+        printf("Error: %s is truncated\n", path);
+        exit (0);
+    }
+    return buf;
+}
+
+/**
+ * Reads the manifest and maps every segment it lists.
+ * @param  path    name of the manifest, segment files are named <path>.<id>
+ * @param  verify  when non-zero, also checksum the body of every segment
+ * @return pointer to the set, or NULL if the manifest does not exist
+ */
+struct segment_set* segments_open (const char* path, int verify) {
+    char* buf = read_manifest (path);
+    if (buf == NULL) {
+        return NULL;
+    }
+
+    struct manifest_header* header = (struct manifest_header*) buf;
+    struct manifest_segment* entries = (struct manifest_segment*) (buf + sizeof (*header));
+    struct segment_set* set = segments_create (header->next_id);
+    set->segs = (struct segment*) malloc ((header->num_segments + 1) * sizeof (struct segment));
+
+    // Check for allocation errors
+    if (set->segs == NULL) {
+        printf("Error: unable to allocate memory for segments\n");
+        exit (0);
+    }
+
+    const uint64_t* bitmaps = (const uint64_t*) (entries + header->num_segments);
+    for (uint32_t s = 0; s < header->num_segments; s++) {
+        struct segment* seg = &set->segs[s];
+        char seg_path[strlen (path) + 16];
+        segment_path (seg_path, sizeof (seg_path), path, entries[s].id);
+
+        seg->id = entries[s].id;
+        seg->idx = index_open (seg_path, verify);
+        if (seg->idx == NULL || seg->idx->header->num_docs != entries[s].num_docs) {
+            printf("Error: segment %s is missing or does not match %s\n", seg_path, path);
+            exit (0);
+        }
+
+        size_t words = bitmap_words (entries[s].num_docs);
+        seg->deleted = (uint64_t*) malloc ((words + 1) * sizeof (uint64_t));
+
+        // Check for allocation errors
+        if (seg->deleted == NULL) {
+            printf("Error: unable to allocate memory for tombstones\n");
+            exit (0);
+        }
+
+        memcpy (seg->deleted, bitmaps, words * sizeof (uint64_t));
+        seg->num_deleted = entries[s].num_deleted;
+        bitmaps += words;
+        set->num_segments++;
+    }
+
+    free (buf);
+    segments_refresh (set);
+    return set;
+}
+
+/**
+ * Unmaps the segments and frees the set.
+ * @param set pointer to the set
+ */
+void segments_close (struct segment_set* set) {
+    for (int s = 0; s < set->num_segments; s++) {
+        index_close (set->segs[s].idx);
+        free (set->segs[s].deleted);
+    }
+    free (set->segs);
+    free (set->docs);
+    free (set->lengths);
+    free (set);
+}
+
+/**
+ * Writes a trained hashtable as a new segment and appends it to the set.
+ * The manifest is not written until segments_commit().
+ * @param set      pointer to the set
+ * @param path     name of the manifest
+ * @param ht       pointer to the trained hashtable
+ * @param impacts  model to precompute the segment's impacts with, or NULL for none
+ */
+void segments_add (struct segment_set* set, const char* path, struct hashtable* ht,
+        const struct scoring* impacts) {
+    char seg_path[strlen (path) + 16];
+    uint32_t id = set->next_id++;
+    segment_path (seg_path, sizeof (seg_path), path, id);
+
+    index_write (ht, seg_path, impacts);
+
+    set->segs = (struct segment*) realloc (set->segs, (set->num_segments + 1) * sizeof (struct segment));
+
+    // Check for allocation errors
+    if (set->segs == NULL) {
+        printf("Error: unable to allocate memory for segments\n");
+        exit (0);
+    }
+
+    struct segment* seg = &set->segs[set->num_segments];
+    seg->id = id;
+    seg->idx = index_open (seg_path, 0);
+    seg->deleted = (uint64_t*) calloc (bitmap_words (ht->num_docs) + 1, sizeof (uint64_t));
+    seg->num_deleted = 0;
+
+    // Check for allocation errors
+    if (seg->deleted == NULL) {
+        printf("Error: unable to allocate memory for tombstones\n");
+        exit (0);
+    }
+
+    set->num_segments++;
+    segments_refresh (set);
+}
+
+/**
+ * Marks a document deleted. Takes effect on disk at the next segments_commit().
+ * @param set  pointer to the set
+ * @param doc  number of the document across the set
+ */
+void segments_delete (struct segment_set* set, uint32_t doc) {
+    struct segment* seg = &set->segs[segment_of (set, doc)];
+    uint32_t i = doc - seg->base;
+
+    if (!segment_is_deleted (seg, i)) {
+        seg->deleted[i / 64] |= (uint64_t) 1 << (i % 64);
+        seg->num_deleted++;
+        set->num_live--;
+        set->live_length -= set->lengths[doc];
+    }
+}
+
+/**
+ * Checks whether a document has been deleted.
+ * @param  set  pointer to the set
+ * @param  doc  number of the document across the set
+ * @return 1 if it is deleted, 0 if it is live
+ */
+int segments_is_deleted (const struct segment_set* set, uint32_t doc) {
+    const struct segment* seg = &set->segs[segment_of (set, doc)];
+    return segment_is_deleted (seg, doc - seg->base);
+}
+
+/**
+ * Atomically replaces the manifest with the current state of the set.
+ * @param set   pointer to the set
+ * @param path  name of the manifest
+ */
+void segments_commit (struct segment_set* set, const char* path) {
+    size_t size = sizeof (struct manifest_header) + set->num_segments * sizeof (struct manifest_segment);
+    for (int s = 0; s < set->num_segments; s++) {
+        size += bitmap_words (set->segs[s].idx->header->num_docs) * sizeof (uint64_t);
+    }
+
+    char* buf = (char*) calloc (1, size);
+
+    // Check for allocation errors
+    if (buf == NULL) {
+        printf("Error: unable to allocate memory for manifest\n");
+        exit (0);
+    }
+
+    struct manifest_header* header = (struct manifest_header*) buf;
+    memcpy (header->magic, MANIFEST_MAGIC, sizeof (MANIFEST_MAGIC));
+    header->version = MANIFEST_VERSION;
+    header->num_segments = set->num_segments;
+    header->next_id = set->next_id;
+
+    struct manifest_segment* entries = (struct manifest_segment*) (buf + sizeof (*header));
+    uint64_t* bitmaps = (uint64_t*) (entries + set->num_segments);
+    for (int s = 0; s < set->num_segments; s++) {
+        uint32_t num_docs = set->segs[s].idx->header->num_docs;
+        entries[s].id = set->segs[s].id;
+        entries[s].num_docs = num_docs;
+        entries[s].num_deleted = set->segs[s].num_deleted;
+
+        memcpy (bitmaps, set->segs[s].deleted, bitmap_words (num_docs) * sizeof (uint64_t));
+        bitmaps += bitmap_words (num_docs);
+    }
+    header->checksum = hash_code (buf, size);
+
+    // Write to a temporary file, then atomically replace the old manifest
+    char tmp_path[strlen (path) + 5];
+    sprintf (tmp_path, "%s.tmp", path);
+
+    FILE* f = fopen (tmp_path, "wb");
+    if (f == NULL) {
+        printf("Error in opening %s: %s\n", tmp_path, strerror (errno));
+        exit (0);
+    }
+    if (fwrite (buf, 1, size, f) != size || fclose (f) != 0) {
+        printf("Error in writing %s: %s\n", tmp_path, strerror (errno));
+        exit (0);
+    }
+    if (rename (tmp_path, path) != 0) {
+        printf("Error in renaming %s: %s\n", tmp_path, strerror (errno));
+        exit (0);
+    }
+
+    free (buf);
+}
+
+/**
+ * Deletes the segment files of a set, used once a new manifest no longer lists them.
+ * @param set   pointer to the set
+ * @param path  name of the manifest
+ */
+void segments_remove_files (const struct segment_set* set, const char* path) {
+    for (int s = 0; s < set->num_segments; s++) {
+        char seg_path[strlen (path) + 16];
+        segment_path (seg_path, sizeof (seg_path), path, set->segs[s].id);
+        unlink (seg_path);
+    }
+}
+
+/**
+ * Finds the model the set's impacts were computed with. An index keeps the impact
+ * settings it was built with, new segments get the same ones.
+ * @param  set  pointer to the set
+ * @param  sc   pointer to the scoring settings to fill in
+ * @return 1 if every segment has impacts, 0 if any has none
+ */
+int segments_impacts (const struct segment_set* set, struct scoring* sc) {
+    if (set->num_segments == 0) {
+        return 0;
+    }
+    for (int s = 1; s < set->num_segments; s++) {
+        if (!set->segs[s].idx->header->impacts) {
+            return 0;
+        }
+    }
+    return index_impacts (set->segs[0].idx, sc);
+}
+
+/**
+ * Checks whether phrase queries can be answered from the set.
+ * @param  set  pointer to the set
+ * @return 1 if every segment has positions, 0 if any has none or there are none
+ */
+int segments_positions (const struct segment_set* set) {
+    if (set->num_segments == 0) {
+        return 0;
+    }
+    for (int s = 0; s < set->num_segments; s++) {
+        if (set->segs[s].idx->positions == NULL) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Average length of the live documents, for BM25 length normalization. A shard
+ * uses the average over the whole collection instead.
+ * @param  set  pointer to the set
+ * @param  sc   pointer to the scoring settings
+ * @return average length in tokens, 0 when there are no live documents
+ */
+double segments_avg_length (const struct segment_set* set, const struct scoring* sc) {
+    if (sc->collection != NULL) {
+        const struct collection_stats* cs = sc->collection;
+        return cs->num_docs > 0 ? (double) cs->total_length / cs->num_docs : 0;
+    }
+    return set->num_live > 0 ? (double) set->live_length / set->num_live : 0;
+}
+
+/**
+ * Replaces the index with a single segment trained from a hashtable. Only the old
+ * manifest is read, not its segments, so an index written by an older version of
+ * the file format is replaced too. The old segment files are removed once the new
+ * manifest is in place.
+ * @param path     name of the manifest
+ * @param ht       pointer to the trained hashtable
+ * @param impacts  model to precompute the segment's impacts with, or NULL for none
+ */
+void segments_rebuild (const char* path, struct hashtable* ht, const struct scoring* impacts) {
+    char* old = read_manifest (path);
+    const struct manifest_header* header = (const struct manifest_header*) old;
+
+    // Segment ids are never reused
+    struct segment_set* set = segments_create (old == NULL ? 0 : header->next_id);
+    segments_add (set, path, ht, impacts);
+    segments_commit (set, path);
+
+    // The new manifest no longer lists the old segments
+    if (old != NULL) {
+        const struct manifest_segment* entries = (const struct manifest_segment*) (old + sizeof (*header));
+        for (uint32_t s = 0; s < header->num_segments; s++) {
+            char seg_path[strlen (path) + 16];
+            segment_path (seg_path, sizeof (seg_path), path, entries[s].id);
+            unlink (seg_path);
+        }
+    }
+
+    segments_close (set);
+    free (old);
+}
+
+/**
+ * Merges every segment into one new segment without the deleted documents,
+ * commits the manifest and removes the old segment files. The new segment keeps
+ * the impacts and positions of the old ones.
+ * @param set   pointer to the set
+ * @param path  name of the manifest
+ */
+void segments_merge (struct segment_set* set, const char* path) {
+    if (set->num_segments == 0 || (set->num_segments == 1 && set->segs[0].num_deleted == 0)) {
+        return;
+    }
+
+    // Impacts are recomputed from the merged segment's statistics
+    // segments_impacts() only fills in the model, the rest keeps its defaults
+    struct scoring impacts;
+    scoring_init (&impacts);
+    int has_impacts = segments_impacts (set, &impacts);
+
+    struct hashtable* ht = ht_create (HT_DEFAULT_BUCKETS);
+    ht->positions = segments_positions (set);
+    ht->num_docs = set->num_live;
+    ht->docs = (struct document*) malloc ((set->num_live + 1) * sizeof (struct document));
+    uint32_t* remap = (uint32_t*) malloc ((set->num_docs + 1) * sizeof (uint32_t));
+
+    // Check for allocation errors
+    if (ht->docs == NULL || remap == NULL) {
+        printf("Error: unable to allocate memory for merge\n");
+        exit (0);
+    }
+
+    // Live documents keep their order and are numbered densely
+    uint32_t next = 0;
+    for (uint32_t doc = 0; doc < set->num_docs; doc++) {
+        if (segments_is_deleted (set, doc)) {
+            continue;
+        }
+        ht->docs[next].path = strdup (set->docs[doc].path);
+
+        // Check for allocation errors
+        if (ht->docs[next].path == NULL) {
+            printf("Error: unable to allocate memory for document path\n");
+            exit (0);
+        }
+
+        ht->docs[next].mtime = set->docs[doc].mtime;
+        ht->docs[next].length = set->docs[doc].length;
+        remap[doc] = next++;
+    }
+
+    // Segments are visited in order, so every word's postings are appended in
+    // increasing order of the new document numbers
+    for (int s = 0; s < set->num_segments; s++) {
+        const struct segment* seg = &set->segs[s];
+        const struct index_file* idx = seg->idx;
+
+        for (uint32_t i = 0; i < idx->header->num_slots; i++) {
+            const struct index_term* term = &idx->slots[i];
+            if (term->df == 0) {
+                continue;
+            }
+
+            struct wordNode* wordPtr = NULL;
+            struct postings_cursor cur;
+            struct positions_cursor positions;
+            postings_open_bytes (&cur, idx->postings + term->postings_offset, term->df);
+            if (ht->positions) {
+                positions_open_bytes (&positions, idx->positions + term->positions_offset);
+            }
+            while (postings_next (&cur)) {
+                if (segment_is_deleted (seg, cur.doc)) {
+                    if (ht->positions) {
+                        positions_skip (&positions, cur.tf);
+                    }
+                    continue;
+                }
+
+                // Words whose documents were all deleted are dropped
+                if (wordPtr == NULL) {
+                    wordPtr = ht_add_word (ht, idx->strings + term->word_offset, term->word_len, term->hash);
+                }
+                uint32_t doc = remap[seg->base + cur.doc];
+                postings_append (&ht->postings, &wordPtr->postings, doc, cur.tf);
+                wordPtr->df++;
+                if (ht->positions) {
+                    positions_copy (&ht->postings, wordPtr->positions, doc, &positions, cur.tf);
+                }
+            }
+        }
+    }
+    free (remap);
+
+    // Swap in the merged segment, then drop the old ones
+    struct segment_set old = *set;
+    set->segs = NULL;
+    set->num_segments = 0;
+    set->docs = NULL;
+    set->lengths = NULL;
+    if (ht->num_docs > 0) {
+        segments_add (set, path, ht, has_impacts ? &impacts : NULL);
+    } else {
+        segments_refresh (set);
+    }
+    ht_destroy (ht);
+
+    segments_commit (set, path);
+    segments_remove_files (&old, path);
+
+    for (int s = 0; s < old.num_segments; s++) {
+        index_close (old.segs[s].idx);
+        free (old.segs[s].deleted);
+    }
+    free (old.segs);
+    free (old.docs);
+    free (old.lengths);
+}
+
+/**
+ * Compares two strings through pointers to them, for bsearch() over a path array.
+ * @param  a pointer to the first char*
+ * @param  b pointer to the second char*
+ * @return strcmp() of the two strings
+ */
+static int path_comparator (const void* a, const void* b) {
+    return strcmp (*(char* const*) a, *(char* const*) b);
+}
+
+/**
+ * Brings the set up to date with the given files: files that are new or whose
+ * modification time changed are trained into a new segment, and the old copies of
+ * changed or missing files are tombstoned. Commits the manifest, then merges if
+ * there are more than SEGMENTS_MAX segments.
+ * @param set          pointer to the set
+ * @param path         name of the manifest
+ * @param paths        sorted array of the file paths that should be indexed
+ * @param num_paths    number of paths
+ * @param num_buckets  initial bucket hint for training
+ * @param num_workers  number of training threads
+ * @param impacts      model to precompute impacts with when the set has no segments
+ *                     yet, or NULL for none. Otherwise the set's own settings are kept.
+ * @param positions    non-zero to store positions when the set has no segments yet,
+ *                     otherwise new segments store them if the set's segments do
+ */
+void segments_update (struct segment_set* set, const char* path, char** paths, int num_paths,
+        int num_buckets, int num_workers, const struct scoring* impacts, int positions) {
+    struct scoring existing;
+    scoring_init (&existing);
+    if (set->num_segments > 0) {
+        impacts = segments_impacts (set, &existing) ? &existing : NULL;
+        positions = segments_positions (set);
+    }
+
+    char* indexed = (char*) calloc (num_paths + 1, sizeof (char));
+    char** fresh = (char**) malloc ((num_paths + 1) * sizeof (char*));
+
+    // Check for allocation errors
+    if (indexed == NULL || fresh == NULL) {
+        printf("Error: unable to allocate memory for update\n");
+        exit (0);
+    }
+
+    // Tombstone live documents whose file is gone or has changed since it was indexed
+    int num_changed = 0;
+    int num_removed = 0;
+    for (uint32_t doc = 0; doc < set->num_docs; doc++) {
+        if (segments_is_deleted (set, doc)) {
+            continue;
+        }
+
+        char* doc_path = set->docs[doc].path;
+        char** found = (char**) bsearch (&doc_path, paths, num_paths, sizeof (char*), path_comparator);
+        if (found == NULL) {
+            segments_delete (set, doc);
+            num_removed++;
+            continue;
+        }
+
+        struct stat st;
+        if (stat (*found, &st) != 0 || st.st_mtime != set->docs[doc].mtime) {
+            segments_delete (set, doc);
+            num_changed++;
+            continue;
+        }
+        indexed[found - paths] = 1;
+    }
+
+    // Everything not indexed yet goes into one new segment
+    int num_fresh = 0;
+    for (int i = 0; i < num_paths; i++) {
+        if (!indexed[i]) {
+            fresh[num_fresh++] = paths[i];
+        }
+    }
+    if (num_fresh > 0) {
+        struct hashtable* ht = train_files (fresh, num_fresh, num_buckets, num_workers, positions);
+        segments_add (set, path, ht, impacts);
+        ht_destroy (ht);
+    }
+
+    segments_commit (set, path);
+    printf ("%d added, %d changed, %d removed, %d segments\n",
+            num_fresh - num_changed, num_changed, num_removed, set->num_segments);
+
+    // Queries already see the update, merging only makes them cheaper
+    if (set->num_segments > SEGMENTS_MAX) {
+        segments_merge (set, path);
+        printf ("merged into %d segment\n", set->num_segments);
+    }
+
+    free (fresh);
+    free (indexed);
+}
+
+/**
+ * Counts the postings of a term in documents that have not been deleted.
+ * @param  seg   pointer to the segment
+ * @param  term  pointer to the term's slot in the segment
+ * @return the term's df among live documents
+ */
+static uint32_t live_df (const struct segment* seg, const struct index_term* term) {
+    if (seg->num_deleted == 0) {
+        return term->df;
+    }
+
+    uint32_t df = 0;
+    struct postings_cursor cur;
+    postings_open_bytes (&cur, seg->idx->postings + term->postings_offset, term->df);
+    while (postings_next (&cur)) {
+        df += !segment_is_deleted (seg, cur.doc);
+    }
+    return df;
+}
+
+/**
+ * Counts the live documents of the set that contain a word.
+ * @param  set   pointer to the set
+ * @param  word  the word
+ * @return the word's df across the segments
+ */
+uint64_t segments_df (const struct segment_set* set, const char* word) {
+    uint64_t df = 0;
+    for (int s = 0; s < set->num_segments; s++) {
+        const struct index_term* term = index_lookup (set->segs[s].idx, word);
+        if (term != NULL) {
+            df += live_df (&set->segs[s], term);
+        }
+    }
+    return df;
+}
+
+/**
+ * Finds the words of any segment a wildcard or fuzzy word matches, see
+ * index_expand().
+ * @param  set    pointer to the set
+ * @param  w      pointer to the wildcard
+ * @param  words  array of at least QUERY_MAX_EXPANSIONS * num_segments words to
+ *                fill in, pointing into the segments
+ * @return number of distinct words at the front of words, in sorted order and at
+ *         most QUERY_MAX_EXPANSIONS
+ */
+int segments_expand (const struct segment_set* set, const struct query_wildcard* w, char** words) {
+    // Each segment's first words in sorted order include the set's first words
+    int n = 0;
+    for (int s = 0; s < set->num_segments; s++) {
+        n += index_expand (set->segs[s].idx, w, words + n, QUERY_MAX_EXPANSIONS);
+    }
+    return set->num_segments > 1 ? query_unique_words (words, n) : n;
+}
+
+/**
+ * Expands every wildcard and fuzzy word of a query with the words of the set, see
+ * query_select_words() and query_expand().
+ * @param set  pointer to the set, open for as long as the query is used
+ * @param sc   pointer to the scoring settings, which choose how fuzzy words are scored
+ * @param q    pointer to the parsed query
+ */
+void segments_expand_query (const struct segment_set* set, const struct scoring* sc, struct query* q) {
+    if (q->num_wildcards == 0) {
+        return;
+    }
+
+    char** words = (char**) malloc ((QUERY_MAX_EXPANSIONS * set->num_segments + 1) * sizeof (char*));
+    uint64_t* df = (uint64_t*) malloc ((QUERY_MAX_EXPANSIONS + 1) * sizeof (uint64_t));
+    double* weights = (double*) malloc ((QUERY_MAX_EXPANSIONS + 1) * sizeof (double));
+
+    // Check for allocation errors
+    if (words == NULL || df == NULL || weights == NULL) {
+        printf("Error: unable to allocate memory for wildcard words\n");
+        exit (0);
+    }
+
+    for (int w = 0; w < q->num_wildcards; w++) {
+        const struct query_wildcard* wildcard = &q->wildcards[w];
+        int n = segments_expand (set, wildcard, words);
+
+        // Picking the closest word needs to know which words are in the most documents
+        if (wildcard->distance > 0 && sc->fuzzy == FUZZY_BEST) {
+            for (int i = 0; i < n; i++) {
+                df[i] = segments_df (set, words[i]);
+            }
+        }
+        n = query_select_words (wildcard, sc->fuzzy, words, df, n, weights);
+        query_expand (q, w, words, weights, n);
+    }
+    free (words);
+    free (df);
+    free (weights);
+}
+
+/**
+ * Looks up every query term in every segment and computes its idf, times its
+ * weight in sc->weights if there are any. The df of each term and the number of
+ * documents are summed over the segments, not counting deleted documents, or
+ * taken from sc->collection when a shard is scoring.
+ * @param set           pointer to the set
+ * @param sc            pointer to the scoring settings
+ * @param search_query  string array of search terms
+ * @param query_len     length of the search query
+ * @param terms         array of query_len * num_segments slots, terms[j * num_segments + s]
+ *                      is set to term j's slot in segment s, or NULL if it is not there
+ * @param idf           array of query_len idfs, 0 for terms that add nothing to any score
+ */
+void segments_lookup (const struct segment_set* set, const struct scoring* sc, char** search_query,
+        int query_len, const struct index_term** terms, double* idf) {
+    for (int j = 0; j < query_len; j++) {
+        const struct index_term** term = terms + j * set->num_segments;
+
+        // Global df of the term, from every segment it occurs in
+        uint64_t df = 0;
+        for (int s = 0; s < set->num_segments; s++) {
+            term[s] = index_lookup (set->segs[s].idx, search_query[j]);
+            if (term[s] != NULL) {
+                df += live_df (&set->segs[s], term[s]);
+            }
+        }
+
+        // A shard weighs its terms by the whole collection
+        uint64_t num_docs = set->num_live;
+        if (sc->collection != NULL) {
+            df = sc->collection->df[j];
+            num_docs = sc->collection->num_docs;
+        }
+
+        // Words that don't exist add nothing and neither do stop words
+        idf[j] = (df == 0 || is_stop_word (df, num_docs)) ? 0 : scoring_idf (sc, df, num_docs);
+        if (sc->weights != NULL) {
+            idf[j] *= sc->weights[j];
+        }
+    }
+}
+
+/**
+ * Gathers the live documents' accumulated scores for ranking.
+ * @param  set  pointer to the set
+ * @param  acc  array of set->num_docs scores indexed by document number
+ * @return array of set->num_live relevancy scores, free it when done
+ */
+static struct relevancy_score* live_scores (const struct segment_set* set, const double* acc) {
+    struct relevancy_score* scores = (struct relevancy_score*) malloc ((set->num_live + 1) * sizeof (struct relevancy_score));
+
+    // Check for allocation errors
+    if (scores == NULL) {
+        printf("Error: unable to allocate memory for scores\n");
+        exit (0);
+    }
+
+    int n = 0;
+    for (int s = 0; s < set->num_segments; s++) {
+        const struct segment* seg = &set->segs[s];
+        for (uint32_t i = 0; i < seg->idx->header->num_docs; i++) {
+            if (!segment_is_deleted (seg, i)) {
+                scores[n].doc = seg->base + i;
+                scores[n].score = acc[seg->base + i];
+                n++;
+            }
+        }
+    }
+    return scores;
+}
+
+/**
+ * Scores every live document against the search query, then ranks the best k.
+ * Each term's postings are walked once, adding their scores into a dense accumulator.
+ * @param  set           pointer to the set
+ * @param  sc            pointer to the scoring settings
+ * @param  search_query  string array of search terms
+ * @param  query_len     length of the search query
+ * @param  k             number of top results wanted, 0 ranks every live document
+ * @param  num_results   set to the number of ranked entries at the front of the array
+ * @param  stats         counters to add this query's work to, may be NULL
+ * @return array of relevancy scores numbered across the set, free it when done
+ */
+struct relevancy_score* segments_score_exhaustive (const struct segment_set* set, const struct scoring* sc,
+        char** search_query, int query_len, int k, int* num_results, struct query_stats* stats) {
+    double* acc = (double*) calloc (set->num_docs + 1, sizeof (double));
+    const struct index_term** terms = (const struct index_term**) malloc ((query_len * set->num_segments + 1) * sizeof (struct index_term*));
+    double* idf = (double*) malloc ((query_len + 1) * sizeof (double));
+
+    // Check for allocation errors
+    if (acc == NULL || terms == NULL || idf == NULL) {
+        printf("Error: unable to allocate memory for score accumulator\n");
+        exit (0);
+    }
+
+    segments_lookup (set, sc, search_query, query_len, terms, idf);
+
+    struct scorer scorer;
+    scorer_init (&scorer, sc, segments_avg_length (set, sc));
+    int uses_length = scorer_uses_length (&scorer);
+
+    // Add each term's score to every live document in its postings
+    uint64_t decoded = 0;
+    for (int j = 0; j < query_len; j++) {
+        if (idf[j] == 0) {
+            continue;
+        }
+
+        for (int s = 0; s < set->num_segments; s++) {
+            const struct segment* seg = &set->segs[s];
+            const struct index_term* term = terms[j * set->num_segments + s];
+            if (term == NULL) {
+                continue;
+            }
+
+            const uint32_t* lengths = set->lengths + seg->base;
+            struct postings_cursor cur;
+            postings_open_bytes (&cur, seg->idx->postings + term->postings_offset, term->df);
+            while (postings_next (&cur)) {
+                if (seg->num_deleted == 0 || !segment_is_deleted (seg, cur.doc)) {
+                    uint32_t length = uses_length ? lengths[cur.doc] : 0;
+                    acc[seg->base + cur.doc] += scorer_term (&scorer, cur.tf, length, idf[j]);
+                }
+            }
+            decoded += term->df;
+        }
+    }
+    free (idf);
+    free (terms);
+
+    // Only live documents are ranked
+    struct relevancy_score* scores = live_scores (set, acc);
+    free (acc);
+
+    if (stats != NULL) {
+        stats->docs_scored += set->num_live;
+        stats->postings_decoded += decoded;
+        stats->postings_total += decoded;
+    }
+
+    // Rank the best k docs according to their scores
+    *num_results = top_k (scores, set->num_live, k > 0 ? k : (int) set->num_live);
+    return scores;
+}
+
+/**
+ * Scores every live document against the search query from the impacts stored in
+ * the segments, then ranks the best k. Each posting only adds its impact to an
+ * integer accumulator, a document's score is its sum times its segment's scale.
+ * Every segment must have impacts.
+ * @param  set           pointer to the set
+ * @param  sc            pointer to the scoring settings
+ * @param  search_query  string array of search terms
+ * @param  query_len     length of the search query
+ * @param  k             number of top results wanted, 0 ranks every live document
+ * @param  num_results   set to the number of ranked entries at the front of the array
+ * @param  stats         counters to add this query's work to, may be NULL
+ * @return array of relevancy scores numbered across the set, free it when done
+ */
+struct relevancy_score* segments_score_impacts (const struct segment_set* set, const struct scoring* sc,
+        char** search_query, int query_len, int k, int* num_results, struct query_stats* stats) {
+    uint32_t* sums = (uint32_t*) calloc (set->num_docs + 1, sizeof (uint32_t));
+    const struct index_term** terms = (const struct index_term**) malloc ((query_len * set->num_segments + 1) * sizeof (struct index_term*));
+    double* idf = (double*) malloc ((query_len + 1) * sizeof (double));
+
+    // Check for allocation errors
+    if (sums == NULL || terms == NULL || idf == NULL) {
+        printf("Error: unable to allocate memory for score accumulator\n");
+        exit (0);
+    }
+
+    // The idfs only pick out the terms that add nothing, the impacts hold the rest
+    segments_lookup (set, sc, search_query, query_len, terms, idf);
+
+    uint64_t decoded = 0;
+    for (int j = 0; j < query_len; j++) {
+        if (idf[j] == 0) {
+            continue;
+        }
+
+        for (int s = 0; s < set->num_segments; s++) {
+            const struct segment* seg = &set->segs[s];
+            const struct index_term* term = terms[j * set->num_segments + s];
+            if (term == NULL) {
+                continue;
+            }
+            if (seg->idx->impacts == NULL) {
+                printf("Error: segment %u has no impacts, rebuild the index with -i\n", seg->id);
+                exit (0);
+            }
+
+            // Deleted documents are skipped when ranking, not here
+            const uint8_t* impact = seg->idx->impacts + term->impacts_offset;
+            uint32_t* seg_sums = sums + seg->base;
+            struct postings_cursor cur;
+            postings_open_bytes (&cur, seg->idx->postings + term->postings_offset, term->df);
+            for (uint32_t i = 0; postings_next (&cur); i++) {
+                seg_sums[cur.doc] += impact[i];
+            }
+            decoded += term->df;
+        }
+    }
+    free (idf);
+    free (terms);
+
+    // Only live documents are ranked, scaled back to scores
+    struct relevancy_score* scores = (struct relevancy_score*) malloc ((set->num_live + 1) * sizeof (struct relevancy_score));
+
+    // Check for allocation errors
+    if (scores == NULL) {
+        printf("Error: unable to allocate memory for scores\n");
+        exit (0);
+    }
+
+    int n = 0;
+    for (int s = 0; s < set->num_segments; s++) {
+        const struct segment* seg = &set->segs[s];
+        double scale = seg->idx->header->impact_scale;
+        for (uint32_t i = 0; i < seg->idx->header->num_docs; i++) {
+            if (!segment_is_deleted (seg, i)) {
+                scores[n].doc = seg->base + i;
+                scores[n].score = sums[seg->base + i] * scale;
+                n++;
+            }
+        }
+    }
+    free (sums);
+
+    if (stats != NULL) {
+        stats->docs_scored += set->num_live;
+        stats->postings_decoded += decoded;
+        stats->postings_total += decoded;
+    }
+
+    *num_results = top_k (scores, set->num_live, k > 0 ? k : (int) set->num_live);
+    return scores;
+}
+
+/**
+ * Adds the work of one query to the counters and to the caller's stats.
+ * @param local  the query's work
+ * @param stats  counters to add it to, may be NULL
+ */
+static void report_stats (const struct query_stats* local, struct query_stats* stats) {
+    STATS_COUNT (STATS_POSTINGS_SCANNED, local->postings_decoded);
+    STATS_COUNT (STATS_DOCS_SCORED, local->docs_scored);
+    if (stats != NULL) {
+        stats->docs_scored += local->docs_scored;
+        stats->docs_pruned += local->docs_pruned;
+        stats->postings_decoded += local->postings_decoded;
+        stats->postings_total += local->postings_total;
+    }
+}
+
+/**
+ * Scores only the given live documents against the search query, then ranks the
+ * best k. Each term's postings are sought to the documents in turn, skipping the
+ * blocks in between. Scores are the same as segments_score() gives them.
+ * @param  set           pointer to the set
+ * @param  sc            pointer to the scoring settings
+ * @param  search_query  string array of search terms
+ * @param  query_len     length of the search query
+ * @param  matches       sorted array of live document numbers across the set
+ * @param  num_matches   number of documents in matches
+ * @param  k             number of top results wanted, 0 ranks every match
+ * @param  num_results   set to the number of ranked entries at the front of the array
+ * @param  stats         counters to add this query's work to, may be NULL
+ * @return array of relevancy scores numbered across the set, free it when done
+ */
+struct relevancy_score* segments_score_matches (const struct segment_set* set, const struct scoring* sc,
+        char** search_query, int query_len, const uint32_t* matches, uint32_t num_matches, int k,
+        int* num_results, struct query_stats* stats) {
+    double* acc = (double*) calloc (num_matches + 1, sizeof (double));
+    uint32_t* sums = (uint32_t*) calloc (num_matches + 1, sizeof (uint32_t));
+    uint32_t* first = (uint32_t*) malloc ((set->num_segments + 1) * sizeof (uint32_t));
+    const struct index_term** terms = (const struct index_term**) malloc ((query_len * set->num_segments + 1) * sizeof (struct index_term*));
+    double* idf = (double*) malloc ((query_len + 1) * sizeof (double));
+
+    // Check for allocation errors
+    if (acc == NULL || sums == NULL || first == NULL || terms == NULL || idf == NULL) {
+        printf("Error: unable to allocate memory for score accumulator\n");
+        exit (0);
+    }
+
+    // The matches of segment s are matches[first[s]] up to matches[first[s + 1]]
+    uint32_t m = 0;
+    for (int s = 0; s < set->num_segments; s++) {
+        while (m < num_matches && matches[m] < set->segs[s].base) {
+            m++;
+        }
+        first[s] = m;
+    }
+    first[set->num_segments] = num_matches;
+
+    segments_lookup (set, sc, search_query, query_len, terms, idf);
+
+    struct scorer scorer;
+    scorer_init (&scorer, sc, segments_avg_length (set, sc));
+    int uses_length = scorer_uses_length (&scorer);
+
+    // Terms in the same order as the other scorers, so the sums round the same
+    for (int j = 0; j < query_len; j++) {
+        if (idf[j] == 0) {
+            continue;
+        }
+
+        for (int s = 0; s < set->num_segments; s++) {
+            const struct segment* seg = &set->segs[s];
+            const struct index_term* term = terms[j * set->num_segments + s];
+            if (term == NULL || first[s] == first[s + 1]) {
+                continue;
+            }
+            if (sc->impacts && seg->idx->impacts == NULL) {
+                printf("Error: segment %u has no impacts, rebuild the index with -i\n", seg->id);
+                exit (0);
+            }
+
+            struct index_cursor cur;
+            index_cursor_open (&cur, seg->idx, term);
+            for (m = first[s]; m < first[s + 1]; m++) {
+                uint32_t doc = matches[m] - seg->base;
+                if (!index_cursor_seek (&cur, doc)) {
+                    break;
+                }
+                if (cur.doc != doc) {
+                    continue;
+                }
+
+                if (sc->impacts) {
+                    sums[m] += seg->idx->impacts[term->impacts_offset + cur.next - 1];
+                } else {
+                    uint32_t length = uses_length ? set->lengths[matches[m]] : 0;
+                    acc[m] += scorer_term (&scorer, cur.tf, length, idf[j]);
+                }
+            }
+            if (stats != NULL) {
+                stats->postings_decoded += cur.decoded;
+                stats->postings_total += term->df;
+            }
+        }
+    }
+    free (idf);
+    free (terms);
+
+    struct relevancy_score* scores = (struct relevancy_score*) malloc ((num_matches + 1) * sizeof (struct relevancy_score));
+
+    // Check for allocation errors
+    if (scores == NULL) {
+        printf("Error: unable to allocate memory for scores\n");
+        exit (0);
+    }
+
+    for (int s = 0; s < set->num_segments; s++) {
+        double scale = sc->impacts ? set->segs[s].idx->header->impact_scale : 0;
+        for (m = first[s]; m < first[s + 1]; m++) {
+            scores[m].doc = matches[m];
+            scores[m].score = sc->impacts ? sums[m] * scale : acc[m];
+        }
+    }
+    free (first);
+    free (sums);
+    free (acc);
+
+    if (stats != NULL) {
+        stats->docs_scored += num_matches;
+        stats->docs_pruned += set->num_live - num_matches;
+    }
+
+    *num_results = top_k (scores, num_matches, k > 0 ? k : (int) num_matches);
+    return scores;
+}
+
+/**
+ * Scores the live documents against the search query and ranks the best k. Only
+ * reads the set, so several threads may score queries at once. A top-k query is
+ * answered with maxscore_top_k(), which skips documents that cannot make the top k,
+ * and a query for every document, or with more than MAXSCORE_MAX_TERMS terms, is
+ * scored exhaustively. Both rank the same.
+ * With sc->impacts the stored impacts are summed instead.
+ * @param  set           pointer to the set
+ * @param  sc            pointer to the scoring settings
+ * @param  search_query  string array of search terms
+ * @param  query_len     length of the search query
+ * @param  k             number of top results wanted, 0 ranks every live document
+ * @param  num_results   set to the number of ranked entries at the front of the array
+ * @param  stats         counters to add this query's work to, may be NULL
+ * @return array of relevancy scores numbered across the set, free it when done
+ */
+struct relevancy_score* segments_score (const struct segment_set* set, const struct scoring* sc,
+        char** search_query, int query_len, int k, int* num_results, struct query_stats* stats) {
+    double start = stats_begin ();
+    struct query_stats local;
+    memset (&local, 0, sizeof (local));
+
+    struct relevancy_score* scores;
+    if (sc->impacts) {
+        scores = segments_score_impacts (set, sc, search_query, query_len, k, num_results, &local);
+    } else if (k > 0 && (uint32_t) k < set->num_live && query_len <= MAXSCORE_MAX_TERMS) {
+        scores = maxscore_top_k (set, sc, search_query, query_len, k, num_results, &local);
+    } else {
+        scores = segments_score_exhaustive (set, sc, search_query, query_len, k, num_results, &local);
+    }
+
+    report_stats (&local, stats);
+    stats_end (STATS_SCORE, start);
+    return scores;
+}
+
+/**
+ * Scores the live documents against a parsed query and ranks the best k. Without
+ * a filter this is segments_score(). Otherwise only the documents the filter
+ * matches are scored, see query_match().
+ * @param  set          pointer to the set
+ * @param  sc           pointer to the scoring settings
+ * @param  q            pointer to the parsed query
+ * @param  k            number of top results wanted, 0 ranks every match
+ * @param  num_results  set to the number of ranked entries at the front of the array
+ * @param  stats        counters to add this query's work to, may be NULL
+ * @return array of relevancy scores numbered across the set, free it when done
+ */
+struct relevancy_score* segments_score_query (const struct segment_set* set, const struct scoring* sc,
+        const struct query* q, int k, int* num_results, struct query_stats* stats) {
+    // Terms a fuzzy word expanded to are weighted by how close they are
+    struct scoring weighted = *sc;
+    weighted.weights = q->weights;
+    sc = &weighted;
+
+    if (q->root < 0) {
+        return segments_score (set, sc, q->terms, q->num_terms, k, num_results, stats);
+    }
+
+    double start = stats_begin ();
+    struct query_stats local;
+    memset (&local, 0, sizeof (local));
+
+    uint32_t num_matches;
+    uint32_t* matches = query_match (set, q, &num_matches);
+    struct relevancy_score* scores = segments_score_matches (set, sc, q->terms, q->num_terms, matches,
+            num_matches, k, num_results, &local);
+    free (matches);
+
+    report_stats (&local, stats);
+    stats_end (STATS_SCORE, start);
+    return scores;
+}
+
+/**
+ * Ranks the live documents against a parsed query and outputs results.
+ * @param  set    pointer to the set
+ * @param  sc     pointer to the scoring settings
+ * @param  q      pointer to the parsed query
+ * @param  k      number of top results to write, 0 writes every match
+ * @param  stats  counters to add this query's work to, may be NULL
+ */
+void segments_rank (const struct segment_set* set, const struct scoring* sc, const struct query* q, int k,
+        struct query_stats* stats) {
+    if (set->num_live == 0) {
+        printf("Error: the index has no documents, run ./search update\n");
+        return;
+    }
+
+    int num_results;
+    struct relevancy_score* scores = segments_score_query (set, sc, q, k, &num_results, stats);
+
+    output_results (set->docs, scores, num_results);
+
+    free (scores);
+}
@@ -0,0 +1,413 @@
+/**************************************************************************************
+* Jack Umina
+* Created Nov, 2019
+* Long-running query server. The index is built or loaded once, and reopened when it
+* changes on disk, then queries are read one per line from stdin or from clients of a
+* Unix domain socket.
+***************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+
+#include "hashtable.h"
+#include "infoRetrieval.h"
+#include "indexfile.h"
+#include "qcache.h"
+#include "segments.h"
+#include "server.h"
+#include "shards.h"
+#include "stats.h"
+
+/**
+ * Accepted client sockets waiting for a thread, as a ring buffer.
+ */
+struct client_queue {
+    int fds[SERVER_QUEUE_SIZE];
+    int head;
+    int count;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+};
+
+struct server_worker {
+    struct server* s;
+    struct client_queue* queue;
+};
+
+/**
+ * Sets up a server and opens the index, if there is one. Leaves ht for the caller to
+ * train and freeze, or shards to start, when segs comes back NULL.
+ * @param s             pointer to the server to fill in
+ * @param index_path    name of the index manifest, or NULL to leave the index to the caller
+ * @param num_results   number of results for each query, 0 ranks every document
+ * @param sc            pointer to the scoring settings
+ * @param cache_budget  bytes of results to cache, 0 turns the cache off
+ */
+void server_init (struct server* s, const char* index_path, int num_results, const struct scoring* sc,
+        size_t cache_budget) {
+    memset (s, 0, sizeof (*s));
+    s->num_results = num_results;
+    s->scoring = *sc;
+    s->cache = cache_budget > 0 ? qcache_create (cache_budget) : NULL;
+    pthread_rwlock_init (&s->lock, NULL);
+    pthread_mutex_init (&s->check_lock, NULL);
+    if (index_path == NULL) {
+        return;
+    }
+
+    // Note which manifest is loaded before opening it, so a change in between is seen
+    struct stat st;
+    if (stat (index_path, &st) == 0) {
+        s->index_ino = st.st_ino;
+        s->index_mtime = st.st_mtim;
+    }
+    s->segs = segments_open (index_path, 0);
+    if (s->segs != NULL) {
+        s->index_path = index_path;
+        s->next_check_us = stats_now_us () + SERVER_CHECK_INTERVAL * 1e6;
+    }
+}
+
+/**
+ * Closes the server's index, stops its shards or frees its hashtable, and frees its cache.
+ * @param s pointer to the server
+ */
+void server_destroy (struct server* s) {
+    if (s->segs != NULL) {
+        segments_close ((struct segment_set*) s->segs);
+    } else if (s->shards != NULL) {
+        shards_stop (s->shards);
+    } else if (s->ht != NULL) {
+        ht_destroy (s->ht);
+    }
+    if (s->cache != NULL) {
+        qcache_destroy (s->cache);
+    }
+    pthread_rwlock_destroy (&s->lock);
+    pthread_mutex_destroy (&s->check_lock);
+}
+
+/**
+ * Prints the latency totals of a stream and the cache's hit rate to stderr.
+ * @param s      pointer to the server
+ * @param label  what the totals are for
+ * @param stats  latency totals of the stream
+ */
+void server_print_stats (struct server* s, const char* label, const struct server_stats* stats) {
+    if (stats->num_queries == 0) {
+        return;
+    }
+    fprintf (stderr, "%s: %ld queries, mean %.0f us, max %.0f us\n", label,
+            stats->num_queries, stats->total_us / stats->num_queries, stats->max_us);
+
+    if (s->cache != NULL) {
+        struct qcache_stats cs;
+        qcache_get_stats (s->cache, &cs);
+        uint64_t lookups = cs.hits + cs.misses;
+        fprintf (stderr, "cache: %lu hits, %lu misses, %.1f%% hit rate, %u entries, %lu bytes, "
+                "%lu evictions, %lu invalidations\n", (unsigned long) cs.hits, (unsigned long) cs.misses,
+                lookups > 0 ? 100.0 * cs.hits / lookups : 0.0, cs.num_entries, (unsigned long) cs.bytes,
+                (unsigned long) cs.evictions, (unsigned long) cs.invalidations);
+    }
+}
+
+/**
+ * Reopens the index if its manifest has been replaced since it was loaded, at most
+ * once every SERVER_CHECK_INTERVAL seconds, and empties the cache when it does.
+ * @param s pointer to the server
+ */
+static void check_index (struct server* s) {
+    if (s->index_path == NULL) {
+        return;
+    }
+
+    double now = stats_now_us ();
+    pthread_mutex_lock (&s->check_lock);
+    if (now < s->next_check_us) {
+        pthread_mutex_unlock (&s->check_lock);
+        return;
+    }
+    s->next_check_us = now + SERVER_CHECK_INTERVAL * 1e6;
+
+    // Manifests are replaced by renaming a new file over them, which changes the inode
+    struct stat st;
+    if (stat (s->index_path, &st) != 0 || (st.st_ino == s->index_ino
+            && st.st_mtim.tv_sec == s->index_mtime.tv_sec && st.st_mtim.tv_nsec == s->index_mtime.tv_nsec)) {
+        pthread_mutex_unlock (&s->check_lock);
+        return;
+    }
+    s->index_ino = st.st_ino;
+    s->index_mtime = st.st_mtim;
+
+    // Open the new index before stopping queries, and keep the old one if it is unusable
+    struct segment_set* set = segments_open (s->index_path, 0);
+    struct scoring sc = s->scoring;
+    if (set == NULL || (sc.impacts && !segments_impacts (set, &sc))) {
+        fprintf (stderr, "Error: %s changed but cannot be used, still answering from the old index\n",
+                s->index_path);
+        if (set != NULL) {
+            segments_close (set);
+        }
+        pthread_mutex_unlock (&s->check_lock);
+        return;
+    }
+
+    pthread_rwlock_wrlock (&s->lock);
+    struct segment_set* old = (struct segment_set*) s->segs;
+    s->segs = set;
+    s->scoring = sc;
+    if (s->cache != NULL) {
+        qcache_invalidate (s->cache);
+    }
+    pthread_rwlock_unlock (&s->lock);
+    pthread_mutex_unlock (&s->check_lock);
+
+    segments_close (old);
+    fprintf (stderr, "reopened %s: %d segments, %u documents\n", s->index_path, set->num_segments, set->num_live);
+}
+
+/**
+ * Answers one query and writes its answer line.
+ * @param  s     pointer to the server
+ * @param  line  the query, split and lowercased in place
+ * @param  out   stream to write the answer to
+ * @return microseconds spent answering
+ */
+static double answer (struct server* s, char* line, FILE* out) {
+    double start = stats_now_us ();
+    check_index (s);
+
+    // Shards parse the query themselves, from the line as it came in
+    char* raw = NULL;
+    if (s->shards != NULL && (raw = strdup (line)) == NULL) {
+        printf("Error: unable to allocate memory for query\n");
+        exit (0);
+    }
+
+    // A query too long to parse is answered with no results
+    struct query q;
+    if (query_parse (line, &q) != 0) {
+        free (raw);
+        double elapsed = stats_now_us () - start;
+        fprintf (out, "0 %.0f\n", elapsed);
+        fflush (out);
+        return elapsed;
+    }
+
+    // With a cache, the terms are sorted so reordered queries share an entry
+    char* key = s->cache != NULL ? qcache_key (&q) : NULL;
+
+    // Cached results and the index they came from must not change under us
+    pthread_rwlock_rdlock (&s->lock);
+
+    int num_results;
+    struct relevancy_score* scores = key != NULL ? qcache_get (s->cache, key, &num_results) : NULL;
+    if (scores == NULL) {
+        // Wildcards and fuzzy words are expanded from the index the query is scored on
+        if (s->segs != NULL) {
+            segments_expand_query (s->segs, &s->scoring, &q);
+            scores = segments_score_query (s->segs, &s->scoring, &q, s->num_results, &num_results, NULL);
+        } else if (s->shards != NULL) {
+            scores = shards_score (s->shards, raw, s->num_results, &num_results, NULL);
+        } else {
+            expand_query (s->ht, &s->scoring, &q);
+            scores = score_query (s->ht, &s->scoring, &q, s->num_results, &num_results);
+        }
+        if (key != NULL) {
+            qcache_put (s->cache, key, scores, num_results);
+        }
+    }
+    const struct document* docs = s->segs != NULL ? s->segs->docs
+            : s->shards != NULL ? s->shards->docs : s->ht->docs;
+
+    // Format the whole answer first so the latency covers it
+    size_t size = 32;
+    for (int i = 0; i < num_results; i++) {
+        size += strlen (docs[scores[i].doc].path) + 32;
+    }
+    char* buf = (char*) malloc (size);
+
+    // Check for allocation errors
+    if (buf == NULL) {
+        printf("Error: unable to allocate memory for answer\n");
+        exit (0);
+    }
+
+    size_t len = 0;
+    buf[0] = '\0';
+    for (int i = 0; i < num_results; i++) {
+        len += snprintf (buf + len, size - len, " %s:%f", docs[scores[i].doc].path, scores[i].score);
+    }
+    pthread_rwlock_unlock (&s->lock);
+
+    double elapsed = stats_now_us () - start;
+    fprintf (out, "%d %.0f%s\n", num_results, elapsed, buf);
+    fflush (out);
+
+    free (buf);
+    free (scores);
+    free (key);
+    free (raw);
+    query_free (&q);
+    return elapsed;
+}
+
+/**
+ * Answers every line of in on out, flushing after each answer, until in ends.
+ * @param s      pointer to the server
+ * @param in     stream of newline-delimited queries
+ * @param out    stream to write the answers to
+ * @param stats  latency totals to add this stream's queries to
+ */
+void serve_stream (struct server* s, FILE* in, FILE* out, struct server_stats* stats) {
+    char* line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+
+    while ((len = getline (&line, &cap, in)) != -1) {
+        // Strip the line ending
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+            line[--len] = '\0';
+        }
+
+        double elapsed = answer (s, line, out);
+        stats->num_queries++;
+        stats->total_us += elapsed;
+        if (elapsed > stats->max_us) {
+            stats->max_us = elapsed;
+        }
+    }
+
+    free (line);
+}
+
+/**
+ * Takes clients off the queue and serves each one until it disconnects.
+ * @param  arg pointer to this thread's server_worker
+ * @return NULL
+ */
+static void* client_worker (void* arg) {
+    struct server_worker* worker = (struct server_worker*) arg;
+    struct client_queue* queue = worker->queue;
+
+    while (1) {
+        pthread_mutex_lock (&queue->lock);
+        while (queue->count == 0) {
+            pthread_cond_wait (&queue->not_empty, &queue->lock);
+        }
+        int fd = queue->fds[queue->head];
+        queue->head = (queue->head + 1) % SERVER_QUEUE_SIZE;
+        queue->count--;
+        pthread_cond_signal (&queue->not_full);
+        pthread_mutex_unlock (&queue->lock);
+
+        // Separate streams for each direction, closing both closes the socket
+        FILE* in = fdopen (fd, "r");
+        int out_fd = dup (fd);
+        FILE* out = out_fd < 0 ? NULL : fdopen (out_fd, "w");
+        if (in == NULL || out == NULL) {
+            fprintf (stderr, "Error in opening client stream: %s\n", strerror (errno));
+            if (in != NULL) {
+                fclose (in);
+            } else {
+                close (fd);
+            }
+            if (out_fd >= 0 && out == NULL) {
+                close (out_fd);
+            }
+            continue;
+        }
+
+        struct server_stats stats = {0, 0, 0};
+        serve_stream (worker->s, in, out, &stats);
+        server_print_stats (worker->s, "client", &stats);
+
+        fclose (out);
+        fclose (in);
+        stats_flush ();
+    }
+    return NULL;
+}
+
+/**
+ * Listens on a Unix domain socket and answers each client's queries on a pool of
+ * threads, one client per thread at a time. Never returns.
+ * @param s            pointer to the server
+ * @param path         file name of the socket, replaced if it already exists
+ * @param num_threads  number of threads serving clients
+ */
+void serve_socket (struct server* s, const char* path, int num_threads) {
+    struct sockaddr_un addr;
+    memset (&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+
+    if (strlen (path) >= sizeof (addr.sun_path)) {
+        printf("Error: socket path %s is too long\n", path);
+        exit (0);
+    }
+    strcpy (addr.sun_path, path);
+
+    // A client that disconnects mid-answer must not kill the server
+    signal (SIGPIPE, SIG_IGN);
+
+    int listen_fd = socket (AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        printf("Error in creating socket: %s\n", strerror (errno));
+        exit (0);
+    }
+    unlink (path);
+    if (bind (listen_fd, (struct sockaddr*) &addr, sizeof (addr)) != 0
+            || listen (listen_fd, SERVER_QUEUE_SIZE) != 0) {
+        printf("Error in listening on %s: %s\n", path, strerror (errno));
+        exit (0);
+    }
+
+    struct client_queue queue;
+    queue.head = 0;
+    queue.count = 0;
+    pthread_mutex_init (&queue.lock, NULL);
+    pthread_cond_init (&queue.not_empty, NULL);
+    pthread_cond_init (&queue.not_full, NULL);
+
+    pthread_t threads[num_threads];
+    struct server_worker worker = {s, &queue};
+
+    for (int t = 0; t < num_threads; t++) {
+        if (pthread_create (&threads[t], NULL, client_worker, &worker) != 0) {
+            printf("Error: unable to start server thread\n");
+            exit (0);
+        }
+    }
+
+    fprintf (stderr, "listening on %s with %d threads\n", path, num_threads);
+
+    while (1) {
+        int fd = accept (listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            printf("Error in accepting client: %s\n", strerror (errno));
+            exit (0);
+        }
+
+        // Hand the client to the pool, waiting while every queue slot is taken
+        pthread_mutex_lock (&queue.lock);
+        while (queue.count == SERVER_QUEUE_SIZE) {
+            pthread_cond_wait (&queue.not_full, &queue.lock);
+        }
+        queue.fds[(queue.head + queue.count) % SERVER_QUEUE_SIZE] = fd;
+        queue.count++;
+        pthread_cond_signal (&queue.not_empty);
+        pthread_mutex_unlock (&queue.lock);
+    }
+}
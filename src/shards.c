@@ -0,0 +1,868 @@
+/**************************************************************************************
+* Jack Umina
+* Created Nov, 2019
+* Sharded index: builds the shards, runs a process for each, and scatters queries
+* to them and gathers their results.
+***************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "hashtable.h"
+#include "infoRetrieval.h"
+#include "indexfile.h"
+#include "parallelTrain.h"
+#include "query.h"
+#include "scoring.h"
+#include "segments.h"
+#include "shards.h"
+#include "sort.h"
+
+/**
+ * Names the manifest of one shard.
+ * @param  path   name of the unsharded index
+ * @param  shard  number of the shard
+ * @return the shard's manifest name, free it when done
+ */
+static char* shard_path (const char* path, int shard) {
+    size_t size = strlen (path) + 32;
+    char* name = (char*) malloc (size);
+
+    // Check for allocation errors
+    if (name == NULL) {
+        printf("Error: unable to allocate memory for shard name\n");
+        exit (0);
+    }
+
+    snprintf (name, size, "%s.shard%d", path, shard);
+    return name;
+}
+
+/**
+ * Splits the files into contiguous ranges, one per shard, and replaces each
+ * shard's index with one trained from its range.
+ * @param path         name of the unsharded index, shards are named <path>.shard<i>
+ * @param paths        sorted array of the file paths to index
+ * @param num_paths    number of paths, at least num_shards
+ * @param num_shards   number of shards
+ * @param num_buckets  initial bucket hint for training each shard
+ * @param num_workers  number of training threads
+ * @param positions    non-zero to also store where each word occurs
+ */
+void shards_build (const char* path, char** paths, int num_paths, int num_shards, int num_buckets,
+        int num_workers, int positions) {
+    if (num_paths < num_shards) {
+        printf("Error: %d shards need at least %d documents\n", num_shards, num_shards);
+        exit (0);
+    }
+
+    for (int i = 0; i < num_shards; i++) {
+        // Ranges in file order keep the documents numbered as one index numbers them
+        int first = (int) ((int64_t) num_paths * i / num_shards);
+        int last = (int) ((int64_t) num_paths * (i + 1) / num_shards);
+
+        struct hashtable* ht = train_files (paths + first, last - first, num_buckets, num_workers, positions);
+        char* name = shard_path (path, i);
+        segments_rebuild (name, ht, NULL);
+        ht_destroy (ht);
+        free (name);
+    }
+
+    // Drop the shards of an earlier build with more of them
+    for (int i = num_shards; ; i++) {
+        char* name = shard_path (path, i);
+        struct segment_set* set = segments_open (name, 0);
+        if (set == NULL) {
+            free (name);
+            break;
+        }
+        segments_remove_files (set, name);
+        segments_close (set);
+        unlink (name);
+        free (name);
+    }
+}
+
+/**
+ * The words each wildcard of a query expands to, in the order of its wildcards,
+ * as the coordinator sends them to the shards: <num_wildcards>, then for each
+ * wildcard the number of its words and each word with its weight.
+ */
+struct expansions {
+    int num_wildcards;
+    int* counts;
+    char** words;
+    double* weights;
+    int num_words;
+};
+
+/**
+ * Allocates room for the words of a query's wildcards.
+ * @param e              pointer to the expansions to set up
+ * @param num_wildcards  number of wildcards
+ * @param num_words      most words of them all
+ */
+static void expansions_init (struct expansions* e, int num_wildcards, int num_words) {
+    e->num_wildcards = num_wildcards;
+    e->num_words = 0;
+    e->counts = (int*) calloc (num_wildcards + 1, sizeof (int));
+    e->words = (char**) malloc ((num_words + 1) * sizeof (char*));
+    e->weights = (double*) malloc ((num_words + 1) * sizeof (double));
+
+    // Check for allocation errors
+    if (e->counts == NULL || e->words == NULL || e->weights == NULL) {
+        printf("Error: unable to allocate memory for wildcard words\n");
+        exit (0);
+    }
+}
+
+/**
+ * Frees the words of the expansions.
+ * @param e pointer to the expansions
+ */
+static void expansions_free (struct expansions* e) {
+    for (int i = 0; i < e->num_words; i++) {
+        free (e->words[i]);
+    }
+    free (e->words);
+    free (e->weights);
+    free (e->counts);
+}
+
+/**
+ * Adds a copy of a word to a wildcard's words. Words are added one wildcard at a
+ * time, in the order of the wildcards.
+ * @param e       pointer to the expansions
+ * @param w       index of the wildcard
+ * @param word    first byte of the word
+ * @param len     length of the word
+ * @param weight  weight of the word when scored
+ */
+static void expansions_add (struct expansions* e, int w, const char* word, size_t len, double weight) {
+    char* copy = strndup (word, len);
+
+    // Check for allocation errors
+    if (copy == NULL) {
+        printf("Error: unable to allocate memory for wildcard words\n");
+        exit (0);
+    }
+
+    e->weights[e->num_words] = weight;
+    e->words[e->num_words++] = copy;
+    e->counts[w]++;
+}
+
+/**
+ * Reads expansions sent by the coordinator.
+ * @param  p  pointer into the request, moved past the expansions
+ * @param  e  pointer to the expansions to fill in, free them with expansions_free()
+ */
+static void expansions_read (char** p, struct expansions* e) {
+    int num_wildcards = (int) strtol (*p, p, 10);
+    if (num_wildcards < 0) {
+        num_wildcards = 0;
+    }
+    expansions_init (e, num_wildcards, num_wildcards * QUERY_MAX_EXPANSIONS);
+
+    for (int w = 0; w < e->num_wildcards; w++) {
+        int count = (int) strtol (*p, p, 10);
+        for (int i = 0; i < count && i < QUERY_MAX_EXPANSIONS; i++) {
+            // Words never contain spaces, query_parse() splits on them
+            *p += **p == ' ';
+            size_t len = strcspn (*p, " ");
+            char* word = *p;
+            *p += len;
+            expansions_add (e, w, word, len, strtod (*p, p));
+        }
+    }
+}
+
+/**
+ * Writes expansions to a shard.
+ * @param to  stream to the shard
+ * @param e   pointer to the expansions
+ */
+static void expansions_write (FILE* to, const struct expansions* e) {
+    fprintf (to, "%d", e->num_wildcards);
+    for (int w = 0, i = 0; w < e->num_wildcards; w++) {
+        fprintf (to, " %d", e->counts[w]);
+        for (int j = 0; j < e->counts[w]; j++) {
+            fprintf (to, " %s %a", e->words[i], e->weights[i]);
+            i++;
+        }
+    }
+}
+
+/**
+ * Expands every wildcard of a query with the words it was sent with.
+ * @param  e  pointer to the expansions, kept until the query is freed
+ * @param  q  pointer to the parsed query
+ * @return 1 if the expansions were for a query with as many wildcards, 0 if not
+ */
+static int expansions_apply (const struct expansions* e, struct query* q) {
+    if (e->num_wildcards != q->num_wildcards) {
+        return 0;
+    }
+    for (int w = 0, i = 0; w < e->num_wildcards; w++) {
+        query_expand (q, w, e->words + i, e->weights + i, e->counts[w]);
+        i += e->counts[w];
+    }
+    return 1;
+}
+
+/**
+ * Answers the coordinator's requests from one shard's index until its socket is
+ * closed. Runs in the shard's own process.
+ * @param set  pointer to the shard's index
+ * @param sc   pointer to the scoring settings
+ * @param in   stream of requests
+ * @param out  stream to write the replies to
+ */
+static void shard_serve (const struct segment_set* set, const struct scoring* sc, FILE* in, FILE* out) {
+    // Introduce the shard with its document table, so results can be numbered globally
+    fprintf (out, "%u %d\n", set->num_docs, segments_positions (set));
+    for (uint32_t doc = 0; doc < set->num_docs; doc++) {
+        fprintf (out, "%ld %u %s\n", (long) set->docs[doc].mtime, set->docs[doc].length, set->docs[doc].path);
+    }
+    fflush (out);
+
+    char* line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+
+    while ((len = getline (&line, &cap, in)) != -1) {
+        if (len > 0 && line[len - 1] == '\n') {
+            line[--len] = '\0';
+        }
+
+        // Wildcards first: the words of this shard each one matches, with their
+        // dfs when the closest fuzzy word is picked by df
+        if (line[0] == 'E' && line[1] == ' ') {
+            struct query q;
+            if (query_parse (line + 2, &q) != 0) {
+                fprintf (stderr, "Error: shard got a query it cannot parse\n");
+                break;
+            }
+
+            char** words = (char**) malloc ((QUERY_MAX_EXPANSIONS * set->num_segments + 1) * sizeof (char*));
+
+            // Check for allocation errors
+            if (words == NULL) {
+                printf("Error: unable to allocate memory for wildcard words\n");
+                exit (0);
+            }
+
+            for (int w = 0; w < q.num_wildcards; w++) {
+                int n = segments_expand (set, &q.wildcards[w], words);
+                int with_df = q.wildcards[w].distance > 0 && sc->fuzzy == FUZZY_BEST;
+                fprintf (out, w == 0 ? "%d" : " %d", n);
+                for (int i = 0; i < n; i++) {
+                    fprintf (out, " %s", words[i]);
+                    if (with_df) {
+                        fprintf (out, " %lu", (unsigned long) segments_df (set, words[i]));
+                    }
+                }
+            }
+            fprintf (out, "\n");
+            fflush (out);
+
+            free (words);
+            query_free (&q);
+            continue;
+        }
+
+        // First round: the shard's share of the collection statistics
+        if (line[0] == 'S' && line[1] == ' ') {
+            char* p = line + 2;
+            struct expansions e;
+            expansions_read (&p, &e);
+            if (*p == ' ') {
+                p++;
+            }
+
+            struct query q;
+            if (query_parse (p, &q) != 0) {
+                fprintf (stderr, "Error: shard got a query it cannot parse\n");
+                break;
+            }
+            if (!expansions_apply (&e, &q)) {
+                fprintf (stderr, "Error: shard got words for %d wildcards of %d\n", e.num_wildcards, q.num_wildcards);
+                break;
+            }
+
+            fprintf (out, "%u %lu", set->num_live, (unsigned long) set->live_length);
+            for (int j = 0; j < q.num_terms; j++) {
+                fprintf (out, " %lu", (unsigned long) segments_df (set, q.terms[j]));
+            }
+            fprintf (out, "\n");
+            fflush (out);
+
+            query_free (&q);
+            expansions_free (&e);
+            continue;
+        }
+
+        if (line[0] != 'Q' || line[1] != ' ') {
+            fprintf (stderr, "Error: shard got an unknown request\n");
+            break;
+        }
+
+        // Second round: score with the whole collection's statistics
+        char* p = line + 2;
+        int k = (int) strtol (p, &p, 10);
+        struct collection_stats cs;
+        cs.num_docs = strtoull (p, &p, 10);
+        cs.total_length = strtoull (p, &p, 10);
+        struct expansions e;
+        expansions_read (&p, &e);
+        int num_terms = (int) strtol (p, &p, 10);
+
+        uint64_t* df = (uint64_t*) malloc ((num_terms + 1) * sizeof (uint64_t));
+
+        // Check for allocation errors
+        if (df == NULL) {
+            printf("Error: unable to allocate memory for collection statistics\n");
+            exit (0);
+        }
+
+        for (int j = 0; j < num_terms; j++) {
+            df[j] = strtoull (p, &p, 10);
+        }
+        cs.df = df;
+
+        // The query follows the numbers after a single space
+        if (*p == ' ') {
+            p++;
+        }
+
+        struct query q;
+        if (query_parse (p, &q) != 0) {
+            fprintf (stderr, "Error: shard got a query it cannot parse\n");
+            break;
+        }
+
+        // Both rounds parse and expand the same query, so the terms line up with the dfs
+        if (!expansions_apply (&e, &q) || q.num_terms != num_terms) {
+            fprintf (stderr, "Error: shard got %d dfs for a query of %d terms\n", num_terms, q.num_terms);
+            break;
+        }
+
+        struct scoring shard_sc = *sc;
+        shard_sc.collection = &cs;
+
+        struct query_stats stats;
+        memset (&stats, 0, sizeof (stats));
+
+        int num_results;
+        struct relevancy_score* scores = segments_score_query (set, &shard_sc, &q, k, &num_results, &stats);
+
+        fprintf (out, "%d %lu %lu %lu %lu\n", num_results, (unsigned long) stats.docs_scored,
+                (unsigned long) stats.docs_pruned, (unsigned long) stats.postings_decoded,
+                (unsigned long) stats.postings_total);
+        for (int i = 0; i < num_results; i++) {
+            fprintf (out, "%u %a\n", scores[i].doc, scores[i].score);
+        }
+        fflush (out);
+
+        free (scores);
+        query_free (&q);
+        expansions_free (&e);
+        free (df);
+    }
+
+    free (line);
+}
+
+/**
+ * Reports a shard that stopped answering and exits.
+ * @param shard  number of the shard
+ */
+static void shard_failed (int shard) {
+    printf("Error: shard %d stopped answering\n", shard);
+    exit (0);
+}
+
+/**
+ * Reads a shard's introduction: its document table and whether it has positions.
+ * @param pool  pointer to the pool, the shard's documents are appended to its table
+ * @param i     number of the shard
+ */
+static void read_doc_table (struct shard_pool* pool, int i) {
+    struct shard* shard = &pool->shards[i];
+    int positions;
+
+    if (fscanf (shard->from, "%u %d", &shard->num_docs, &positions) != 2 || getc (shard->from) != '\n') {
+        shard_failed (i);
+    }
+
+    shard->base = pool->num_docs;
+    pool->num_docs += shard->num_docs;
+    pool->positions = pool->positions && positions;
+
+    pool->docs = (struct document*) realloc (pool->docs, (pool->num_docs + 1) * sizeof (struct document));
+
+    // Check for allocation errors
+    if (pool->docs == NULL) {
+        printf("Error: unable to allocate memory for document table\n");
+        exit (0);
+    }
+
+    char* line = NULL;
+    size_t cap = 0;
+    for (uint32_t doc = 0; doc < shard->num_docs; doc++) {
+        long mtime;
+        unsigned int length;
+        int offset;
+
+        // The path is the rest of the line, it may hold spaces
+        ssize_t len = getline (&line, &cap, shard->from);
+        if (len <= 0 || sscanf (line, "%ld %u %n", &mtime, &length, &offset) != 2) {
+            shard_failed (i);
+        }
+        if (line[len - 1] == '\n') {
+            line[--len] = '\0';
+        }
+
+        struct document* d = &pool->docs[shard->base + doc];
+        d->path = strdup (line + offset);
+
+        // Check for allocation errors
+        if (d->path == NULL) {
+            printf("Error: unable to allocate memory for document path\n");
+            exit (0);
+        }
+
+        d->mtime = mtime;
+        d->length = length;
+    }
+    free (line);
+}
+
+/**
+ * Starts a process for each shard, which opens the shard's index and answers the
+ * coordinator until its socket is closed, and reads each shard's document table.
+ * @param  path        name of the unsharded index
+ * @param  num_shards  number of shards
+ * @param  sc          pointer to the scoring settings, without impacts
+ * @return pointer to the pool, stop it with shards_stop()
+ */
+struct shard_pool* shards_start (const char* path, int num_shards, const struct scoring* sc) {
+    struct shard_pool* pool = (struct shard_pool*) malloc (sizeof (struct shard_pool));
+    struct shard* shards = (struct shard*) calloc (num_shards, sizeof (struct shard));
+
+    // Check for allocation errors
+    if (pool == NULL || shards == NULL) {
+        printf("Error: unable to allocate memory for shards\n");
+        exit (0);
+    }
+
+    pool->shards = shards;
+    pool->num_shards = num_shards;
+    pool->num_docs = 0;
+    pool->docs = NULL;
+    pool->positions = 1;
+    pool->fuzzy = sc->fuzzy;
+    pthread_mutex_init (&pool->lock, NULL);
+
+    // A shard that dies shows up as a failed read, not a signal
+    signal (SIGPIPE, SIG_IGN);
+
+    for (int i = 0; i < num_shards; i++) {
+        char* name = shard_path (path, i);
+        if (access (name, R_OK) != 0) {
+            printf("Error: %s does not exist, run ./search -n %d index\n", name, num_shards);
+            exit (0);
+        }
+
+        int fds[2];
+        if (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+            printf("Error in creating shard socket: %s\n", strerror (errno));
+            exit (0);
+        }
+
+        // Nothing buffered may be written twice by the child
+        fflush (stdout);
+        pid_t pid = fork ();
+        if (pid < 0) {
+            printf("Error in starting shard: %s\n", strerror (errno));
+            exit (0);
+        }
+
+        if (pid == 0) {
+            close (fds[0]);
+
+            // Only the coordinator talks to the other shards
+            for (int j = 0; j < i; j++) {
+                fclose (shards[j].to);
+                fclose (shards[j].from);
+            }
+
+            struct segment_set* set = segments_open (name, 0);
+            FILE* in = fdopen (fds[1], "r");
+            FILE* out = fdopen (dup (fds[1]), "w");
+            if (set == NULL || in == NULL || out == NULL) {
+                fprintf (stderr, "Error in opening %s\n", name);
+                _exit (0);
+            }
+
+            shard_serve (set, sc, in, out);
+
+            // Leave the coordinator's atexit() handlers to the coordinator
+            fclose (out);
+            fclose (in);
+            segments_close (set);
+            _exit (0);
+        }
+
+        close (fds[1]);
+        shards[i].pid = pid;
+        shards[i].from = fdopen (fds[0], "r");
+        int out_fd = dup (fds[0]);
+        shards[i].to = out_fd < 0 ? NULL : fdopen (out_fd, "w");
+        if (shards[i].from == NULL || shards[i].to == NULL) {
+            printf("Error in opening shard stream: %s\n", strerror (errno));
+            exit (0);
+        }
+        free (name);
+    }
+
+    // Leaving shards out would silently drop their documents
+    char* extra = shard_path (path, num_shards);
+    if (access (extra, F_OK) == 0) {
+        printf("Error: the index has more than %d shards\n", num_shards);
+        exit (0);
+    }
+    free (extra);
+
+    // Every shard opens its index at once, then introduces itself
+    for (int i = 0; i < num_shards; i++) {
+        read_doc_table (pool, i);
+    }
+
+    return pool;
+}
+
+/**
+ * Closes every shard's socket, waits for the processes to exit and frees the pool.
+ * @param pool pointer to the pool
+ */
+void shards_stop (struct shard_pool* pool) {
+    for (int i = 0; i < pool->num_shards; i++) {
+        fclose (pool->shards[i].to);
+        fclose (pool->shards[i].from);
+    }
+    for (int i = 0; i < pool->num_shards; i++) {
+        waitpid (pool->shards[i].pid, NULL, 0);
+    }
+
+    doc_table_destroy (pool->docs, pool->num_docs);
+    pthread_mutex_destroy (&pool->lock);
+    free (pool->shards);
+    free (pool);
+}
+
+/**
+ * A word some shard expanded a wildcard to, with its df on that shard.
+ */
+struct shard_word {
+    char* word;
+    uint64_t df;
+};
+
+/**
+ * Orders shard words by word, for qsort().
+ * @param  a pointer to the first shard word
+ * @param  b pointer to the second shard word
+ * @return negative, zero or positive as a sorts before, with or after b
+ */
+static int shard_word_comparator (const void* a, const void* b) {
+    return strcmp (((const struct shard_word*) a)->word, ((const struct shard_word*) b)->word);
+}
+
+/**
+ * Asks every shard for the words each wildcard of a query matches and keeps the
+ * first QUERY_MAX_EXPANSIONS of each in sorted order, the same words an
+ * unsharded index would expand it to. A fuzzy word's words are then picked and
+ * weighted as the unsharded index would, with their dfs summed over the shards.
+ * @param pool  pointer to the pool, locked
+ * @param line  the query on one line
+ * @param q     pointer to the query parsed from it, not yet expanded
+ * @param e     pointer to the expansions to fill in, free them with expansions_free()
+ */
+static void gather_expansions (struct shard_pool* pool, const char* line, const struct query* q,
+        struct expansions* e) {
+    for (int i = 0; i < pool->num_shards; i++) {
+        fprintf (pool->shards[i].to, "E %s\n", line);
+        fflush (pool->shards[i].to);
+    }
+
+    size_t size = QUERY_MAX_EXPANSIONS * pool->num_shards + 1;
+    char** replies = (char**) calloc (pool->num_shards, sizeof (char*));
+    char** pos = (char**) malloc (pool->num_shards * sizeof (char*));
+    struct shard_word* found = (struct shard_word*) malloc (size * sizeof (struct shard_word));
+    char** words = (char**) malloc (size * sizeof (char*));
+    uint64_t* df = (uint64_t*) malloc (size * sizeof (uint64_t));
+    double* weights = (double*) malloc (size * sizeof (double));
+
+    // Check for allocation errors
+    if (replies == NULL || pos == NULL || found == NULL || words == NULL || df == NULL || weights == NULL) {
+        printf("Error: unable to allocate memory for wildcard words\n");
+        exit (0);
+    }
+
+    // Each reply is one line, after whatever the last reply left unread of its line
+    for (int i = 0; i < pool->num_shards; i++) {
+        size_t cap = 0;
+        if (fscanf (pool->shards[i].from, " ") != 0 || getline (&replies[i], &cap, pool->shards[i].from) == -1) {
+            shard_failed (i);
+        }
+        pos[i] = replies[i];
+    }
+
+    expansions_init (e, q->num_wildcards, q->num_wildcards * QUERY_MAX_EXPANSIONS);
+    for (int w = 0; w < q->num_wildcards; w++) {
+        const struct query_wildcard* wildcard = &q->wildcards[w];
+        int with_df = wildcard->distance > 0 && pool->fuzzy == FUZZY_BEST;
+
+        // Words of this wildcard from every shard, cut out of the replies in place
+        int n = 0;
+        for (int i = 0; i < pool->num_shards; i++) {
+            char* end;
+            long count = strtol (pos[i], &end, 10);
+            if (end == pos[i] || count < 0 || count > QUERY_MAX_EXPANSIONS) {
+                shard_failed (i);
+            }
+            pos[i] = end;
+            for (long j = 0; j < count; j++) {
+                pos[i] += *pos[i] == ' ';
+                size_t len = strcspn (pos[i], " \n");
+                if (len == 0) {
+                    shard_failed (i);
+                }
+                found[n].word = pos[i];
+                pos[i] += len;
+                if (*pos[i] != '\0') {
+                    *pos[i]++ = '\0';
+                }
+                found[n].df = with_df ? strtoull (pos[i], &pos[i], 10) : 0;
+                n++;
+            }
+        }
+
+        // Sorted, each word once with its df over every shard
+        qsort (found, n, sizeof (struct shard_word), shard_word_comparator);
+        int num_words = 0;
+        for (int j = 0; j < n; j++) {
+            if (num_words > 0 && strcmp (words[num_words - 1], found[j].word) == 0) {
+                df[num_words - 1] += found[j].df;
+            } else if (num_words == QUERY_MAX_EXPANSIONS) {
+                break;
+            } else {
+                words[num_words] = found[j].word;
+                df[num_words++] = found[j].df;
+            }
+        }
+
+        num_words = query_select_words (wildcard, pool->fuzzy, words, df, num_words, weights);
+        for (int j = 0; j < num_words; j++) {
+            expansions_add (e, w, words[j], strlen (words[j]), weights[j]);
+        }
+    }
+
+    for (int i = 0; i < pool->num_shards; i++) {
+        free (replies[i]);
+    }
+    free (replies);
+    free (pos);
+    free (found);
+    free (words);
+    free (df);
+    free (weights);
+}
+
+/**
+ * Scores a query on every shard with the statistics of the whole collection and
+ * merges their top k. Ranks and scores the same as the unsharded index would.
+ * Safe to call from several threads, queries are answered one at a time.
+ * @param  pool         pointer to the pool
+ * @param  query        the query as typed, not yet parsed
+ * @param  k            number of top results wanted, 0 ranks every match
+ * @param  num_results  set to the number of ranked entries at the front of the array
+ * @param  stats        counters to add every shard's work to, may be NULL
+ * @return array of relevancy scores numbered across the shards, free it when done
+ */
+struct relevancy_score* shards_score (struct shard_pool* pool, const char* query, int k, int* num_results,
+        struct query_stats* stats) {
+    // Requests are one line each, so the query must be too
+    char* line = strdup (query);
+
+    // Check for allocation errors
+    if (line == NULL) {
+        printf("Error: unable to allocate memory for query\n");
+        exit (0);
+    }
+
+    for (char* c = line; *c != '\0'; c++) {
+        if (*c == '\n' || *c == '\r') {
+            *c = ' ';
+        }
+    }
+
+    // Parse a copy the way the shards will, to learn how many terms there are
+    char* copy = strdup (line);
+
+    // Check for allocation errors
+    if (copy == NULL) {
+        printf("Error: unable to allocate memory for query\n");
+        exit (0);
+    }
+
+    // The shards would refuse a query too long to parse, it matches nothing
+    struct query q;
+    if (query_parse (copy, &q) != 0) {
+        free (copy);
+        free (line);
+        struct relevancy_score* scores = (struct relevancy_score*) malloc (sizeof (struct relevancy_score));
+
+        // Check for allocation errors
+        if (scores == NULL) {
+            printf("Error: unable to allocate memory for shard results\n");
+            exit (0);
+        }
+        *num_results = 0;
+        return scores;
+    }
+
+    pthread_mutex_lock (&pool->lock);
+
+    // Expand the wildcards with the words of every shard, then send every shard the
+    // same words so they all score the same terms
+    struct expansions e;
+    if (q.num_wildcards > 0) {
+        gather_expansions (pool, line, &q, &e);
+    } else {
+        expansions_init (&e, 0, 0);
+    }
+    expansions_apply (&e, &q);
+    int num_terms = q.num_terms;
+    query_free (&q);
+    free (copy);
+
+    uint64_t* df = (uint64_t*) calloc (num_terms + 1, sizeof (uint64_t));
+
+    // Check for allocation errors
+    if (df == NULL) {
+        printf("Error: unable to allocate memory for collection statistics\n");
+        exit (0);
+    }
+
+    // Gather: sum every shard's statistics into the whole collection's
+    for (int i = 0; i < pool->num_shards; i++) {
+        fprintf (pool->shards[i].to, "S ");
+        expansions_write (pool->shards[i].to, &e);
+        fprintf (pool->shards[i].to, " %s\n", line);
+        fflush (pool->shards[i].to);
+    }
+
+    unsigned long num_docs = 0;
+    unsigned long total_length = 0;
+    for (int i = 0; i < pool->num_shards; i++) {
+        unsigned long shard_docs, shard_length;
+        if (fscanf (pool->shards[i].from, "%lu %lu", &shard_docs, &shard_length) != 2) {
+            shard_failed (i);
+        }
+        num_docs += shard_docs;
+        total_length += shard_length;
+
+        for (int j = 0; j < num_terms; j++) {
+            unsigned long shard_df;
+            if (fscanf (pool->shards[i].from, "%lu", &shard_df) != 1) {
+                shard_failed (i);
+            }
+            df[j] += shard_df;
+        }
+    }
+
+    // Scatter the query with the collection's statistics, every shard scores at once
+    for (int i = 0; i < pool->num_shards; i++) {
+        FILE* to = pool->shards[i].to;
+        fprintf (to, "Q %d %lu %lu ", k, num_docs, total_length);
+        expansions_write (to, &e);
+        fprintf (to, " %d", num_terms);
+        for (int j = 0; j < num_terms; j++) {
+            fprintf (to, " %lu", (unsigned long) df[j]);
+        }
+        fprintf (to, " %s\n", line);
+        fflush (to);
+    }
+
+    // Merge: each shard's top k holds every one of its documents in the overall top k
+    struct relevancy_score* scores = NULL;
+    int num_scores = 0;
+    for (int i = 0; i < pool->num_shards; i++) {
+        const struct shard* shard = &pool->shards[i];
+        int n;
+        unsigned long scored, pruned, decoded, total;
+        if (fscanf (shard->from, "%d %lu %lu %lu %lu", &n, &scored, &pruned, &decoded, &total) != 5 || n < 0) {
+            shard_failed (i);
+        }
+        if (stats != NULL) {
+            stats->docs_scored += scored;
+            stats->docs_pruned += pruned;
+            stats->postings_decoded += decoded;
+            stats->postings_total += total;
+        }
+
+        scores = (struct relevancy_score*) realloc (scores, (num_scores + n + 1) * sizeof (struct relevancy_score));
+
+        // Check for allocation errors
+        if (scores == NULL) {
+            printf("Error: unable to allocate memory for shard results\n");
+            exit (0);
+        }
+
+        for (int r = 0; r < n; r++) {
+            unsigned int doc;
+            double score;
+            if (fscanf (shard->from, "%u %la", &doc, &score) != 2 || doc >= shard->num_docs) {
+                shard_failed (i);
+            }
+            scores[num_scores].doc = shard->base + doc;
+            scores[num_scores].score = score;
+            num_scores++;
+        }
+    }
+
+    pthread_mutex_unlock (&pool->lock);
+
+    // Same ranking as one index, equal scores go to the lower document number
+    *num_results = top_k (scores, num_scores, k > 0 ? k : num_scores);
+
+    expansions_free (&e);
+    free (df);
+    free (line);
+    return scores;
+}
+
+/**
+ * Ranks a query across the shards and outputs results.
+ * @param pool   pointer to the pool
+ * @param query  the query as typed, not yet parsed
+ * @param k      number of top results to write, 0 writes every match
+ * @param stats  counters to add every shard's work to, may be NULL
+ */
+void shards_rank (struct shard_pool* pool, const char* query, int k, struct query_stats* stats) {
+    int num_results;
+    struct relevancy_score* scores = shards_score (pool, query, k, &num_results, stats);
+
+    output_results (pool->docs, scores, num_results);
+
+    free (scores);
+}
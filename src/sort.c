@@ -10,29 +10,123 @@
 #include "hashtable.h"
 #include "infoRetrieval.h"
 #include "sort.h"
+#include "stats.h"
 
 /**
  * Function to compare to relevancy_score structs according to their scores.
+ * Equal scores are ordered by doc so the ranking is the same on every run.
  * @param  a relevancy_score 1
  * @param  b relevancy_score 2
- * @return negative number if a->score > b->score
- *         positive number if a->score < b->score
- *         and 0 if a->score = b->score
+ * @return negative number if a ranks before b (higher score, or same score and lower doc)
+ *         positive number if a ranks after b
+ *         and 0 if a and b are the same document
  */
 int comparator (const void* a, const void* b)
 {
-    // Since comparator() requires an int to be returned, need to multiply scores by 1 million
-    // to get an int that we can compare
-    int s1 = (int) ( ((struct relevancy_score*) a)->score * 1000000 );
-    int s2 = (int) ( ((struct relevancy_score*) b)->score * 1000000 );
-    return (s2 - s1);
+    const struct relevancy_score* s1 = (const struct relevancy_score*) a;
+    const struct relevancy_score* s2 = (const struct relevancy_score*) b;
+
+    if (s1->score != s2->score) {
+        return s1->score > s2->score ? -1 : 1;
+    }
+    if (s1->doc != s2->doc) {
+        return s1->doc < s2->doc ? -1 : 1;
+    }
+    return 0;
 }
 
 /**
  * Function to sort an array of relevancy_score structs.
- * @param ht      pointer to the hashtable
- * @param scores array to sort
+ * @param scores    array to sort
+ * @param num_docs  number of entries in scores
+ */
+void sort (struct relevancy_score* scores, int num_docs) {
+    qsort ((void*) scores, num_docs, sizeof (struct relevancy_score), comparator);
+}
+
+/**
+ * Moves heap[i] down until neither child ranks after it. The root of the heap is
+ * the entry that ranks last, the one a better score replaces.
+ * @param heap  array holding the heap
+ * @param n     number of entries in the heap
+ * @param i     index of the entry to move
+ */
+static void sift_down (struct relevancy_score* heap, int n, int i) {
+    struct relevancy_score moving = heap[i];
+
+    while (2 * i + 1 < n) {
+        int child = 2 * i + 1;
+        if (child + 1 < n && comparator (&heap[child + 1], &heap[child]) > 0) {
+            child++;
+        }
+        if (comparator (&heap[child], &moving) <= 0) {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = moving;
+}
+
+/**
+ * Offers an entry to a bounded heap of the best k entries seen so far, as kept by
+ * top_k(). The root, heap[0], is the entry that ranks last.
+ * @param  heap   array of at least k entries holding the heap
+ * @param  size   number of entries in the heap, updated
+ * @param  k      largest size of the heap
+ * @param  entry  the entry to offer
+ * @return 1 if the entry was kept, 0 if it ranks after all k entries
+ */
+int top_k_push (struct relevancy_score* heap, int* size, int k, struct relevancy_score entry) {
+    if (*size < k) {
+        // Move the new entry up while it ranks after its parent
+        int i = (*size)++;
+        while (i > 0 && comparator (&entry, &heap[(i - 1) / 2]) > 0) {
+            heap[i] = heap[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+        heap[i] = entry;
+        return 1;
+    }
+    if (k == 0 || comparator (&entry, &heap[0]) >= 0) {
+        return 0;
+    }
+    heap[0] = entry;
+    sift_down (heap, k, 0);
+    return 1;
+}
+
+/**
+ * Moves the k best entries to the front of scores in ranked order, keeping a
+ * bounded heap of the best k seen so far. The rest of the array is left unordered.
+ * @param  scores    array to select from
+ * @param  num_docs  number of entries in scores
+ * @param  k         number of entries wanted
+ * @return number of entries now ranked at the front, the smaller of k and num_docs
  */
-void sort (struct hashtable* ht, struct relevancy_score* scores) {
-    qsort ((void*) scores, ht->num_docs, sizeof (struct relevancy_score), comparator);
+int top_k (struct relevancy_score* scores, int num_docs, int k) {
+    if (k <= 0 || num_docs <= 0) {
+        return 0;
+    }
+
+    double start = stats_begin ();
+    if (k >= num_docs) {
+        sort (scores, num_docs);
+        k = num_docs;
+    } else {
+        // Heapify the first k entries, then let each later entry replace the worst one
+        for (int i = k / 2 - 1; i >= 0; i--) {
+            sift_down (scores, k, i);
+        }
+        for (int i = k; i < num_docs; i++) {
+            if (comparator (&scores[i], &scores[0]) < 0) {
+                scores[0] = scores[i];
+                sift_down (scores, k, 0);
+            }
+        }
+
+        sort (scores, k);
+    }
+    stats_end (STATS_SORT, start);
+    return k;
 }
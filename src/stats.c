@@ -0,0 +1,124 @@
+/**************************************************************************************
+* Jack Umina
+* Created Nov, 2019
+* Optional instrumentation: phase timers and hot path counters, written as JSON.
+***************************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "stats.h"
+
+int stats_enabled = 0;
+__thread struct stats stats_local;
+
+// Totals of every thread that has flushed
+static struct stats stats_total;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char* phase_names[STATS_NUM_PHASES] = {
+    "glob", "train", "index_write", "index_open", "parse", "score", "sort", "output"
+};
+
+static const char* counter_names[STATS_NUM_COUNTERS] = {
+    "hash_lookups", "hash_probes", "strcmp", "postings_scanned", "docs_scored", "bytes_read"
+};
+
+/**
+ * Current time of the monotonic clock.
+ * @return microseconds
+ */
+double stats_now_us (void) {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec * 1e-3;
+}
+
+/**
+ * Starts timing phases. Until then stats_begin() and stats_end() do nothing.
+ */
+void stats_enable (void) {
+    stats_enabled = 1;
+}
+
+/**
+ * Starts timing a phase.
+ * @return the start time to pass to stats_end()
+ */
+double stats_begin (void) {
+    return stats_enabled ? stats_now_us () : 0;
+}
+
+/**
+ * Adds the time since start to a phase. Phases may nest, the time of an inner
+ * phase also counts towards the outer one.
+ * @param phase  the phase that ended
+ * @param start  what stats_begin() returned
+ */
+void stats_end (enum stats_phase phase, double start) {
+    if (stats_enabled) {
+        stats_local.phase_us[phase] += stats_now_us () - start;
+        stats_local.phase_calls[phase]++;
+    }
+}
+
+/**
+ * Adds this thread's stats to the process totals and clears them. Worker threads
+ * call it before they exit.
+ */
+void stats_flush (void) {
+    pthread_mutex_lock (&stats_lock);
+    for (int i = 0; i < STATS_NUM_PHASES; i++) {
+        stats_total.phase_us[i] += stats_local.phase_us[i];
+        stats_total.phase_calls[i] += stats_local.phase_calls[i];
+    }
+    for (int i = 0; i < STATS_NUM_COUNTERS; i++) {
+        stats_total.counters[i] += stats_local.counters[i];
+    }
+    for (int i = 0; i < STATS_PROBE_HIST; i++) {
+        stats_total.probe_hist[i] += stats_local.probe_hist[i];
+    }
+    pthread_mutex_unlock (&stats_lock);
+
+    memset (&stats_local, 0, sizeof (stats_local));
+}
+
+/**
+ * Writes the process totals, after flushing the calling thread, as JSON.
+ * @param f stream to write to
+ */
+void stats_write (FILE* f) {
+    stats_flush ();
+
+    pthread_mutex_lock (&stats_lock);
+#ifdef SEARCH_STATS
+    fprintf (f, "{\n  \"counters_enabled\": true,\n");
+#else
+    fprintf (f, "{\n  \"counters_enabled\": false,\n");
+#endif
+
+    fprintf (f, "  \"phases\": {\n");
+    for (int i = 0; i < STATS_NUM_PHASES; i++) {
+        fprintf (f, "    \"%s\": {\"calls\": %lu, \"us\": %.1f}%s\n", phase_names[i],
+                (unsigned long) stats_total.phase_calls[i], stats_total.phase_us[i],
+                i < STATS_NUM_PHASES - 1 ? "," : "");
+    }
+    fprintf (f, "  },\n");
+
+    fprintf (f, "  \"counters\": {\n");
+    for (int i = 0; i < STATS_NUM_COUNTERS; i++) {
+        fprintf (f, "    \"%s\": %lu%s\n", counter_names[i], (unsigned long) stats_total.counters[i],
+                i < STATS_NUM_COUNTERS - 1 ? "," : "");
+    }
+    fprintf (f, "  },\n");
+
+    // Bucket i counts the lookups that probed i + 1 slots
+    fprintf (f, "  \"probe_lengths\": [");
+    for (int i = 0; i < STATS_PROBE_HIST; i++) {
+        fprintf (f, "%lu%s", (unsigned long) stats_total.probe_hist[i], i < STATS_PROBE_HIST - 1 ? ", " : "");
+    }
+    fprintf (f, "]\n}\n");
+    pthread_mutex_unlock (&stats_lock);
+}
@@ -0,0 +1,187 @@
+/**************************************************************************************
+* Jack Umina
+* Created Nov, 2019
+* Splits blocks of document text into lowercase words. Words are returned as
+* (pointer, length) slices into the block instead of separately allocated strings.
+***************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define TOKENIZER_X86 1
+#endif
+
+#include "tokenizer.h"
+
+/**
+ * Initialize an empty token_list.
+ * @param list pointer to the token_list
+ */
+void token_list_init (struct token_list* list) {
+    list->tokens = NULL;
+    list->num_tokens = 0;
+    list->capacity = 0;
+}
+
+/**
+ * Deallocate the tokens of this token_list.
+ * @param list pointer to the token_list
+ */
+void token_list_destroy (struct token_list* list) {
+    free (list->tokens);
+    token_list_init (list);
+}
+
+/**
+ * Appends the word buf[start..end) to list unless it is empty.
+ * @param list   token_list to append to
+ * @param buf    block of text
+ * @param start  offset of the first byte of the word
+ * @param end    offset one past the last byte of the word
+ */
+static inline void emit (struct token_list* list, const char* buf, size_t start, size_t end) {
+    if (start == end) {
+        return;
+    }
+
+    if (list->num_tokens == list->capacity) {
+        list->capacity = list->capacity == 0 ? 1024 : list->capacity * 2;
+        list->tokens = (struct token*) realloc (list->tokens, list->capacity * sizeof (struct token));
+
+        // Check for allocation errors
+        if (list->tokens == NULL) {
+            printf("Error: unable to allocate memory for tokens\n");
+            exit (0);
+        }
+    }
+
+    list->tokens[list->num_tokens].word = buf + start;
+    list->tokens[list->num_tokens].len = (uint32_t) (end - start);
+    list->num_tokens++;
+}
+
+/**
+ * Emits a word ending at each set bit of a delimiter mask.
+ * @param list    token_list to append to
+ * @param buf     block of text
+ * @param base    offset of the chunk the mask describes
+ * @param mask    bit i set if buf[base + i] is a delimiter
+ * @param start   offset where the current word started, updated
+ */
+static inline void emit_mask (struct token_list* list, const char* buf, size_t base,
+        uint64_t mask, size_t* start) {
+    while (mask != 0) {
+        size_t end = base + __builtin_ctzll (mask);
+        emit (list, buf, *start, end);
+        *start = end + 1;
+        mask &= mask - 1;
+    }
+}
+
+/**
+ * Scalar version, also used for the tail of a block shorter than one vector.
+ * @param buf    block of text, modified in place
+ * @param from   offset to start at
+ * @param len    number of bytes in buf
+ * @param list   token_list to append to
+ * @param start  offset where the current word started, updated
+ */
+static void tokenize_scalar (char* buf, size_t from, size_t len, struct token_list* list, size_t* start) {
+    for (size_t i = from; i < len; i++) {
+        char c = buf[i];
+        if (c == ' ' || c == '\n') {
+            emit (list, buf, *start, i);
+            *start = i + 1;
+        } else if (c >= 'A' && c <= 'Z') {
+            buf[i] = c + ('a' - 'A');
+        }
+    }
+}
+
+#ifdef TOKENIZER_X86
+
+/**
+ * SSE2 version, 16 bytes at a time. Lowercases with signed compares, which
+ * leave bytes >= 0x80 alone, and gathers delimiters into a bit mask.
+ * @return offset of the first byte not processed
+ */
+static size_t tokenize_sse2 (char* buf, size_t len, struct token_list* list, size_t* start) {
+    const __m128i upper_lo = _mm_set1_epi8 ('A' - 1);
+    const __m128i upper_hi = _mm_set1_epi8 ('Z' + 1);
+    const __m128i case_bit = _mm_set1_epi8 (0x20);
+    const __m128i space = _mm_set1_epi8 (' ');
+    const __m128i newline = _mm_set1_epi8 ('\n');
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128 ((const __m128i*) (buf + i));
+        __m128i upper = _mm_and_si128 (_mm_cmpgt_epi8 (v, upper_lo), _mm_cmplt_epi8 (v, upper_hi));
+        _mm_storeu_si128 ((__m128i*) (buf + i), _mm_or_si128 (v, _mm_and_si128 (upper, case_bit)));
+
+        __m128i delim = _mm_or_si128 (_mm_cmpeq_epi8 (v, space), _mm_cmpeq_epi8 (v, newline));
+        emit_mask (list, buf, i, (uint32_t) _mm_movemask_epi8 (delim), start);
+    }
+    return i;
+}
+
+/**
+ * AVX2 version, 32 bytes at a time. Same approach as tokenize_sse2().
+ * @return offset of the first byte not processed
+ */
+__attribute__ ((target ("avx2")))
+static size_t tokenize_avx2 (char* buf, size_t len, struct token_list* list, size_t* start) {
+    const __m256i upper_lo = _mm256_set1_epi8 ('A' - 1);
+    const __m256i upper_hi = _mm256_set1_epi8 ('Z' + 1);
+    const __m256i case_bit = _mm256_set1_epi8 (0x20);
+    const __m256i space = _mm256_set1_epi8 (' ');
+    const __m256i newline = _mm256_set1_epi8 ('\n');
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256 ((const __m256i*) (buf + i));
+        __m256i upper = _mm256_and_si256 (_mm256_cmpgt_epi8 (v, upper_lo), _mm256_cmpgt_epi8 (upper_hi, v));
+        _mm256_storeu_si256 ((__m256i*) (buf + i), _mm256_or_si256 (v, _mm256_and_si256 (upper, case_bit)));
+
+        __m256i delim = _mm256_or_si256 (_mm256_cmpeq_epi8 (v, space), _mm256_cmpeq_epi8 (v, newline));
+        emit_mask (list, buf, i, (uint32_t) _mm256_movemask_epi8 (delim), start);
+    }
+    return i;
+}
+
+#endif
+
+/**
+ * Lowercases ASCII letters in buf in place and appends every word, delimited by
+ * ' ' or '\n', to list. Empty words between repeated delimiters are skipped.
+ * Uses AVX2 or SSE2 when the CPU has them and a scalar loop otherwise.
+ * @param  buf     block of text, modified in place
+ * @param  len     number of bytes in buf
+ * @param  at_eof  non-zero if nothing follows buf, so its last word is complete
+ * @param  list    token_list to append to, its slices point into buf
+ * @return number of bytes consumed; when !at_eof, buf[return..len) is an unfinished
+ *         word that must be carried over to the start of the next block
+ */
+size_t tokenize (char* buf, size_t len, int at_eof, struct token_list* list) {
+    size_t start = 0;
+    size_t i = 0;
+
+#ifdef TOKENIZER_X86
+    if (__builtin_cpu_supports ("avx2")) {
+        i = tokenize_avx2 (buf, len, list, &start);
+    } else {
+        i = tokenize_sse2 (buf, len, list, &start);
+    }
+#endif
+
+    tokenize_scalar (buf, i, len, list, &start);
+
+    // The last word is only complete if the file ends here
+    if (at_eof) {
+        emit (list, buf, start, len);
+        return len;
+    }
+    return start;
+}